@@ -0,0 +1,112 @@
+// Times the on-device dithering kernel on the host, and compares it with the radio time
+// saved by downloading the rain grid instead of the full frame.
+//
+// usage: dither_bench [frames] [throughput_kB_per_s]
+//
+// Host cycles aren't RP2040 cycles, this is for comparing changes to the kernel and a first
+// sanity check. The "dither" phase in the firmware's profiler table is the real number.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#include "dither.hpp"
+
+namespace
+{
+    constexpr int GRID_WIDTH = 200;
+    constexpr int GRID_HEIGHT = 120;
+    // the default board's panel, the ditherer is built for it
+    constexpr int WIDTH = board::WIDTH;
+    constexpr int HEIGHT = board::HEIGHT;
+
+    // a few blobs of rain getting heavier towards their middles, and a patch of snow
+    std::vector<uint8_t> make_grid()
+    {
+        struct Blob
+        {
+            float x, y, r;
+        };
+        const Blob blobs[] = {{40, 30, 25}, {120, 70, 40}, {170, 20, 15}, {80, 100, 20}};
+        std::vector<uint8_t> grid(GRID_WIDTH * GRID_HEIGHT, 0);
+        for (int y = 0; y < GRID_HEIGHT; y++)
+        {
+            for (int x = 0; x < GRID_WIDTH; x++)
+            {
+                float best = 0;
+                for (const Blob &b : blobs)
+                {
+                    float const d = std::hypot(x - b.x, y - b.y) / b.r;
+                    if (d < 1)
+                    {
+                        best = std::fmax(best, 1 - d);
+                    }
+                }
+                uint8_t v = best > 0 ? (uint8_t)(dither::INTENSITY_MIN + best * (127 - dither::INTENSITY_MIN)) : 0;
+                if (x > 180 && y > 100)
+                {
+                    v = dither::SNOW_BIT | 40;
+                }
+                grid[y * GRID_WIDTH + x] = v;
+            }
+        }
+        return grid;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int const frames = argc > 1 ? atoi(argv[1]) : 200;
+    double const throughput_kBps = argc > 2 ? atof(argv[2]) : 60.0;
+
+    std::vector<uint8_t> const grid = make_grid();
+    std::vector<uint8_t> row(WIDTH);
+    static dither::PanelDitherer ditherer;
+
+    uint64_t checksum = 0;
+    size_t rain_pixels = 0;
+    auto const start = std::chrono::steady_clock::now();
+#if HAVE_RDTSC
+    uint64_t const start_tsc = __rdtsc();
+#endif
+    for (int f = 0; f < frames; f++)
+    {
+        ditherer.begin(grid.data(), GRID_WIDTH, GRID_HEIGHT);
+        while (ditherer.next_row(row.data()))
+        {
+            for (uint8_t c : row)
+            {
+                checksum = checksum * 31 + c;
+                rain_pixels += f == 0 && c != dither::TRANSPARENT;
+            }
+        }
+    }
+#if HAVE_RDTSC
+    uint64_t const cycles = __rdtsc() - start_tsc;
+#endif
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double const ms_per_frame = seconds * 1000 / frames;
+    printf("frames,%d\n", frames);
+    printf("rain_pixels,%zu\n", rain_pixels);
+    printf("checksum,%016llx\n", (unsigned long long)checksum);
+    printf("ms_per_frame,%.3f\n", ms_per_frame);
+#if HAVE_RDTSC
+    printf("host_cycles_per_pixel,%.1f\n", (double)cycles / frames / (WIDTH * HEIGHT));
+#endif
+
+    // what the radio no longer has to receive: quantized.bin is a byte per pixel,
+    // rain_grid.bin a byte per cell plus a 16 byte header
+    double const full_bytes = WIDTH * HEIGHT;
+    double const grid_bytes = GRID_WIDTH * GRID_HEIGHT + 16;
+    double const saved_ms = (full_bytes - grid_bytes) / (throughput_kBps * 1000) * 1000;
+    printf("radio_ms_saved_at_%.0fkBps,%.1f\n", throughput_kBps, saved_ms);
+    return 0;
+}
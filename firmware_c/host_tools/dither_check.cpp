@@ -0,0 +1,85 @@
+// Checks the device's colour ramp against the server's intensity_to_color for every
+// intensity, so the rain the device dithers itself comes out the colours the server's would.
+//
+// usage: dither_check
+//
+// The server's arithmetic is copied here as is, floats and all. Exits non-zero on a mismatch.
+
+#include <cstdio>
+
+#include "dither.hpp"
+
+namespace
+{
+    struct Stop
+    {
+        int intensity;
+        int r, g, b;
+    };
+
+    // server/main.py's color_stops
+    constexpr Stop STOPS[] = {
+        {0, 0, 0, 0},
+        {10, 0, 255, 0},
+        {30, 0, 0, 255},
+        {50, 255, 255, 0},
+        {70, 255, 140, 0},
+        {100, 255, 0, 0},
+        {127, 255, 255, 255},
+    };
+    constexpr int INTENSITY_MAX = 127;
+
+    // lerp_color: int(c1 + (c2 - c1) * t)
+    int lerp(int c1, int c2, double t)
+    {
+        return (int)(c1 + (c2 - c1) * t);
+    }
+
+    void server_colour(int intensity, int rgb[3])
+    {
+        for (size_t i = 0; i + 1 < sizeof(STOPS) / sizeof(STOPS[0]); i++)
+        {
+            const Stop &a = STOPS[i];
+            const Stop &b = STOPS[i + 1];
+            if (a.intensity <= intensity && intensity <= b.intensity)
+            {
+                double const t = (double)(intensity - a.intensity) / (b.intensity - a.intensity);
+                rgb[0] = lerp(a.r, b.r, t);
+                rgb[1] = lerp(a.g, b.g, t);
+                rgb[2] = lerp(a.b, b.b, t);
+                return;
+            }
+        }
+    }
+}
+
+int main()
+{
+    int mismatches = 0;
+    for (int intensity = 0; intensity <= INTENSITY_MAX; intensity++)
+    {
+        bool const server_rain = intensity >= dither::INTENSITY_MIN;
+        bool const device_rain = dither::nearest_colour((uint8_t)intensity) != dither::TRANSPARENT;
+        if (server_rain != device_rain)
+        {
+            printf("%3d: server %s rain, device %s\n", intensity, server_rain ? "draws" : "doesn't draw", device_rain ? "does" : "doesn't");
+            mismatches++;
+            continue;
+        }
+        if (!server_rain)
+        {
+            continue;
+        }
+        int expected[3];
+        uint8_t got[3];
+        server_colour(intensity, expected);
+        dither::ramp_colour((uint8_t)intensity, got);
+        if (expected[0] != got[0] || expected[1] != got[1] || expected[2] != got[2])
+        {
+            printf("%3d: server %d,%d,%d, device %d,%d,%d\n", intensity, expected[0], expected[1], expected[2], got[0], got[1], got[2]);
+            mismatches++;
+        }
+    }
+    printf("%d of %d intensities differ from the server\n", mismatches, INTENSITY_MAX + 1);
+    return mismatches ? 1 : 0;
+}
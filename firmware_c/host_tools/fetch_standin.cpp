@@ -0,0 +1,681 @@
+// A stand-in for the frame server on localhost, over TLS, and a fleet of frames to load it
+// with. Each frame makes the request fetch_image does: connect, a TLS 1.2 handshake asking
+// for 4 KB records, then lwIP httpc's GET for /N/quantized.bin with the telemetry query,
+// reading until the server closes. The frames wake as schedule.hpp has them, spread over the
+// jitter window after the 10 minute boundary, with the time it takes them to join the network
+// on top. The window and the joins are sped up by --speedup, the transfers aren't.
+//
+// usage: fetch_standin [options]
+//   --fleets 10,50,100,250   fleet sizes to run, one update boundary each
+//   --window-s 120           the wake jitter window, RAIN_RADAR_WAKE_JITTER_S
+//   --speedup 20             how much faster than real time the wakes come
+//   --file quantized.bin     what each frame asks for
+//   --dir DIR                serve files from here, else a frame's worth of made up bytes
+//   --latency-ms 0           wait before answering each request
+//   --kbytes-per-s 0         cap each connection's body at this, 0 for no cap
+//   --truncate-pct 0         close this many bodies halfway through
+//   --error-pct 0            answer this many with a 503 and a Retry-After
+//   --port 8443
+//   --serve                  only run the server, until killed
+//   --connect HOST           only run the fleets, against a server at HOST:port
+//
+// Prints a csv row per fleet size. Time to first byte on the server is from accepting the
+// connection to the first byte of the body going out, so it includes the handshake, and its
+// throughput is every body's bytes over the time from the first body starting to the last
+// one finishing. On the frames it's from starting to connect, and each body's own rate.
+// Against --connect only the client side columns are filled in.
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <arpa/inet.h>
+#include <csignal>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "board.hpp"
+#include "schedule.hpp"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // what lwIP's httpc sends, see HTTPC_REQ_11_HOST
+    constexpr const char *USER_AGENT = "lwIP/2.2.0 (http://savannah.nongnu.org/projects/lwip)";
+    constexpr const char *HOST_NAME = "muse-hub.taile8f45.ts.net";
+    constexpr uint32_t RETRY_AFTER_S = 30;
+    // the firmware's receive window is about this, so the server writes in pieces this size
+    constexpr size_t WRITE_CHUNK = 4096;
+
+    struct Options
+    {
+        std::vector<int> fleets = {10, 50, 100, 250};
+        uint32_t window_s = 120;
+        double speedup = 20;
+        std::string file = "quantized.bin";
+        std::string dir;
+        uint32_t latency_ms = 0;
+        uint32_t kbytes_per_s = 0;
+        int truncate_pct = 0;
+        int error_pct = 0;
+        uint16_t port = 8443;
+        bool serve_only = false;
+        std::string connect_host;
+    };
+
+    double ms_between(Clock::time_point a, Clock::time_point b)
+    {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    }
+
+    double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty())
+        {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        size_t const i = std::min(values.size() - 1, (size_t)(p / 100 * values.size()));
+        return values[i];
+    }
+
+    // Server
+
+    struct ServedRequest
+    {
+        double ttfb_ms;
+        Clock::time_point body_start;
+        Clock::time_point body_end;
+        size_t bytes;
+        int status;
+    };
+
+    class Server
+    {
+    public:
+        explicit Server(const Options &options) : options(options) {}
+
+        bool start();
+        void stop();
+
+        std::vector<ServedRequest> take_stats()
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            return std::move(stats);
+        }
+
+    private:
+        const Options &options;
+        SSL_CTX *ctx = nullptr;
+        int listen_fd = -1;
+        std::thread accept_thread;
+        std::atomic<bool> running{false};
+        std::mutex stats_mutex;
+        std::vector<ServedRequest> stats;
+        std::mutex rng_mutex;
+        std::mt19937 rng{1};
+        std::vector<uint8_t> made_up;
+
+        void accept_loop();
+        void serve(int fd, Clock::time_point accepted);
+        bool roll(int pct);
+        bool body_for(const std::string &path, std::vector<uint8_t> &body);
+    };
+
+    // a throwaway P-256 key and self-signed cert, the frames don't check it
+    bool make_identity(SSL_CTX *ctx)
+    {
+        EVP_PKEY *key = EVP_EC_gen("P-256");
+        X509 *cert = X509_new();
+        if (!key || !cert)
+        {
+            return false;
+        }
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME *name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)HOST_NAME, -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        bool const ok = X509_sign(cert, key, EVP_sha256()) && SSL_CTX_use_certificate(ctx, cert) == 1 &&
+                        SSL_CTX_use_PrivateKey(ctx, key) == 1;
+        X509_free(cert);
+        EVP_PKEY_free(key);
+        return ok;
+    }
+
+    bool Server::start()
+    {
+        ctx = SSL_CTX_new(TLS_server_method());
+        if (!ctx || !make_identity(ctx))
+        {
+            fprintf(stderr, "Couldn't set up TLS\n");
+            ERR_print_errors_fp(stderr);
+            return false;
+        }
+        made_up.resize(board::PIXELS);
+        for (size_t i = 0; i < made_up.size(); i++)
+        {
+            made_up[i] = i / board::WIDTH % board::ACTIVE.colours;
+        }
+
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int const one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(options.port);
+        if (bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 1024) != 0)
+        {
+            perror("Couldn't listen");
+            return false;
+        }
+        running = true;
+        accept_thread = std::thread(&Server::accept_loop, this);
+        return true;
+    }
+
+    void Server::stop()
+    {
+        running = false;
+        shutdown(listen_fd, SHUT_RDWR);
+        close(listen_fd);
+        if (accept_thread.joinable())
+        {
+            accept_thread.join();
+        }
+        SSL_CTX_free(ctx);
+    }
+
+    void Server::accept_loop()
+    {
+        while (running)
+        {
+            int const fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                continue;
+            }
+            // the head and the body go in separate writes, don't let Nagle hold the body
+            // back for the frame's delayed ack
+            int const one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            std::thread(&Server::serve, this, fd, Clock::now()).detach();
+        }
+    }
+
+    bool Server::roll(int pct)
+    {
+        std::lock_guard<std::mutex> lock(rng_mutex);
+        return (int)(rng() % 100) < pct;
+    }
+
+    // /N/file?query, N being the SSID index
+    bool Server::body_for(const std::string &path, std::vector<uint8_t> &body)
+    {
+        std::string file = path.substr(0, path.find('?'));
+        size_t const slash = file.find('/', 1);
+        file = slash == std::string::npos ? file.substr(1) : file.substr(slash + 1);
+        if (options.dir.empty())
+        {
+            body = made_up;
+            return true;
+        }
+        if (file.find("..") != std::string::npos)
+        {
+            return false;
+        }
+        std::ifstream in(options.dir + "/" + file, std::ios::binary);
+        if (!in)
+        {
+            return false;
+        }
+        body.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    void Server::serve(int fd, Clock::time_point accepted)
+    {
+        SSL *ssl = SSL_new(ctx);
+        SSL_set_fd(ssl, fd);
+        ServedRequest served = {};
+        char request[1024];
+        size_t request_len = 0;
+        if (SSL_accept(ssl) == 1)
+        {
+            // the whole request, up to the blank line
+            while (request_len < sizeof(request) - 1)
+            {
+                int const n = SSL_read(ssl, request + request_len, sizeof(request) - 1 - request_len);
+                if (n <= 0)
+                {
+                    break;
+                }
+                request_len += n;
+                request[request_len] = '\0';
+                if (strstr(request, "\r\n\r\n"))
+                {
+                    break;
+                }
+            }
+        }
+        request[request_len] = '\0';
+
+        char method[8] = "";
+        char path[512] = "";
+        if (request_len && sscanf(request, "%7s %511s", method, path) == 2)
+        {
+            if (options.latency_ms)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(options.latency_ms));
+            }
+            char date[64];
+            time_t const now = time(nullptr);
+            strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&now));
+
+            std::vector<uint8_t> body;
+            char head[256];
+            if (roll(options.error_pct))
+            {
+                served.status = 503;
+                snprintf(head, sizeof(head), "HTTP/1.1 503 Service Unavailable\r\nDate: %s\r\nRetry-After: %u\r\n"
+                         "Content-Length: 0\r\nConnection: close\r\n\r\n", date, RETRY_AFTER_S);
+            }
+            else if (strcmp(method, "GET") != 0 || !body_for(path, body))
+            {
+                served.status = 404;
+                snprintf(head, sizeof(head), "HTTP/1.1 404 Not Found\r\nDate: %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", date);
+            }
+            else
+            {
+                served.status = 200;
+                snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nDate: %s\r\nContent-Type: application/octet-stream\r\n"
+                         "Content-Length: %zu\r\nConnection: close\r\n\r\n", date, body.size());
+            }
+            SSL_write(ssl, head, strlen(head));
+
+            size_t const send_len = roll(options.truncate_pct) ? body.size() / 2 : body.size();
+            served.body_start = Clock::now();
+            while (served.bytes < send_len)
+            {
+                size_t const n = std::min(WRITE_CHUNK, send_len - served.bytes);
+                if (SSL_write(ssl, body.data() + served.bytes, n) <= 0)
+                {
+                    break;
+                }
+                if (!served.bytes)
+                {
+                    served.ttfb_ms = ms_between(accepted, Clock::now());
+                }
+                served.bytes += n;
+                if (options.kbytes_per_s)
+                {
+                    // hold each connection to the cap, however fast the last chunk went
+                    auto const due = served.body_start + std::chrono::microseconds(served.bytes * 1000 / options.kbytes_per_s);
+                    std::this_thread::sleep_until(due);
+                }
+            }
+            served.body_end = Clock::now();
+            if (!served.bytes)
+            {
+                served.ttfb_ms = ms_between(accepted, Clock::now());
+            }
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                stats.push_back(served);
+            }
+            if (options.serve_only)
+            {
+                printf("%s %d %zu bytes, first byte %.1f ms\n", path, served.status, served.bytes, served.ttfb_ms);
+                fflush(stdout);
+            }
+        }
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        close(fd);
+    }
+
+    // The fleet
+
+    struct Fetch
+    {
+        bool connected = false;
+        int status = 0;
+        size_t content_length = 0;
+        size_t bytes = 0;
+        double ttfb_ms = 0;
+        double total_ms = 0;
+    };
+
+    Fetch fetch(SSL_CTX *ctx, const sockaddr_in &addr, int ssid_index, const std::string &file, int rssi)
+    {
+        Fetch result;
+        Clock::time_point const start = Clock::now();
+        int const fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (const sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return result;
+        }
+        SSL *ssl = SSL_new(ctx);
+        SSL_set_fd(ssl, fd);
+        SSL_set_tlsext_host_name(ssl, HOST_NAME);
+        // mbedtls_config.h has MBEDTLS_SSL_MAX_FRAGMENT_LENGTH, tls_arena asks for 4 KB
+        SSL_set_tlsext_max_fragment_length(ssl, TLSEXT_max_fragment_length_4096);
+        if (SSL_connect(ssl) == 1)
+        {
+            result.connected = true;
+            char request[512];
+            snprintf(request, sizeof(request),
+                     "GET /%d/%s?vsys=4100&usb=0&rssi=%d HTTP/1.1\r\nUser-Agent: %s\r\nAccept: */*\r\nHost: %s\r\n"
+                     "Connection: Close\r\n\r\n", ssid_index, file.c_str(), rssi, USER_AGENT, HOST_NAME);
+            SSL_write(ssl, request, strlen(request));
+
+            std::string head;
+            bool in_body = false;
+            char buf[16384];
+            int n;
+            while ((n = SSL_read(ssl, buf, sizeof(buf))) > 0)
+            {
+                if (in_body)
+                {
+                    if (!result.bytes)
+                    {
+                        result.ttfb_ms = ms_between(start, Clock::now());
+                    }
+                    result.bytes += n;
+                    continue;
+                }
+                head.append(buf, n);
+                size_t const end = head.find("\r\n\r\n");
+                if (end == std::string::npos)
+                {
+                    continue;
+                }
+                in_body = true;
+                sscanf(head.c_str(), "HTTP/1.%*d %d", &result.status);
+                const char *length = strcasestr(head.c_str(), "Content-Length: ");
+                result.content_length = length ? strtoul(length + 16, nullptr, 10) : 0;
+                result.bytes = head.size() - (end + 4);
+                if (result.bytes)
+                {
+                    result.ttfb_ms = ms_between(start, Clock::now());
+                }
+            }
+            // a body that never came, the head is as close as it got
+            if (in_body && !result.bytes)
+            {
+                result.ttfb_ms = ms_between(start, Clock::now());
+            }
+        }
+        result.total_ms = ms_between(start, Clock::now());
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        close(fd);
+        return result;
+    }
+
+    bool resolve(const std::string &host, uint16_t port, sockaddr_in &addr)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *res = nullptr;
+        if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || !res)
+        {
+            return false;
+        }
+        addr = *(const sockaddr_in *)res->ai_addr;
+        addr.sin_port = htons(port);
+        freeaddrinfo(res);
+        return true;
+    }
+
+    // One update boundary: every frame in the fleet wakes, joins and fetches once
+    std::vector<Fetch> run_fleet(SSL_CTX *ctx, const sockaddr_in &addr, const Options &options, int fleet)
+    {
+        std::mt19937 rng(fleet);
+        std::uniform_int_distribution<int> join_ms(2000, 5000);
+        std::uniform_int_distribution<int> rssi(-85, -50);
+        std::vector<Fetch> fetches(fleet);
+        std::vector<std::thread> threads;
+        Clock::time_point const boundary = Clock::now();
+        for (int i = 0; i < fleet; i++)
+        {
+            uint8_t id[8];
+            for (uint8_t &b : id)
+            {
+                b = rng();
+            }
+            double const wake_ms = (schedule::jitter_s(id, sizeof(id), options.window_s) * 1000.0 + join_ms(rng)) / options.speedup;
+            Clock::time_point const at = boundary + std::chrono::microseconds((int64_t)(wake_ms * 1000));
+            int const device_rssi = rssi(rng);
+            threads.emplace_back([&, i, at, device_rssi]()
+            {
+                std::this_thread::sleep_until(at);
+                fetches[i] = fetch(ctx, addr, i % 3, options.file, device_rssi);
+            });
+        }
+        for (std::thread &t : threads)
+        {
+            t.join();
+        }
+        return fetches;
+    }
+
+    bool parse(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string const arg = argv[i];
+            if (arg == "--serve")
+            {
+                options.serve_only = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            const char *value = argv[++i];
+            if (arg == "--fleets")
+            {
+                options.fleets.clear();
+                for (const char *p = value; *p; p += *p == ',')
+                {
+                    char *end;
+                    options.fleets.push_back(strtol(p, &end, 10));
+                    if (end == p)
+                    {
+                        return false;
+                    }
+                    p = end;
+                }
+            }
+            else if (arg == "--window-s")
+            {
+                options.window_s = atoi(value);
+            }
+            else if (arg == "--speedup")
+            {
+                options.speedup = atof(value);
+            }
+            else if (arg == "--file")
+            {
+                options.file = value;
+            }
+            else if (arg == "--dir")
+            {
+                options.dir = value;
+            }
+            else if (arg == "--latency-ms")
+            {
+                options.latency_ms = atoi(value);
+            }
+            else if (arg == "--kbytes-per-s")
+            {
+                options.kbytes_per_s = atoi(value);
+            }
+            else if (arg == "--truncate-pct")
+            {
+                options.truncate_pct = atoi(value);
+            }
+            else if (arg == "--error-pct")
+            {
+                options.error_pct = atoi(value);
+            }
+            else if (arg == "--port")
+            {
+                options.port = atoi(value);
+            }
+            else if (arg == "--connect")
+            {
+                options.connect_host = value;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return options.speedup > 0 && !options.fleets.empty();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        fprintf(stderr, "usage: %s [--fleets 10,50,100,250] [--window-s 120] [--speedup 20] [--file quantized.bin] [--dir DIR]\n"
+                        "       [--latency-ms 0] [--kbytes-per-s 0] [--truncate-pct 0] [--error-pct 0] [--port 8443]\n"
+                        "       [--serve | --connect HOST]\n", argv[0]);
+        return 2;
+    }
+
+    // a frame hanging up mid body shouldn't take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    bool const local = options.connect_host.empty();
+    Server server(options);
+    if (local && !server.start())
+    {
+        return 1;
+    }
+    if (options.serve_only)
+    {
+        printf("Serving on port %u\n", options.port);
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::hours(1));
+        }
+    }
+
+    sockaddr_in addr;
+    if (!resolve(local ? "127.0.0.1" : options.connect_host, options.port, addr))
+    {
+        fprintf(stderr, "Couldn't resolve %s\n", options.connect_host.c_str());
+        return 1;
+    }
+    SSL_CTX *client_ctx = SSL_CTX_new(TLS_client_method());
+    // MBEDTLS_SSL_PROTO_TLS1_2 is all the firmware has
+    SSL_CTX_set_min_proto_version(client_ctx, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(client_ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(client_ctx, SSL_VERIFY_NONE, nullptr);
+
+    printf("fleet,requests,ok,rejected,short,failed,server_ttfb_p50_ms,server_ttfb_p99_ms,server_kbytes_per_s,"
+           "client_ttfb_p50_ms,client_ttfb_p99_ms,client_body_kbytes_per_s_p50\n");
+    for (int fleet : options.fleets)
+    {
+        if (local)
+        {
+            server.take_stats();
+        }
+        std::vector<Fetch> const fetches = run_fleet(client_ctx, addr, options, fleet);
+
+        int ok = 0, rejected = 0, cut_short = 0, failed = 0;
+        std::vector<double> client_ttfb;
+        std::vector<double> client_rate;
+        for (const Fetch &f : fetches)
+        {
+            if (!f.connected || f.status == 0)
+            {
+                failed++;
+                continue;
+            }
+            client_ttfb.push_back(f.ttfb_ms);
+            if (f.status == 503 || f.status == 429)
+            {
+                rejected++;
+            }
+            else if (f.status == 200 && f.bytes == f.content_length)
+            {
+                ok++;
+                double const body_ms = f.total_ms - f.ttfb_ms;
+                client_rate.push_back(body_ms > 0 ? f.bytes / body_ms : 0);
+            }
+            else if (f.status == 200)
+            {
+                cut_short++;
+            }
+            else
+            {
+                failed++;
+            }
+        }
+
+        // the bodies' bytes over the time any of them were going out
+        std::vector<double> server_ttfb;
+        size_t server_bytes = 0;
+        Clock::time_point first_body = Clock::time_point::max();
+        Clock::time_point last_body = Clock::time_point::min();
+        for (const ServedRequest &s : local ? server.take_stats() : std::vector<ServedRequest>())
+        {
+            server_ttfb.push_back(s.ttfb_ms);
+            server_bytes += s.bytes;
+            first_body = std::min(first_body, s.body_start);
+            last_body = std::max(last_body, s.body_end);
+        }
+        double const busy_ms = server_bytes ? ms_between(first_body, last_body) : 0;
+
+        printf("%d,%d,%d,%d,%d,%d,", fleet, fleet, ok, rejected, cut_short, failed);
+        if (local)
+        {
+            printf("%.1f,%.1f,%.0f,", percentile(server_ttfb, 50), percentile(server_ttfb, 99), busy_ms > 0 ? server_bytes / busy_ms : 0);
+        }
+        else
+        {
+            printf(",,,");
+        }
+        printf("%.1f,%.1f,%.0f\n", percentile(client_ttfb, 50), percentile(client_ttfb, 99), percentile(client_rate, 50));
+        fflush(stdout);
+    }
+
+    SSL_CTX_free(client_ctx);
+    if (local)
+    {
+        server.stop();
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Runs a fleet of frames through a day of schedule.hpp, with and without the wake jitter,
+// and prints the most requests the server had at once for each fleet size. Then again
+// against a server that can only serve so many at once, to count the requests turned away.
+//
+// usage: fleet_sim [jitter_window_s] [server_capacity]
+//
+// Each wake joins the network, then makes one request. Requests over the capacity get a
+// 503 with a Retry-After and the frame backs off as the firmware does. Every frame takes
+// its clock from the server's Date header, so they're all within a second of each other.
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "schedule.hpp"
+
+namespace
+{
+    constexpr uint32_t DAY_START_S = schedule::NIGHT_END_HOUR * 3600;
+    constexpr uint32_t DAY_END_S = schedule::NIGHT_START_HOUR * 3600;
+    // what the server's 503s ask for
+    constexpr uint32_t RETRY_AFTER_S = 30;
+
+    struct Device
+    {
+        uint32_t jitter;
+        int clock_offset_s;
+        uint8_t failures;
+    };
+
+    struct Result
+    {
+        uint32_t requests = 0;
+        uint32_t rejected = 0;
+        int peak = 0;
+    };
+
+    Result run(int fleet, uint32_t window_s, int capacity)
+    {
+        std::mt19937 rng(fleet);
+        std::uniform_int_distribution<int> connect_s(2, 5);
+        std::uniform_int_distribution<int> request_s(3, 6);
+        std::uniform_int_distribution<int> clock_offset_s(-1, 1);
+
+        std::vector<Device> devices(fleet);
+        // (request start, device), earliest first
+        using Event = std::pair<uint32_t, int>;
+        std::priority_queue<Event, std::vector<Event>, std::greater<Event>> starts;
+        for (int i = 0; i < fleet; i++)
+        {
+            uint8_t id[8];
+            for (uint8_t &b : id)
+            {
+                b = rng();
+            }
+            devices[i] = {schedule::jitter_s(id, sizeof(id), window_s), clock_offset_s(rng), 0};
+            // the first wake of the day is the same for everyone, bar the jitter
+            starts.push({DAY_START_S + devices[i].jitter + devices[i].clock_offset_s + connect_s(rng), i});
+        }
+
+        // requests in progress each second of the day
+        std::vector<int> active(schedule::DAY_S + 60, 0);
+        Result result;
+        while (!starts.empty())
+        {
+            auto const [start, i] = starts.top();
+            starts.pop();
+            if (start >= DAY_END_S)
+            {
+                continue;
+            }
+            Device &device = devices[i];
+            result.requests++;
+
+            uint32_t now_s;
+            schedule::Wake wake;
+            if (active[start] >= capacity)
+            {
+                result.rejected++;
+                // a 503 comes back straight away
+                now_s = start + 1;
+                if (device.failures < UINT8_MAX)
+                {
+                    device.failures++;
+                }
+                wake = schedule::retry(now_s, schedule::backoff_s(device.failures, RETRY_AFTER_S), device.jitter);
+            }
+            else
+            {
+                uint32_t const end = start + request_s(rng);
+                for (uint32_t t = start; t < end; t++)
+                {
+                    active[t]++;
+                }
+                result.peak = std::max(result.peak, active[start]);
+                now_s = end;
+                device.failures = 0;
+                wake = schedule::next_update(now_s, device.jitter);
+            }
+            uint32_t const next = now_s + schedule::seconds_until(now_s, wake) + device.clock_offset_s + connect_s(rng);
+            starts.push({next, i});
+        }
+        return result;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t const window_s = argc > 1 ? atoi(argv[1]) : 120;
+    int const capacity = argc > 2 ? atoi(argv[2]) : 8;
+    if (capacity <= 0)
+    {
+        fprintf(stderr, "usage: %s [jitter_window_s] [server_capacity]\n", argv[0]);
+        return 2;
+    }
+
+    printf("fleet,jitter_window_s,peak_concurrent,requests_at_capacity,rejected_at_capacity\n");
+    for (int fleet : {10, 50, 100, 250, 500, 1000})
+    {
+        for (uint32_t window : {0u, window_s})
+        {
+            Result const unlimited = run(fleet, window, INT_MAX);
+            Result const limited = run(fleet, window, capacity);
+            printf("%d,%lu,%d,%lu,%lu\n", fleet, (unsigned long)window, unlimited.peak,
+                   (unsigned long)limited.requests, (unsigned long)limited.rejected);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+// Turns the log.bin the firmware leaves on the SD card back into text. The records only
+// hold the address of their format string, so this needs the ELF of the exact build
+// that wrote them.
+//
+// usage: log_decode rain_radar.elf log.bin
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "logging_format.hpp"
+
+namespace
+{
+    constexpr uint32_t FILE_MAGIC = 0x474C5252; // "RRLG"
+    constexpr uint32_t RECORD_TAG = 0x4C;
+    constexpr size_t RECORD_HEADER_WORDS = 3;
+    const char *const LEVELS[] = {"?", "E", "W", "I", "D"};
+
+    struct Segment
+    {
+        uint32_t addr;
+        uint32_t size;
+        uint32_t offset;
+    };
+
+    struct Elf
+    {
+        std::vector<uint8_t> bytes;
+        std::vector<Segment> segments;
+    };
+
+    bool read_file(const char *path, std::vector<uint8_t> &bytes)
+    {
+        FILE *f = fopen(path, "rb");
+        if (!f)
+        {
+            return false;
+        }
+        uint8_t buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        {
+            bytes.insert(bytes.end(), buf, buf + n);
+        }
+        fclose(f);
+        return true;
+    }
+
+    uint32_t u32(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    uint16_t u16(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    // the loadable segments of a little endian ELF32, by the address they load at, which for
+    // the format strings is flash
+    bool load_elf(const char *path, Elf &elf)
+    {
+        if (!read_file(path, elf.bytes) || elf.bytes.size() < 52 || memcmp(elf.bytes.data(), "\x7f" "ELF\x01\x01", 6) != 0)
+        {
+            return false;
+        }
+        const uint8_t *const b = elf.bytes.data();
+        uint32_t const phoff = u32(b + 28);
+        uint16_t const phentsize = u16(b + 42);
+        uint16_t const phnum = u16(b + 44);
+        for (uint16_t i = 0; i < phnum; i++)
+        {
+            size_t const ph = phoff + (size_t)i * phentsize;
+            if (ph + 32 > elf.bytes.size())
+            {
+                return false;
+            }
+            uint32_t const type = u32(b + ph);
+            uint32_t const offset = u32(b + ph + 4);
+            uint32_t const paddr = u32(b + ph + 12);
+            uint32_t const filesz = u32(b + ph + 16);
+            if (type == 1 && filesz && (size_t)offset + filesz <= elf.bytes.size()) // PT_LOAD
+            {
+                elf.segments.push_back({paddr, filesz, offset});
+            }
+        }
+        return !elf.segments.empty();
+    }
+
+    const char *resolve(uint32_t address, void *ctx)
+    {
+        const Elf *elf = (const Elf *)ctx;
+        for (const Segment &seg : elf->segments)
+        {
+            if (address >= seg.addr && address < seg.addr + seg.size)
+            {
+                const char *str = (const char *)elf->bytes.data() + seg.offset + (address - seg.addr);
+                // has to end inside the segment
+                size_t const room = seg.addr + seg.size - address;
+                return memchr(str, '\0', room) ? str : nullptr;
+            }
+        }
+        return nullptr;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s rain_radar.elf log.bin\n", argv[0]);
+        return 2;
+    }
+    Elf elf;
+    if (!load_elf(argv[1], elf))
+    {
+        fprintf(stderr, "couldn't read %s as an RP2040 ELF\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> log;
+    if (!read_file(argv[2], log))
+    {
+        fprintf(stderr, "couldn't read %s\n", argv[2]);
+        return 1;
+    }
+
+    char text[512];
+    size_t pos = 0;
+    int wake = 0;
+    while (pos + 16 <= log.size())
+    {
+        uint32_t const magic = u32(&log[pos]);
+        uint32_t const words = u32(&log[pos + 4]);
+        uint32_t const dropped = u32(&log[pos + 8]);
+        if (magic != FILE_MAGIC || pos + 16 + (size_t)words * 4 > log.size())
+        {
+            fprintf(stderr, "log.bin is damaged at byte %zu\n", pos);
+            return 1;
+        }
+        pos += 16;
+        printf("--- wake %d\n", wake++);
+        if (dropped)
+        {
+            printf("(%u records dropped)\n", dropped);
+        }
+
+        std::vector<uint32_t> ring(words);
+        for (uint32_t i = 0; i < words; i++)
+        {
+            ring[i] = u32(&log[pos + i * 4]);
+        }
+        pos += (size_t)words * 4;
+
+        size_t i = 0;
+        while (i + RECORD_HEADER_WORDS <= ring.size())
+        {
+            uint32_t const head = ring[i];
+            size_t const arg_words = head & 0xFF;
+            unsigned const level = (head >> 16) & 0xFF;
+            if ((head >> 24) != RECORD_TAG || i + RECORD_HEADER_WORDS + arg_words > ring.size())
+            {
+                printf("(bad record at word %zu)\n", i);
+                break;
+            }
+            uint32_t const us = ring[i + 1];
+            const char *fmt = resolve(ring[i + 2], &elf);
+            if (fmt)
+            {
+                size_t const n = logging::format(text, sizeof(text), fmt, &ring[i + RECORD_HEADER_WORDS], arg_words, resolve, &elf);
+                bool const newline = n && text[n - 1] == '\n';
+                printf("[%u.%06u] %s %s%s", us / 1000000, us % 1000000, level < 5 ? LEVELS[level] : "?", text, newline ? "" : "\n");
+            }
+            else
+            {
+                printf("[%u.%06u] (format at %08x isn't in this ELF)\n", us / 1000000, us % 1000000, ring[i + 2]);
+            }
+            i += RECORD_HEADER_WORDS + arg_words;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,308 @@
+#include "basemap.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "board.hpp"
+#include "core1_tasks.hpp"
+#include "persistent_data.hpp"
+#include "rain_stats.hpp"
+
+using namespace pimoroni;
+
+// The header gets its own sector straight after the persistent data, the pixels follow it
+#define BASEMAP_HEADER_OFFSET (FLASH_TARGET_OFFSET + FLASH_SECTOR_SIZE)
+#define BASEMAP_PIXELS_OFFSET (BASEMAP_HEADER_OFFSET + FLASH_SECTOR_SIZE)
+#define BASEMAP_MAX_BYTES (PICO_FLASH_SIZE_BYTES - BASEMAP_PIXELS_OFFSET)
+
+namespace basemap
+{
+    namespace
+    {
+        constexpr uint32_t BASEMAP_MAGIC = 0x50414D42;     // "BMAP"
+        constexpr uint32_t LAYER_MAGIC = 0x4C505252;       // "RRPL"
+        constexpr size_t LAYER_HEADER_LEN = 16;
+        constexpr size_t RUN_HEADER_LEN = 6;
+        constexpr int ROW_BYTES = board::WIDTH / 2;
+        // where FlashWriter gathers the download
+        constexpr uint32_t STAGING_ADDRESS = board::PSRAM_STAGING_ADDRESS;
+
+        uint8_t sector_buffer[FLASH_SECTOR_SIZE];
+        uint8_t row_buffer[board::WIDTH];
+
+        uint16_t read_u16(const uint8_t *p)
+        {
+            return p[0] | (p[1] << 8);
+        }
+
+        uint32_t read_u32(const uint8_t *p)
+        {
+            return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        }
+
+        const Header *flash_header()
+        {
+            return (const Header *)(XIP_BASE + BASEMAP_HEADER_OFFSET);
+        }
+
+        void erase_and_program(uint32_t offset, const uint8_t *data, size_t len)
+        {
+            core1_tasks::FlashLockout lockout;
+            uint32_t interrupts = save_and_disable_interrupts();
+            flash_range_erase(offset, FLASH_SECTOR_SIZE);
+            if (data)
+            {
+                flash_range_program(offset, data, len);
+            }
+            restore_interrupts(interrupts);
+        }
+    }
+
+    void load_row(int y, uint8_t *row)
+    {
+        const uint8_t *src = (const uint8_t *)(XIP_BASE + BASEMAP_PIXELS_OFFSET) + y * ROW_BYTES;
+        for (int i = 0; i < ROW_BYTES; i++)
+        {
+            row[i * 2] = src[i] >> 4;
+            row[i * 2 + 1] = src[i] & 0x0F;
+        }
+    }
+
+    uint32_t stored_version(int width, int height)
+    {
+        const Header *header = flash_header();
+        if (header->magic != BASEMAP_MAGIC || header->width != width || header->height != height || header->length != (uint32_t)(width * height / 2))
+        {
+            return 0;
+        }
+        return header->version;
+    }
+
+    Err load_frame(PSRamDisplay &psram)
+    {
+        if (!stored_version(board::WIDTH, board::HEIGHT))
+        {
+            return Err::NO_DATA;
+        }
+        for (int y = 0; y < board::HEIGHT; y++)
+        {
+            load_row(y, row_buffer);
+            psram.write_span(y * board::WIDTH, board::WIDTH, row_buffer);
+        }
+        return Err::OK;
+    }
+
+    FlashWriter::FlashWriter(PSRamDisplay &psram)
+        : psram(psram)
+    {
+    }
+
+    Err FlashWriter::begin(uint32_t version, int width, int height)
+    {
+        header = {
+            .magic = BASEMAP_MAGIC,
+            .version = version,
+            .width = (uint16_t)width,
+            .height = (uint16_t)height,
+            .length = (uint32_t)(width * height / 2),
+        };
+        if (header.length > BASEMAP_MAX_BYTES || header.length > board::PSRAM_STAGING_BYTES)
+        {
+            printf("Basemap of %lu bytes doesn't fit in flash\n", header.length);
+            return Err::NO_MEMORY;
+        }
+        written = 0;
+        return Err::OK;
+    }
+
+    void FlashWriter::program_sector(size_t offset)
+    {
+        size_t const len = std::min<size_t>(FLASH_SECTOR_SIZE, written - offset);
+        uint32_t const address = STAGING_ADDRESS + offset;
+        psram.read_pixel_span(Point(address % board::WIDTH, address / board::WIDTH), len, sector_buffer);
+        // pad the last sector, flash_range_program wants whole pages
+        memset(sector_buffer + len, 0xFF, FLASH_SECTOR_SIZE - len);
+        erase_and_program(BASEMAP_PIXELS_OFFSET + offset, sector_buffer, FLASH_SECTOR_SIZE);
+    }
+
+    Err FlashWriter::write(const uint8_t *data, size_t len)
+    {
+        if (written + len > header.length)
+        {
+            printf("Basemap data exceeds expected length\n");
+            return Err::INVALID_RESPONSE;
+        }
+        psram.write_span(STAGING_ADDRESS + written, len, data);
+        written += len;
+        return Err::OK;
+    }
+
+    Err FlashWriter::finish()
+    {
+        if (written != header.length)
+        {
+            printf("Basemap was %u bytes, expected %lu\n", written, header.length);
+            return Err::NO_DATA;
+        }
+
+        printf("Writing basemap to flash\n");
+        erase_and_program(BASEMAP_HEADER_OFFSET, nullptr, 0);
+        for (size_t offset = 0; offset < written; offset += FLASH_SECTOR_SIZE)
+        {
+            program_sector(offset);
+        }
+
+        uint8_t page[FLASH_PAGE_SIZE];
+        memset(page, 0xFF, sizeof(page));
+        memcpy(page, &header, sizeof(header));
+        core1_tasks::FlashLockout lockout;
+        uint32_t interrupts = save_and_disable_interrupts();
+        flash_range_program(BASEMAP_HEADER_OFFSET, page, sizeof(page));
+        restore_interrupts(interrupts);
+        printf("Stored basemap version %lu\n", header.version);
+        return Err::OK;
+    }
+
+    PrecipCompositor::PrecipCompositor(PSRamDisplay &psram)
+        : psram(psram)
+    {
+    }
+
+    void PrecipCompositor::write_row(int y, bool with_buffer)
+    {
+        if (!with_buffer)
+        {
+            load_row(y, row_buffer);
+        }
+        // same pixel offsets that fetch_image streams the full frame into
+        psram.write_span(y * board::WIDTH, board::WIDTH, row_buffer);
+    }
+
+    Err PrecipCompositor::start_row(int y)
+    {
+        if (y < row_y || y >= board::HEIGHT)
+        {
+            printf("Precip run for row %d out of order\n", y);
+            return Err::INVALID_RESPONSE;
+        }
+        if (y == row_y)
+        {
+            return Err::OK;
+        }
+        if (row_y >= 0)
+        {
+            write_row(row_y, true);
+        }
+        // rows without rain are just the basemap
+        for (int r = row_y + 1; r < y; r++)
+        {
+            write_row(r, false);
+        }
+        load_row(y, row_buffer);
+        row_y = y;
+        return Err::OK;
+    }
+
+    Err PrecipCompositor::feed(const uint8_t *data, size_t len)
+    {
+        while (len)
+        {
+            if (state == State::RUN_PIXELS)
+            {
+                size_t n = std::min<size_t>(len, run_left);
+                // the basemap is still under it
+                rain_stats::add_span(row_y, run_x, data, row_buffer + run_x, n);
+                memcpy(row_buffer + run_x, data, n);
+                run_x += n;
+                run_left -= n;
+                data += n;
+                len -= n;
+                if (run_left == 0)
+                {
+                    runs_left--;
+                    state = State::RUN_HEADER;
+                }
+                continue;
+            }
+
+            // headers may be split across pbufs, gather them up first
+            size_t const need = state == State::LAYER_HEADER ? LAYER_HEADER_LEN : RUN_HEADER_LEN;
+            if (state == State::RUN_HEADER && runs_left == 0)
+            {
+                printf("Unexpected data after the last precip run\n");
+                return Err::INVALID_RESPONSE;
+            }
+            size_t n = std::min(len, need - pending_len);
+            memcpy(pending + pending_len, data, n);
+            pending_len += n;
+            data += n;
+            len -= n;
+            if (pending_len < need)
+            {
+                continue;
+            }
+            pending_len = 0;
+
+            if (state == State::LAYER_HEADER)
+            {
+                if (read_u32(pending) != LAYER_MAGIC || read_u16(pending + 8) != board::WIDTH || read_u16(pending + 10) != board::HEIGHT)
+                {
+                    printf("Not a precip layer for this display\n");
+                    return Err::INVALID_RESPONSE;
+                }
+                basemap_version = read_u32(pending + 4);
+                if (basemap_version != stored_version(board::WIDTH, board::HEIGHT))
+                {
+                    printf("Precip layer wants basemap %lu\n", basemap_version);
+                    return Err::BASEMAP_OUT_OF_DATE;
+                }
+                runs_left = read_u32(pending + 12);
+                state = State::RUN_HEADER;
+                rain_stats::begin();
+                continue;
+            }
+
+            uint16_t const y = read_u16(pending);
+            run_x = read_u16(pending + 2);
+            run_left = read_u16(pending + 4);
+            if (run_x + run_left > board::WIDTH)
+            {
+                printf("Precip run off the edge of row %u\n", y);
+                return Err::INVALID_RESPONSE;
+            }
+            Err err = start_row(y);
+            if (err != Err::OK)
+            {
+                return err;
+            }
+            state = run_left ? State::RUN_PIXELS : State::RUN_HEADER;
+            if (!run_left)
+            {
+                runs_left--;
+            }
+        }
+        return Err::OK;
+    }
+
+    Err PrecipCompositor::finish()
+    {
+        if (state != State::RUN_HEADER || runs_left != 0)
+        {
+            printf("Precip layer was cut short\n");
+            return Err::NO_DATA;
+        }
+        if (row_y >= 0)
+        {
+            write_row(row_y, true);
+        }
+        for (int r = row_y + 1; r < board::HEIGHT; r++)
+        {
+            write_row(r, false);
+        }
+        return Err::OK;
+    }
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "psram_display.hpp"
+#include "rain_radar_common.hpp"
+
+// The map under the rain never changes, so a pre-dithered copy of it lives in the spare
+// flash after the program image and the server only sends the pixels that differ from it.
+namespace basemap
+{
+    // Stored in its own sector in front of the pixels. Only written once every pixel
+    // has been programmed, so a half finished download is never mistaken for a good one.
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint16_t width;
+        uint16_t height;
+        uint32_t length; // bytes of packed pixels that follow
+    };
+
+    // Version of the basemap in flash, 0 if there isn't a valid one
+    uint32_t stored_version(int width, int height);
+
+    // Unpack row y of the basemap in flash into row, one palette index per byte, board::WIDTH
+    // of them. Only valid if stored_version is non zero for the board's size.
+    void load_row(int y, uint8_t *row);
+
+    // Copy the whole basemap in flash into the frame in PSRAM. Err::NO_DATA if there isn't one.
+    Err load_frame(pimoroni::PSRamDisplay &psram);
+
+    // Gathers a new basemap in the PSRAM after the frame as it downloads, and writes it to flash
+    // once the request's done. Erasing and programming a sector holds off interrupts for tens of
+    // ms, which from the recv callback would stall the radio with the TCP window still open.
+    class FlashWriter
+    {
+    public:
+        explicit FlashWriter(pimoroni::PSRamDisplay &psram);
+
+        Err begin(uint32_t version, int width, int height);
+        Err write(const uint8_t *data, size_t len);
+        // Replaces whatever basemap is in flash with the one gathered, then programs the header,
+        // making it live. Call outside any lwIP callback.
+        Err finish();
+
+    private:
+        pimoroni::PSRamDisplay &psram;
+        Header header = {};
+        size_t written = 0;
+
+        void program_sector(size_t offset);
+    };
+
+    // Builds the frame in PSRAM row by row from the basemap in flash plus a sparse precipitation
+    // layer, as the layer streams in. The layer is a small header followed by runs sorted by
+    // row then column, each a (y, x, len) triple of little endian u16s then len palette indices.
+    // Always the whole panel, see board.hpp.
+    class PrecipCompositor
+    {
+    public:
+        explicit PrecipCompositor(pimoroni::PSRamDisplay &psram);
+
+        // Feed the next chunk of the layer. Returns an error if the layer is malformed or was made
+        // for a different basemap (Err::BASEMAP_OUT_OF_DATE, see layer_basemap_version).
+        Err feed(const uint8_t *data, size_t len);
+        // Writes out the rows after the last run. Call once the whole layer has arrived.
+        Err finish();
+
+        uint32_t layer_basemap_version() const { return basemap_version; }
+
+    private:
+        enum class State : uint8_t
+        {
+            LAYER_HEADER,
+            RUN_HEADER,
+            RUN_PIXELS,
+        };
+
+        pimoroni::PSRamDisplay &psram;
+
+        State state = State::LAYER_HEADER;
+        uint8_t pending[16];
+        size_t pending_len = 0;
+
+        uint32_t basemap_version = 0;
+        uint32_t runs_left = 0;
+        uint16_t run_x = 0;
+        uint16_t run_left = 0;
+        // row currently held in row_buffer, rows before it are already in PSRAM
+        int row_y = -1;
+
+        Err start_row(int y);
+        void write_row(int y, bool with_buffer);
+    };
+
+}
@@ -7,6 +7,7 @@
 #include "hardware/gpio.h"
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
+#include "logging.hpp"
 #include <cstdio>
 #include <cmath>
 
@@ -43,7 +44,7 @@ float Battery::read_vsys_voltage() {
     uint32_t vsys_sum = 0;
     for(int i = 0; i < SAMPLE_COUNT; i++) {
         uint16_t val = adc_fifo_get_blocking();
-        printf("ADC sample %d: %d\n", i, val);  // Debug print
+        LOG_DEBUG("ADC sample %d: %d\n", i, val);
         vsys_sum += val;
     }
 
@@ -61,7 +62,7 @@ float Battery::read_vsys_voltage() {
     const float conversion_factor = 3.3f / (1 << 12);  // 12-bit ADC
     float voltage = vsys_avg * 3.0f * conversion_factor;
     
-    printf("ADC avg: %lu, voltage: %.3f\n", vsys_avg, voltage);  // Debug print
+    LOG_DEBUG("ADC avg: %lu, voltage: %.3f\n", vsys_avg, voltage);
     
     return voltage;
     #endif
@@ -72,7 +73,10 @@ float Battery::get_voltage() {
 }
 
 int Battery::get_battery_percentage() {
-    float voltage = get_voltage();
+    return percentage_for(get_voltage());
+}
+
+int Battery::percentage_for(float voltage) {
     if (voltage < 0) {
         return -1;
     }
@@ -110,6 +114,9 @@ const char* Battery::get_status_string() {
     float voltage = get_voltage();
     
     bool usb_powered = is_usb_powered();
+    status_voltage = voltage;
+    status_usb_powered = usb_powered;
+    status_percentage = -1;
     
     if (voltage < 0) {
         snprintf(status_buffer, sizeof(status_buffer), "ERR");
@@ -119,7 +126,9 @@ const char* Battery::get_status_string() {
     if (usb_powered) {
         snprintf(status_buffer, sizeof(status_buffer), "%.1fV USB", voltage);
     } else {
-        int percentage = get_battery_percentage();
+        // one ADC read is enough, the VSYS pin is shared with cyw43
+        int percentage = percentage_for(voltage);
+        status_percentage = percentage;
         if (percentage >= 0) {
             snprintf(status_buffer, sizeof(status_buffer), "%.1fV %d%%", voltage, percentage);
         } else {
@@ -48,19 +48,36 @@ public:
      */
     const char* get_status_string();
 
+    /**
+     * The string, voltage and power source get_status_string() last read
+     * Still good after cyw43 has been powered down, unlike the methods above
+     */
+    const char* last_status() const { return status_buffer; }
+    float last_voltage() const { return status_voltage; }
+    bool last_usb_powered() const { return status_usb_powered; }
+    int last_percentage() const { return status_percentage; }
+
 private:
     static constexpr float MIN_BATTERY_VOLTAGE = 3.0f;
     static constexpr float MAX_BATTERY_VOLTAGE = 4.2f;
     static constexpr int SAMPLE_COUNT = 3;
     static constexpr int PICO_FIRST_ADC_PIN = 26;
     
-    char status_buffer[16];  // Buffer for status string
+    char status_buffer[16] = "";  // Buffer for status string
+    float status_voltage = -1.0f;
+    bool status_usb_powered = false;
+    int status_percentage = -1;
     
     /**
      * Internal method to read VSYS voltage using ADC
      * @return Raw voltage reading or -1.0f on error
      */
     float read_vsys_voltage();
+
+    /**
+     * Battery percentage for a voltage already read
+     */
+    int percentage_for(float voltage);
 };
 
 #endif // BATTERY_HPP
\ No newline at end of file
@@ -0,0 +1,317 @@
+#include <cstdio>
+#include <cstring>
+
+#include "battery.hpp"
+#include "board.hpp"
+#include "core1_tasks.hpp"
+#include "data_fetching.hpp"
+#include "ff.h"
+#include "frame_cache.hpp"
+#include "frame_container.hpp"
+#include "hardware/clocks.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "inky_frame_7.hpp"
+#include "logging.hpp"
+#include "mbedtls/sha256.h"
+#include "overlays.hpp"
+#include "panel_stream.hpp"
+#include "pico/stdlib.h"
+#include "rain_radar_common.hpp"
+#include "secrets.h"
+#include "tls_arena.hpp"
+#include "wifi_setup.hpp"
+
+using namespace pimoroni;
+
+// rain_radar_bench: times the pieces the firmware is made of, on the board, so decisions
+// about them come from numbers. Built from the same sources and options as rain_radar.
+// Prints one csv row per measurement as it goes, then draws the table on the panel and
+// times that refresh, which can only go to the serial port.
+//
+// Overwrites the last sector of flash, which nothing else uses, and bench.bin on the SD card.
+
+InkyFrame inky_frame;
+Battery battery;
+overlays::OverlayList overlay_list;
+
+namespace
+{
+    struct Result
+    {
+        const char *name;
+        uint32_t param;
+        float value;
+        const char *unit;
+    };
+
+    // a rect and a title leave room for this many on the panel
+    constexpr size_t MAX_RESULTS = overlays::MAX_OVERLAYS - 2;
+    Result results[MAX_RESULTS];
+    size_t result_count = 0;
+
+    // the size of a frame at a byte per pixel, 384 KB on the 7.3
+    constexpr uint32_t FRAME_BYTES = board::PIXELS;
+    // same as frame_cache's chunks
+    constexpr size_t BUFFER_SIZE = 16 * 512;
+    uint8_t buffer[BUFFER_SIZE];
+
+    constexpr uint32_t FLASH_BENCH_OFFSET = PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE;
+    constexpr const char *SD_BENCH_PATH = "bench.bin";
+
+    void record(const char *name, uint32_t param, float value, const char *unit)
+    {
+        printf("%s,%lu,%.2f,%s\n", name, param, value, unit);
+        if (result_count < MAX_RESULTS)
+        {
+            results[result_count++] = {name, param, value, unit};
+        }
+    }
+
+    float kbytes_per_s(uint32_t bytes, uint64_t us)
+    {
+        return us ? bytes * 1000.0f / us : 0.0f;
+    }
+
+    // write_span for a whole frame, a chunk at a time, like the fetch paths' pbufs
+    void bench_psram()
+    {
+        PSRamDisplay &psram = inky_frame.ramDisplay;
+        const size_t chunks[] = {64, 256, 1024, 4096};
+        for (size_t chunk : chunks)
+        {
+            uint64_t const start = time_us_64();
+            for (uint32_t offset = 0; offset < FRAME_BYTES; offset += chunk)
+            {
+                psram.write_span(offset, MIN(chunk, FRAME_BYTES - offset), buffer);
+            }
+            record("psram_write_span", chunk, kbytes_per_s(FRAME_BYTES, time_us_64() - start), "kB/s");
+        }
+    }
+
+    // a sector erase and a page program, the units basemap and persistent data write in
+    void bench_flash()
+    {
+        core1_tasks::FlashLockout lockout;
+        uint32_t interrupts = save_and_disable_interrupts();
+        uint64_t const erase_start = time_us_64();
+        flash_range_erase(FLASH_BENCH_OFFSET, FLASH_SECTOR_SIZE);
+        uint64_t const program_start = time_us_64();
+        flash_range_program(FLASH_BENCH_OFFSET, buffer, FLASH_PAGE_SIZE);
+        uint64_t const end = time_us_64();
+        flash_range_erase(FLASH_BENCH_OFFSET, FLASH_SECTOR_SIZE);
+        restore_interrupts(interrupts);
+
+        record("flash_erase", FLASH_SECTOR_SIZE, (program_start - erase_start) / 1000.0f, "ms");
+        record("flash_program", FLASH_PAGE_SIZE, (float)(end - program_start), "us");
+    }
+
+    // a frame's worth written then read back, the way frame_cache does
+    void bench_sd()
+    {
+        Err err = frame_cache::mount();
+        if (err != Err::OK)
+        {
+            printf("No SD card (%s), skipping it\n", errToString(err).data());
+            return;
+        }
+
+        FIL fil;
+        if (f_open(&fil, SD_BENCH_PATH, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        {
+            printf("Couldn't open %s to write\n", SD_BENCH_PATH);
+            return;
+        }
+        uint64_t start = time_us_64();
+        uint32_t written = 0;
+        while (written < FRAME_BYTES)
+        {
+            UINT bw = 0;
+            if (f_write(&fil, buffer, MIN(BUFFER_SIZE, FRAME_BYTES - written), &bw) != FR_OK || bw == 0)
+            {
+                break;
+            }
+            written += bw;
+        }
+        f_sync(&fil);
+        uint64_t const write_us = time_us_64() - start;
+        f_close(&fil);
+        if (written != FRAME_BYTES)
+        {
+            printf("SD write stopped after %lu bytes\n", written);
+            return;
+        }
+        record("sd_write", FRAME_BYTES, kbytes_per_s(FRAME_BYTES, write_us), "kB/s");
+
+        if (f_open(&fil, SD_BENCH_PATH, FA_READ) != FR_OK)
+        {
+            printf("Couldn't open %s to read\n", SD_BENCH_PATH);
+            return;
+        }
+        start = time_us_64();
+        uint32_t read = 0;
+        while (read < FRAME_BYTES)
+        {
+            UINT br = 0;
+            if (f_read(&fil, buffer, BUFFER_SIZE, &br) != FR_OK || br == 0)
+            {
+                break;
+            }
+            read += br;
+        }
+        uint64_t const read_us = time_us_64() - start;
+        f_close(&fil);
+        f_unlink(SD_BENCH_PATH);
+        record("sd_read", read, kbytes_per_s(read, read_us), "kB/s");
+    }
+
+    // a VSYS reading, the burst of samples battery takes each wake. Needs cyw43 up.
+    void bench_adc()
+    {
+        constexpr int READS = 20;
+        battery.init();
+        uint64_t const start = time_us_64();
+        for (int i = 0; i < READS; i++)
+        {
+            battery.get_voltage();
+        }
+        record("adc_vsys_read", READS, (time_us_64() - start) / (float)READS, "us");
+    }
+
+    // image_info.txt is a few bytes, so the time to it is DNS, TCP and the handshake
+    void bench_tls(int8_t ssid_index)
+    {
+        constexpr int RUNS = 3;
+        uint32_t first_byte_ms = 0;
+        int ok = 0;
+        for (int run = 0; run < RUNS; run++)
+        {
+            ResultOr<data_fetching::TransferStats> const res = data_fetching::fetch_and_discard(ssid_index, "image_info.txt");
+            if (!res.ok())
+            {
+                printf("TLS request %d failed: %s\n", run, errToString(res.err).data());
+                continue;
+            }
+            first_byte_ms += res.unwrap().first_byte_ms;
+            ok++;
+        }
+        if (ok)
+        {
+            record("tls_first_byte", ok, first_byte_ms / (float)ok, "ms");
+            record("tls_peak_arena", tls_arena::size(), (float)tls_arena::take_peak(), "bytes");
+        }
+    }
+
+    void bench_network()
+    {
+        int8_t order[secrets::NUM_KNOWN_SSIDS];
+        for (int i = 0; i < secrets::NUM_KNOWN_SSIDS; i++)
+        {
+            order[i] = i;
+        }
+        wifi_setup::begin_connect(inky_frame, order, secrets::NUM_KNOWN_SSIDS);
+        ResultOr<int8_t> const connected = wifi_setup::finish_connect(inky_frame, [](int8_t ssid_index, bool joined, uint32_t ms)
+        {
+            printf("Join %d %s in %lu ms\n", ssid_index, joined ? "worked" : "failed", ms);
+        });
+        if (connected.err == Err::NOT_INITIALISED)
+        {
+            printf("cyw43 didn't come up, skipping the ADC and TLS\n");
+            return;
+        }
+        bench_adc();
+        if (connected.ok())
+        {
+            bench_tls(connected.unwrap());
+        }
+        wifi_setup::network_deinit(inky_frame);
+        logging::flush();
+    }
+
+    // crc32 is what frame.bin is checked with, sha256 is what TLS hashes every record with
+    void bench_checksums()
+    {
+        uint64_t start = time_us_64();
+        uint32_t crc = 0;
+        for (uint32_t offset = 0; offset < FRAME_BYTES; offset += BUFFER_SIZE)
+        {
+            crc = frame_container::crc32(crc, buffer, MIN(BUFFER_SIZE, FRAME_BYTES - offset));
+        }
+        record("crc32", FRAME_BYTES, kbytes_per_s(FRAME_BYTES, time_us_64() - start), "kB/s");
+
+        uint8_t digest[32];
+        mbedtls_sha256_context sha;
+        mbedtls_sha256_init(&sha);
+        start = time_us_64();
+        mbedtls_sha256_starts(&sha, 0);
+        for (uint32_t offset = 0; offset < FRAME_BYTES; offset += BUFFER_SIZE)
+        {
+            mbedtls_sha256_update(&sha, buffer, MIN(BUFFER_SIZE, FRAME_BYTES - offset));
+        }
+        mbedtls_sha256_finish(&sha, digest);
+        record("sha256", FRAME_BYTES, kbytes_per_s(FRAME_BYTES, time_us_64() - start), "kB/s");
+        mbedtls_sha256_free(&sha);
+        // so neither loop can be thrown away
+        printf("crc %08lx sha %02x%02x%02x%02x\n", crc, digest[0], digest[1], digest[2], digest[3]);
+    }
+
+    void draw_results()
+    {
+        // the PSRAM benchmark left stripes
+        for (int y = 0; y < board::HEIGHT; y++)
+        {
+            inky_frame.ramDisplay.write_pixel_span(Point(0, y), board::WIDTH, Inky73::WHITE);
+        }
+        constexpr int LINE_HEIGHT = 24;
+        overlay_list.add_rect(Rect(0, 0, board::WIDTH, LINE_HEIGHT + 8), Inky73::BLACK);
+        char line[overlays::MAX_TEXT_LEN];
+        snprintf(line, sizeof(line), "rain_radar_bench %s %lu MHz", board::ACTIVE.name, clock_get_hz(clk_sys) / 1000000);
+        overlay_list.add_text(line, Point(8, 8), 2, Inky73::WHITE);
+        for (size_t i = 0; i < result_count; i++)
+        {
+            const Result &r = results[i];
+            snprintf(line, sizeof(line), "%-18s %7lu %10.1f %s", r.name, r.param, r.value, r.unit);
+            overlay_list.add_text(line, Point(8, (i + 1) * LINE_HEIGHT + 16), 2, Inky73::BLACK);
+        }
+    }
+
+    void bench_panel()
+    {
+        uint64_t const start = time_us_64();
+        panel_stream::refresh_from_psram(inky_frame, overlay_list);
+        uint64_t const sent = time_us_64();
+        panel_stream::wait_for_refresh(inky_frame);
+        uint64_t const end = time_us_64();
+        printf("panel_send,%lu,%.2f,ms\n", (uint32_t)board::PIXELS, (sent - start) / 1000.0f);
+        printf("panel_refresh,%lu,%.2f,ms\n", (uint32_t)board::PIXELS, (end - sent) / 1000.0f);
+    }
+}
+
+int main()
+{
+    inky_frame.init();
+    stdio_init_all();
+    logging::init();
+    // give the serial port a moment to be opened
+    sleep_ms(2000);
+
+    for (size_t i = 0; i < BUFFER_SIZE; i++)
+    {
+        buffer[i] = i % board::ACTIVE.colours;
+    }
+
+    printf("# rain_radar_bench on %s at %lu MHz\n", board::ACTIVE.name, clock_get_hz(clk_sys) / 1000000);
+    printf("bench,param,value,unit\n");
+    bench_psram();
+    bench_flash();
+    bench_sd();
+    bench_checksums();
+    bench_network();
+
+    draw_results();
+    bench_panel();
+    printf("# done\n");
+
+    inky_frame.sleep();
+    return 0;
+}
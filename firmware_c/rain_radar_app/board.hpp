@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// What the firmware needs to know about the Inky Frame it's built for. It's fixed at compile
+// time (RAIN_RADAR_BOARD) so the loops that touch every pixel get their bounds and strides as
+// constants rather than reading them off inky_frame. No pico headers, host_tools uses it too.
+namespace board
+{
+    enum class Packing : uint8_t
+    {
+        // a palette index per byte, the 7.3's frame buffer in PSRAM
+        BYTE,
+        // two per byte, high nibble first, pico_graphics' P4 buffer in SRAM on the smaller frames
+        NIBBLE,
+    };
+
+    struct Profile
+    {
+        const char *name;
+        int width;
+        int height;
+        // black, white, green, blue, red, yellow, orange, in that order on every panel
+        uint8_t colours;
+        Packing packing;
+        bool has_psram;
+    };
+
+    constexpr Profile INKY_FRAME_7_3 = {"inky_frame_7_3", 800, 480, 7, Packing::BYTE, true};
+    constexpr Profile INKY_FRAME_5_7 = {"inky_frame_5_7", 600, 448, 7, Packing::NIBBLE, false};
+    constexpr Profile INKY_FRAME_4_0 = {"inky_frame_4_0", 640, 400, 7, Packing::NIBBLE, false};
+
+#if defined(RAIN_RADAR_BOARD_5_7)
+    constexpr Profile ACTIVE = INKY_FRAME_5_7;
+#elif defined(RAIN_RADAR_BOARD_4_0)
+    constexpr Profile ACTIVE = INKY_FRAME_4_0;
+#else
+    constexpr Profile ACTIVE = INKY_FRAME_7_3;
+#endif
+
+    constexpr int WIDTH = ACTIVE.width;
+    constexpr int HEIGHT = ACTIVE.height;
+    constexpr size_t PIXELS = (size_t)WIDTH * HEIGHT;
+    constexpr size_t FRAMEBUFFER_BYTES = ACTIVE.packing == Packing::BYTE ? PIXELS : PIXELS / 2;
+
+    // The 7.3's 8 MB of PSRAM past the frame, where downloads that end up in flash or on the
+    // SD card are gathered first, so neither gets written from inside lwIP's recv callback.
+    // One download at a time.
+    constexpr uint32_t PSRAM_STAGING_ADDRESS = PIXELS;
+    constexpr size_t PSRAM_STAGING_BYTES = 8 * 1024 * 1024 - PIXELS;
+
+    // the 2 bit and half resolution frame encodings pack whole bytes per row
+    static_assert(WIDTH % 8 == 0 && HEIGHT % 2 == 0, "panel size the frame encodings can't pack");
+}
@@ -0,0 +1,107 @@
+#include "boot.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include "pico/stdlib.h"
+#include "core1_tasks.hpp"
+
+namespace boot
+{
+    namespace
+    {
+        const Step *steps = nullptr;
+        size_t count = 0;
+        uint32_t done = 0;
+
+        // the step core1 is running, count if there isn't one
+        size_t on_core1 = 0;
+        uint64_t core1_started_us = 0;
+        // set on core1, read once the done queue says it's there
+        uint64_t core1_finished_us = 0;
+
+        void print_time(size_t step, uint64_t took_us, const char *where)
+        {
+            printf("boot: %s %llu.%03llu ms%s\n", steps[step].name, took_us / 1000, took_us % 1000, where);
+        }
+
+        void run_on_core1(void *arg)
+        {
+            ((const Step *)arg)->fn();
+            core1_finished_us = time_us_64();
+        }
+
+        void core1_done()
+        {
+            print_time(on_core1, core1_finished_us - core1_started_us, " on core1");
+            done |= 1u << on_core1;
+            on_core1 = count;
+        }
+
+        bool ready(size_t i)
+        {
+            bool const core1_busy = steps[i].core1 && on_core1 != count;
+            return !(done & (1u << i)) && i != on_core1 && !core1_busy && (steps[i].after & ~done) == 0;
+        }
+    }
+
+    void run(const Step *list, size_t n)
+    {
+        steps = list;
+        count = n;
+        done = 0;
+        on_core1 = count;
+        uint32_t const all = count == 32 ? ~0u : (1u << count) - 1;
+        while (done != all)
+        {
+            size_t next = count;
+            for (size_t i = 0; i < count; i++)
+            {
+                if (ready(i))
+                {
+                    next = i;
+                    break;
+                }
+            }
+            if (next == count)
+            {
+                if (on_core1 != count)
+                {
+                    // everything left waits on core1
+                    core1_tasks::wait();
+                    core1_done();
+                    continue;
+                }
+                // nothing ready but not all done means the steps wait on each other
+                assert(false);
+                printf("Boot steps depend on each other, stopping\n");
+                return;
+            }
+
+            if (steps[next].core1)
+            {
+                on_core1 = next;
+                core1_started_us = time_us_64();
+                core1_tasks::run(run_on_core1, (void *)&steps[next]);
+                continue;
+            }
+
+            uint64_t const started_us = time_us_64();
+            steps[next].fn();
+            print_time(next, time_us_64() - started_us, "");
+            done |= 1u << next;
+            if (on_core1 != count && core1_tasks::try_wait())
+            {
+                core1_done();
+            }
+        }
+    }
+
+    bool finished(size_t step)
+    {
+        if (on_core1 != count && step == on_core1 && core1_tasks::try_wait())
+        {
+            core1_done();
+        }
+        return done & (1u << step);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Runs the steps of boot in an order worked out from what each one needs done first.
+// The point is to get cyw43 powered and associating as early as possible: once it has
+// started, association carries on in the background and everything else that's ready
+// runs while it does. Steps that touch nothing core0 is using can go to core1 instead,
+// and run alongside whatever core0 is doing, cyw43's firmware load included.
+namespace boot
+{
+    using StepFn = void (*)();
+
+    struct Step
+    {
+        const char *name;
+        StepFn fn;
+        // bit i set means this step has to wait for steps[i]
+        uint32_t after;
+        // runs on core1, one such step at a time. Mustn't use SPI0, it's core0's during boot.
+        bool core1 = false;
+    };
+
+    constexpr uint32_t after(size_t step)
+    {
+        return 1u << step;
+    }
+
+    // Run every step once, each after the ones it depends on. When more than one is
+    // ready the earliest in the list goes first, so put the radio's path near the top.
+    // A core1 step is handed over as soon as it's ready and core1 is free, and anything
+    // that depends on it waits for it to finish. Prints how long each took.
+    void run(const Step *steps, size_t count);
+
+    template <size_t N>
+    void run(const Step (&steps)[N])
+    {
+        static_assert(N <= 32, "one bit per step in Step::after");
+        run(steps, N);
+    }
+
+    // For a step to see if another it doesn't depend on has finished, e.g. a core1 step
+    // it could use the results of but would rather not wait for
+    bool finished(size_t step);
+}
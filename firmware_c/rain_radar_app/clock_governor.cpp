@@ -0,0 +1,161 @@
+#include "clock_governor.hpp"
+
+#include <cstdio>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "hardware/clocks.h"
+#include "hardware/i2c.h"
+#include "hardware/spi.h"
+#include "hardware/uart.h"
+#include "hardware/vreg.h"
+
+namespace clock_governor
+{
+    namespace
+    {
+        constexpr size_t NUM_LEVELS = (size_t)Level::COUNT;
+
+        struct LevelConfig
+        {
+            uint32_t khz;
+            vreg_voltage voltage;
+        };
+
+        const LevelConfig LEVELS[NUM_LEVELS] = {
+            {48000, VREG_VOLTAGE_0_95},
+            {125000, VREG_VOLTAGE_1_10},
+            {187500, VREG_VOLTAGE_1_15},
+        };
+
+        // 187.5 MHz / 3 is the 62.5 MHz the cyw43 bus runs at with the stock clock and divider
+        constexpr uint16_t CYW43_PIO_DIV = 3;
+
+        Level current = Level::RADIO;
+        uint64_t entered_us = 0;
+        uint64_t total_us[NUM_LEVELS] = {0};
+
+        // what the drivers asked for, to ask again once clk_peri has moved
+        uint spi_baud[2] = {0};
+        uint i2c_baud[2] = {0};
+
+        spi_inst_t *spi_bus(size_t i)
+        {
+            return i ? spi1 : spi0;
+        }
+
+        i2c_inst_t *i2c_bus(size_t i)
+        {
+            return i ? i2c1 : i2c0;
+        }
+
+        void rederive_peripherals()
+        {
+            for (size_t i = 0; i < 2; i++)
+            {
+                if (spi_baud[i])
+                {
+                    spi_set_baudrate(spi_bus(i), spi_baud[i]);
+                }
+                if (i2c_baud[i])
+                {
+                    i2c_set_baudrate(i2c_bus(i), i2c_baud[i]);
+                }
+            }
+#if LIB_PICO_STDIO_UART
+            uart_set_baudrate(uart_default, PICO_DEFAULT_UART_BAUD_RATE);
+#endif
+        }
+    }
+
+    void init()
+    {
+        entered_us = time_us_64();
+        uint32_t const sys_hz = clock_get_hz(clk_sys);
+        for (size_t i = 0; i < 2; i++)
+        {
+            if (spi_get_hw(spi_bus(i))->cr1 & SPI_SSPCR1_SSE_BITS)
+            {
+                spi_baud[i] = spi_get_baudrate(spi_bus(i));
+            }
+            i2c_hw_t *hw = i2c_get_hw(i2c_bus(i));
+            if (hw->enable)
+            {
+                // the same sum i2c_set_baudrate worked the counts out from
+                i2c_baud[i] = sys_hz / (hw->fs_scl_hcnt + hw->fs_scl_lcnt);
+            }
+        }
+#if RAIN_RADAR_CLOCK_GOVERNOR
+        cyw43_set_pio_clock_divisor(CYW43_PIO_DIV, 0);
+#endif
+    }
+
+    void set(Level level)
+    {
+#if RAIN_RADAR_CLOCK_GOVERNOR
+        if (level == current)
+        {
+            return;
+        }
+        const LevelConfig &from = LEVELS[(size_t)current];
+        const LevelConfig &to = LEVELS[(size_t)level];
+
+        // cyw43 mustn't be part way through a transfer when its bus clock changes
+        bool const radio = cyw43_is_initialized(&cyw43_state);
+        if (radio)
+        {
+            cyw43_thread_enter();
+        }
+        // more voltage before more speed, and less speed before less voltage
+        if (to.voltage > from.voltage)
+        {
+            vreg_set_voltage(to.voltage);
+            sleep_us(10);
+        }
+        if (level == Level::IDLE)
+        {
+            set_sys_clock_48mhz();
+        }
+        else
+        {
+            set_sys_clock_khz(to.khz, true);
+        }
+        if (to.voltage < from.voltage)
+        {
+            vreg_set_voltage(to.voltage);
+        }
+        rederive_peripherals();
+        if (radio)
+        {
+            cyw43_thread_exit();
+        }
+
+        uint64_t const now = time_us_64();
+        total_us[(size_t)current] += now - entered_us;
+        entered_us = now;
+        current = level;
+        printf("sys_clk %lu kHz\n", to.khz);
+#else
+        (void)level;
+#endif
+    }
+
+    Level level()
+    {
+        return current;
+    }
+
+    uint64_t duration_us(Level level)
+    {
+        uint64_t total = total_us[(size_t)level];
+        if (level == current)
+        {
+            total += time_us_64() - entered_us;
+        }
+        return total;
+    }
+
+    uint32_t khz(Level level)
+    {
+        return LEVELS[(size_t)level].khz;
+    }
+}
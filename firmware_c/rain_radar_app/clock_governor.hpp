@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+// Runs sys_clk at what each part of the wake needs: flat out for the TLS handshake and
+// decoding, and as slow as it'll go while waiting on the panel or writing flash.
+//
+// cyw43's PIO SPI is clocked off sys_clk with a divider fixed when it's initialised, which
+// is what went wrong when the whole cycle was dropped to 96 MHz. The divider is set so FAST
+// gives the bus the same 62.5 MHz it gets at the stock 125 MHz, and no level is faster.
+// clk_peri follows sys_clk, so the SPI, I2C and UART baud rates are set again after each change.
+namespace clock_governor
+{
+    enum class Level : uint8_t
+    {
+        IDLE,  // 48 MHz off pll_usb with pll_sys off and the core voltage down
+        RADIO, // the stock 125 MHz, waiting for association
+        FAST,  // 187.5 MHz, TLS and decoding
+        COUNT
+    };
+
+    // Before cyw43_arch_init, which takes the PIO divider. Notes the baud rates to keep.
+    void init();
+
+    void set(Level level);
+    Level level();
+
+    // total time spent at the level so far
+    uint64_t duration_us(Level level);
+    uint32_t khz(Level level);
+}
@@ -0,0 +1,102 @@
+#include "clock_model.hpp"
+
+#include <cstdio>
+#include "time_util.hpp"
+
+namespace clock_model
+{
+    namespace
+    {
+        bool measured(const persistent::ClockStats &clock)
+        {
+            return clock.set_at != 0 && clock.samples != 0;
+        }
+
+        // how far ahead the RTC has got in since_set_s
+        int64_t drift_s(const persistent::ClockStats &clock, int64_t since_set_s)
+        {
+            return (int64_t)clock.drift_ppb * since_set_s / 1000000000;
+        }
+    }
+
+    datetime_t now(const persistent::PersistentData &data, const datetime_t &rtc)
+    {
+        const persistent::ClockStats &clock = data.clock;
+        if (!time_util::is_set(rtc) || !measured(clock))
+        {
+            return rtc;
+        }
+        // rtc = t + drift * (t - set_at), so t = rtc - drift * (rtc - set_at) near enough
+        int64_t const rtc_unix = time_util::to_unix(rtc);
+        return time_util::from_unix(rtc_unix - drift_s(clock, rtc_unix - clock.set_at));
+    }
+
+    bool sync(persistent::PersistentData &data, const datetime_t &rtc, int64_t server_unix)
+    {
+        persistent::ClockStats &clock = data.clock;
+        if (!time_util::is_set(rtc) || clock.set_at == 0 || clock.set_at > server_unix)
+        {
+            clock.set_at = (uint32_t)server_unix;
+            return true;
+        }
+
+        int64_t const error_s = time_util::to_unix(rtc) - server_unix;
+        int64_t const elapsed_s = server_unix - clock.set_at;
+        if (error_s < MAX_ERROR_S && error_s > -MAX_ERROR_S && elapsed_s < MAX_BASELINE_S)
+        {
+            return false;
+        }
+
+        int64_t const sample = elapsed_s ? error_s * 1000000000 / elapsed_s : 0;
+        if (elapsed_s < MIN_BASELINE_S || sample > MAX_DRIFT_PPB || sample < -MAX_DRIFT_PPB)
+        {
+            printf("RTC out by %ld s after %ld s, not counting it as drift\n", (long)error_s, (long)elapsed_s);
+        }
+        else
+        {
+            // new = old + (sample - old) / 4, like the network stats
+            clock.drift_ppb = clock.samples ? (int32_t)(((int64_t)clock.drift_ppb * 3 + sample) / 4) : (int32_t)sample;
+            if (clock.samples < UINT8_MAX)
+            {
+                clock.samples++;
+            }
+            printf("RTC out by %ld s after %ld h, drift now %ld ppb\n", (long)error_s, (long)(elapsed_s / 3600), (long)clock.drift_ppb);
+        }
+        clock.set_at = (uint32_t)server_unix;
+        return true;
+    }
+
+    datetime_t local(const datetime_t &utc)
+    {
+        if (!time_util::is_set(utc))
+        {
+            return utc;
+        }
+        int64_t const t = time_util::to_unix(utc);
+        return time_util::from_unix(t + time_util::london_offset_s(t));
+    }
+
+    schedule::Wake alarm(const persistent::PersistentData &data, const datetime_t &now, const schedule::Wake &local_wake)
+    {
+        // no telling the offset or the drift, and the schedule ran on the RTC as it is
+        if (!time_util::is_set(now))
+        {
+            return local_wake;
+        }
+        int64_t const now_unix = time_util::to_unix(now);
+        int32_t const offset_s = time_util::london_offset_s(now_unix);
+        datetime_t const local_now = time_util::from_unix(now_unix + offset_s);
+        uint32_t const local_s = schedule::time_of_day(local_now.hour, local_now.min, local_now.sec);
+        int64_t at = now_unix + schedule::seconds_until(local_s, local_wake);
+        // if the clocks change before then, the same local time is an hour nearer or further
+        at += offset_s - time_util::london_offset_s(at);
+
+        const persistent::ClockStats &clock = data.clock;
+        if (measured(clock))
+        {
+            at += drift_s(clock, at - clock.set_at);
+        }
+        datetime_t const rtc_at = time_util::from_unix(at);
+        return {rtc_at.hour, rtc_at.min, rtc_at.sec};
+    }
+}
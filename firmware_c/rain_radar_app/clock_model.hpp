@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include "pico/types.h"
+#include "persistent_data.hpp"
+#include "schedule.hpp"
+
+// The RTC is only ever set from the server's Date header, so a wake without the radio (a
+// frame from the SD card or the forecast bundle) has nothing but the RTC to go on. This keeps
+// an estimate of how fast the RTC runs, from how far out it is each time the server's time
+// comes in, and takes that off. The RTC is left alone until it's MAX_ERROR_S out, so the
+// drift is measured over a day or so rather than the 10 minutes between fetches.
+//
+// The RTC and the server are on UTC. The schedule works in Europe/London time so the night
+// is the same hours all year, and alarm() turns a wake it plans back into the RTC's time.
+namespace clock_model
+{
+    // the RTC is set again once it's this far out
+    constexpr int64_t MAX_ERROR_S = 2;
+    // over less than this the drift is mostly the second resolution of the Date header and the RTC
+    constexpr int64_t MIN_BASELINE_S = 12 * 60 * 60;
+    // and it's set at least this often, so one that keeps good time still gets measured
+    constexpr int64_t MAX_BASELINE_S = 7 * 24 * 60 * 60;
+    // anything more is the RTC having been knocked, not drift
+    constexpr int32_t MAX_DRIFT_PPB = 200000;
+
+    // The time as near as can be told from what the RTC says, UTC. The RTC as is until
+    // its drift has been measured.
+    datetime_t now(const persistent::PersistentData &data, const datetime_t &rtc);
+
+    // The server's time, as of now, and what the RTC says. Measures the drift if it's been
+    // long enough since the RTC was set. True if it wants setting to server_unix.
+    bool sync(persistent::PersistentData &data, const datetime_t &rtc, int64_t server_unix);
+
+    // A UTC time in Europe/London, as is if the RTC's never been set
+    datetime_t local(const datetime_t &utc);
+
+    // The RTC alarm for a wake the schedule planned in local time, now being from now()
+    schedule::Wake alarm(const persistent::PersistentData &data, const datetime_t &now, const schedule::Wake &local_wake);
+}
@@ -0,0 +1,107 @@
+#include "core1_tasks.hpp"
+
+#include <cstdio>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/util/queue.h"
+
+namespace core1_tasks
+{
+    namespace
+    {
+        struct Task
+        {
+            TaskFn fn;
+            void *arg;
+        };
+
+        queue_t task_queue;
+        queue_t done_queue;
+        bool running = false;
+        bool busy = false;
+
+        void core1_main()
+        {
+            // lets core0 pause us while it writes to flash
+            multicore_lockout_victim_init();
+            while (true)
+            {
+                Task task;
+                queue_remove_blocking(&task_queue, &task);
+                task.fn(task.arg);
+                bool const done = true;
+                queue_add_blocking(&done_queue, &done);
+            }
+        }
+    }
+
+    void launch()
+    {
+        if (running)
+        {
+            return;
+        }
+        queue_init(&task_queue, sizeof(Task), 1);
+        queue_init(&done_queue, sizeof(bool), 1);
+        multicore_launch_core1(core1_main);
+        running = true;
+        printf("Core1 launched\n");
+    }
+
+    bool launched()
+    {
+        return running;
+    }
+
+    void run(TaskFn fn, void *arg)
+    {
+        launch();
+        assert(!busy);
+        Task const task = {fn, arg};
+        queue_add_blocking(&task_queue, &task);
+        busy = true;
+    }
+
+    void wait()
+    {
+        if (!busy)
+        {
+            return;
+        }
+        bool done;
+        queue_remove_blocking(&done_queue, &done);
+        busy = false;
+    }
+
+    bool try_wait()
+    {
+        if (!busy)
+        {
+            return true;
+        }
+        bool done;
+        if (!queue_try_remove(&done_queue, &done))
+        {
+            return false;
+        }
+        busy = false;
+        return true;
+    }
+
+    FlashLockout::FlashLockout() : locked(running)
+    {
+        if (locked)
+        {
+            multicore_lockout_start_blocking();
+        }
+    }
+
+    FlashLockout::~FlashLockout()
+    {
+        if (locked)
+        {
+            multicore_lockout_end_blocking();
+        }
+    }
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// Runs work on the second core, which otherwise sits idle.
+// Tasks and completions go through pico_util queues. The inter-core FIFO is left alone
+// because core1 is a multicore lockout victim, and the lockout handshake owns the FIFO.
+namespace core1_tasks
+{
+    using TaskFn = void (*)(void *arg);
+
+    // Start core1 waiting for tasks, does nothing if it's already running.
+    void launch();
+    bool launched();
+
+    // Hand fn to core1, launching it if needed. One task at a time, wait() before the next.
+    void run(TaskFn fn, void *arg);
+    // Block until the task given to run has returned.
+    void wait();
+    // Whether the task given to run has returned, without blocking. Once it has, it's as
+    // if wait() had been called.
+    bool try_wait();
+
+    // Parks core1 in RAM for as long as this is alive, so core0 can erase and program
+    // flash without core1 executing from it. Does nothing if core1 isn't running.
+    class FlashLockout
+    {
+    public:
+        FlashLockout();
+        ~FlashLockout();
+
+    private:
+        bool const locked;
+    };
+
+}
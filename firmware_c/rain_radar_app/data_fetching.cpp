@@ -23,17 +23,116 @@
 #include "pico/async_context.h"
 #include "http_client_util.hpp"
 #include "rain_radar_common.hpp"
+#include "time_util.hpp"
+#include "tls_arena.hpp"
 #include "wifi_setup.hpp"
+#include "logging.hpp"
 #include "psram_display.hpp"
 #include "inky_frame_7.hpp"
+#include "panel_stream.hpp"
+#include "basemap.hpp"
+#include "board.hpp"
+#include "forecast_bundle.hpp"
+#include "frame_container.hpp"
+#include "dns_cache.hpp"
+#include "rain_stats.hpp"
 #include "pico/util/datetime.h"
 #include "pico/types.h"
 
 #define HOST "muse-hub.taile8f45.ts.net"
 
+// how long to wait for the next body bytes before giving up on a streamed frame
+#define STREAM_TIMEOUT_MS 10000
+
+// every fetch path here writes a palette index per byte straight into PSRAM
+static_assert(board::ACTIVE.has_psram && board::ACTIVE.packing == board::Packing::BYTE,
+              "the fetch paths need the PSRAM frame buffer");
+
 namespace data_fetching
 {
-    // Parse HTTP date string like "Mon, 27 Oct 2025 21:09:46 GMT" to datetime_t
+    namespace
+    {
+        // query string sent with every request this wake, empty until set_telemetry
+        char telemetry_query[48] = "";
+
+        // a request's path and query
+        using Url = char[96];
+
+        // every body this wake, from its headers arriving to the request finishing
+        uint32_t body_bytes = 0;
+        uint32_t body_ms = 0;
+        uint32_t body_start_ms = 0;
+        bool in_body = false;
+
+        // the longest the server has asked us to wait this wake, in a Retry-After
+        uint32_t retry_after = 0;
+
+        // ms since boot the Date header came in, 0 if the latest request didn't have one
+        uint32_t date_ms = 0;
+
+        // the headers are in, the body follows
+        void begin_body()
+        {
+            wifi_setup::set_power_phase(wifi_setup::PowerPhase::TRANSFER);
+            body_start_ms = to_ms_since_boot(get_absolute_time());
+            in_body = true;
+        }
+
+        // a new request, the last one's Date isn't the time this one's frame goes with
+        void begin_request()
+        {
+            date_ms = 0;
+        }
+
+        void end_body()
+        {
+            wifi_setup::set_power_phase(wifi_setup::PowerPhase::WAIT);
+            if (in_body)
+            {
+                body_ms += to_ms_since_boot(get_absolute_time()) - body_start_ms;
+                in_body = false;
+            }
+        }
+    }
+
+    uint32_t body_throughput()
+    {
+        // anything under a few ms is mostly timer resolution
+        if (body_ms < 20)
+        {
+            return 0;
+        }
+        return body_bytes / body_ms; // bytes per ms is kB/s near enough
+    }
+
+    uint32_t retry_after_s()
+    {
+        return retry_after;
+    }
+
+    uint32_t server_time_ms()
+    {
+        return date_ms;
+    }
+
+    void set_telemetry(const Telemetry &telemetry)
+    {
+        snprintf(telemetry_query, sizeof(telemetry_query), "?vsys=%u&usb=%d&rssi=%ld", telemetry.vsys_mv, telemetry.usb_powered ? 1 : 0, (long)telemetry.rssi);
+    }
+
+    void prime_dns_cache(persistent::PersistentData &data, int64_t now_unix)
+    {
+        dns_cache::prime(data, HOST, now_unix);
+    }
+
+    // Fills in url and returns it, the buffers live on the stack of the request that uses them
+    const char *request_url(int8_t connected_ssid_index, const char *file, Url &url)
+    {
+        snprintf(url, sizeof(url), "/%d/%s%s", connected_ssid_index, file, telemetry_query);
+        return url;
+    }
+
+    // Parse a header with an HTTP date like "Date: Mon, 27 Oct 2025 21:09:46 GMT" to datetime_t
     bool parse_http_date(const char *date_str, datetime_t *dt)
     {
         // Month names for parsing
@@ -44,12 +143,12 @@ namespace data_fetching
         int day, year, hour, min, sec;
 
         // Parse format: "Mon, 27 Oct 2025 21:09:46 GMT"
-        int parsed = sscanf(date_str, "Date: %3s, %d %3s %d %d:%d:%d GMT",
+        int parsed = sscanf(date_str, "%*[^:]: %3s, %d %3s %d %d:%d:%d GMT",
                             day_name, &day, month_name, &year, &hour, &min, &sec);
 
         if (parsed != 7)
         {
-            printf("Failed to parse date string\n");
+            LOG_WARN("Failed to parse date string\n");
             return false;
         }
 
@@ -66,7 +165,7 @@ namespace data_fetching
 
         if (month == 0)
         {
-            printf("Invalid month in date string: %s\n", month_name);
+            LOG_WARN("Invalid month in date string\n");
             return false;
         }
 
@@ -79,7 +178,7 @@ namespace data_fetching
         dt->sec = sec;
         dt->dotw = 0; // Day of week - we could calculate this but it's not critical
 
-        printf("Parsed date: %04d-%02d-%02d %02d:%02d:%02d\n",
+        LOG_INFO("Parsed date: %04d-%02d-%02d %02d:%02d:%02d\n",
                dt->year, dt->month, dt->day, dt->hour, dt->min, dt->sec);
 
         return true;
@@ -145,25 +244,21 @@ namespace data_fetching
     {
         datetime_t server_datetime;
         pimoroni::PSRamDisplay &psram_display;
-        size_t const max_address_write;
         size_t offset = 0;
         Err result;
 
         ImageWriterHelper(pimoroni::InkyFrame &inky_frame)
             : server_datetime({0})
             , psram_display(inky_frame.ramDisplay)
-            , max_address_write(inky_frame.width * inky_frame.height)
             , offset(0)
             , result(Err::OK)
         {
         }
     };
 
-    err_t datetime_header_parser(__unused httpc_state_t *connection, void *arg, struct pbuf *hdr, u16_t hdr_len, __unused u32_t content_len)
+    // Look for the Date header and parse it into dt
+    bool parse_date_header(struct pbuf *hdr, datetime_t *dt)
     {
-        printf("\nheaders %u\n", hdr_len);
-        ImageWriterHelper *info = (ImageWriterHelper *)arg;
-
         const char *header_buffer = (const char *)hdr->payload;
         size_t header_buffer_len = hdr->len;
 
@@ -171,29 +266,67 @@ namespace data_fetching
         const char *date_header = "Date: ";
         const char *date_start = strnstr(header_buffer, date_header, header_buffer_len);
         // date_start might not be null terminate!
-        if (date_start)
+        if (!date_start)
         {
-            char safe_buffer[64];
-            size_t copy_len = strnlen(date_start, sizeof(safe_buffer) - 1);
-            memcpy(safe_buffer, date_start, copy_len);
-            safe_buffer[copy_len] = '\0';
-            printf("Found Date header: %s\n", safe_buffer);
+            LOG_WARN("No Date header found\n");
+            return false;
+        }
 
-            // Parse the date directly - sscanf will stop at the end of the valid format
-            if (parse_http_date(safe_buffer, &info->server_datetime))
-            {
-                printf("Successfully parsed server datetime\n");
-            }
-            else
-            {
-                printf("Failed to parse server datetime\n");
-            }
+        char safe_buffer[64];
+        size_t copy_len = strnlen(date_start, sizeof(safe_buffer) - 1);
+        memcpy(safe_buffer, date_start, copy_len);
+        safe_buffer[copy_len] = '\0';
+
+        // Parse the date directly - sscanf will stop at the end of the valid format
+        if (parse_http_date(safe_buffer, dt))
+        {
+            date_ms = to_ms_since_boot(get_absolute_time());
+            LOG_DEBUG("Successfully parsed server datetime\n");
+            return true;
         }
-        else
+        LOG_WARN("Failed to parse server datetime\n");
+        return false;
+    }
+
+    // Look for a Retry-After header, sent with a 429 or 503. It's either seconds or a date,
+    // which is taken relative to the Date header in case our clock is off.
+    void parse_retry_after(struct pbuf *hdr)
+    {
+        const char *header_buffer = (const char *)hdr->payload;
+        const char *retry_start = strnstr(header_buffer, "Retry-After: ", hdr->len);
+        if (!retry_start)
+        {
+            return;
+        }
+
+        char safe_buffer[64];
+        size_t const copy_len = MIN(sizeof(safe_buffer) - 1, (size_t)(header_buffer + hdr->len - retry_start));
+        memcpy(safe_buffer, retry_start, copy_len);
+        safe_buffer[copy_len] = '\0';
+
+        const char *value = safe_buffer + strlen("Retry-After: ");
+        uint32_t seconds = 0;
+        datetime_t until, server_time;
+        if (*value >= '0' && *value <= '9')
         {
-            printf("No Date header found\n");
+            seconds = strtoul(value, nullptr, 10);
         }
+        else if (parse_http_date(safe_buffer, &until) && parse_date_header(hdr, &server_time))
+        {
+            int64_t const diff = time_util::to_unix(until) - time_util::to_unix(server_time);
+            seconds = diff > 0 ? (uint32_t)diff : 0;
+        }
+        LOG_INFO("Retry-After %lu s\n", seconds);
+        retry_after = MAX(retry_after, seconds);
+    }
 
+    err_t datetime_header_parser(__unused httpc_state_t *connection, void *arg, struct pbuf *hdr, u16_t hdr_len, __unused u32_t content_len)
+    {
+        LOG_DEBUG("headers %u\n", hdr_len);
+        begin_body();
+        parse_retry_after(hdr);
+        ImageWriterHelper *info = (ImageWriterHelper *)arg;
+        parse_date_header(hdr, &info->server_datetime);
         return ERR_OK;
     }
 
@@ -228,11 +361,11 @@ namespace data_fetching
     //     return result ? Err::ERROR : ResultOr(info);
     // }
 
-    err_t image_data_callback_fn(void *_arg, __unused struct altcp_pcb *conn, struct pbuf *p, err_t err)
+    err_t HOT_PATH(image_data_callback_fn)(void *_arg, __unused struct altcp_pcb *conn, struct pbuf *p, err_t err)
     {
         if (err != ERR_OK || p == NULL)
         {
-            printf("Error in image_data_callback_fn: %d\n", err);
+            LOG_ERROR("Error in image_data_callback_fn: %d\n", err);
             return err;
         }
 
@@ -240,18 +373,20 @@ namespace data_fetching
 
         // TODO: handle pbuf chains
         size_t body_len = p->len;
-        // printf("Received image data chunk of %u bytes\n", body_len);
+        LOG_DEBUG("Received image data chunk of %u bytes\n", body_len);
 
         // Ive had to modify PSRamDisplay to make the write function and pointToAddress public
         size_t offset = image_writer->offset;
         size_t new_offset = offset + body_len;
-        if (new_offset > image_writer->max_address_write)
+        if (new_offset > board::PIXELS)
         {
-            printf("Image data exceeds display size\n");
+            LOG_ERROR("Image data exceeds display size\n");
             return ERR_BUF;
         }
+        rain_stats::add_pixels(offset, (const uint8_t *)p->payload, body_len);
         image_writer->psram_display.write_span(offset, body_len, (const uint8_t *)p->payload);
         image_writer->offset = new_offset;
+        body_bytes += body_len;
 
         // https://forums.raspberrypi.com/viewtopic.php?t=385648
         altcp_recved(conn, body_len);
@@ -280,25 +415,27 @@ namespace data_fetching
 
         http_client_util::http_req_t req = {0};
         req.hostname = HOST;
-        std::string url_str = "/" + std::to_string(connected_ssid_index) + "/quantized.bin";
-        req.url = url_str.c_str();
+        Url url;
+        req.url = request_url(connected_ssid_index, "quantized.bin", url);
         printf("Requesting URL: %s from %s\n", req.url, req.hostname);
 
         ImageWriterHelper image_writer(inky_frame);
+        rain_stats::begin();
 
         req.callback_arg = &image_writer;
 
         req.headers_fn = datetime_header_parser;
         req.recv_fn = image_data_callback_fn;
-        /* No CA certificate checking */
-        struct altcp_tls_config *tls_config = altcp_tls_create_config_client(NULL, 0);
+        struct altcp_tls_config *tls_config = tls_arena::create_config();
         assert(tls_config);
         req.tls_config = tls_config; // setting tls_config enables https
 
         req.result_fn = result_fn;
 
+        begin_request();
         int result = http_client_util::http_client_request_sync(cyw43_arch_async_context(), &req);
-        altcp_tls_free_config(tls_config);
+        end_body();
+        tls_arena::free_config(tls_config);
 
         if (image_writer.result != Err::OK)
         {
@@ -318,4 +455,648 @@ namespace data_fetching
         return ResultOr<datetime_t>(image_writer.server_datetime);
     }
 
+    // Hands each chunk of the body to consume as it arrives, for bodies that are
+    // processed on the fly rather than written to PSRAM as is.
+    struct ChunkSink
+    {
+        datetime_t server_datetime = {0};
+        std::function<Err(const uint8_t *, size_t)> consume;
+        Err result = Err::OK;
+    };
+
+    err_t chunk_header_fn(__unused httpc_state_t *connection, void *arg, struct pbuf *hdr, u16_t hdr_len, __unused u32_t content_len)
+    {
+        LOG_DEBUG("headers %u\n", hdr_len);
+        begin_body();
+        parse_retry_after(hdr);
+        ChunkSink *sink = (ChunkSink *)arg;
+        parse_date_header(hdr, &sink->server_datetime);
+        return ERR_OK;
+    }
+
+    err_t HOT_PATH(chunk_recv_fn)(void *arg, struct altcp_pcb *conn, struct pbuf *p, err_t err)
+    {
+        if (err != ERR_OK || p == NULL)
+        {
+            LOG_ERROR("Error in chunk_recv_fn: %d\n", err);
+            return err;
+        }
+
+        ChunkSink *sink = (ChunkSink *)arg;
+        body_bytes += p->tot_len;
+        for (struct pbuf *q = p; q && sink->result == Err::OK; q = q->next)
+        {
+            sink->result = sink->consume((const uint8_t *)q->payload, q->len);
+        }
+        // once something has gone wrong the rest of the body is just drained
+        altcp_recved(conn, p->tot_len);
+        pbuf_free(p);
+        return ERR_OK;
+    }
+
+    void chunk_result_fn(void *arg, __unused httpc_result_t httpc_result, __unused u32_t rx_content_len, u32_t srv_res, __unused err_t err)
+    {
+        ChunkSink *sink = (ChunkSink *)arg;
+        if (sink->result == Err::OK)
+        {
+            sink->result = httpStatusToErr(srv_res);
+        }
+    }
+
+    Err fetch_chunks(const char *url, ChunkSink &sink)
+    {
+        http_client_util::http_req_t req = {0};
+        req.hostname = HOST;
+        req.url = url;
+        printf("Requesting URL: %s from %s\n", req.url, req.hostname);
+
+        req.callback_arg = &sink;
+        req.headers_fn = chunk_header_fn;
+        req.recv_fn = chunk_recv_fn;
+        req.result_fn = chunk_result_fn;
+        struct altcp_tls_config *tls_config = tls_arena::create_config();
+        assert(tls_config);
+        req.tls_config = tls_config; // setting tls_config enables https
+
+        begin_request();
+        int result = http_client_util::http_client_request_sync(cyw43_arch_async_context(), &req);
+        end_body();
+        tls_arena::free_config(tls_config);
+
+        if (sink.result != Err::OK)
+        {
+            return sink.result;
+        }
+        return result ? Err::ERROR : Err::OK;
+    }
+
+    ResultOr<TransferStats> fetch_and_discard(int8_t connected_ssid_index, const char *file)
+    {
+        TransferStats stats;
+        uint32_t const start_ms = to_ms_since_boot(get_absolute_time());
+        ChunkSink sink;
+        sink.consume = [&](__unused const uint8_t *data, size_t len) -> Err
+        {
+            uint32_t const now_ms = to_ms_since_boot(get_absolute_time()) - start_ms;
+            if (!stats.bytes)
+            {
+                stats.first_byte_ms = now_ms;
+            }
+            stats.bytes += len;
+            stats.last_byte_ms = now_ms;
+            return Err::OK;
+        };
+        Url url;
+        Err err = fetch_chunks(request_url(connected_ssid_index, file, url), sink);
+        if (err != Err::OK)
+        {
+            return err;
+        }
+        return ResultOr<TransferStats>(stats);
+    }
+
+    // basemap.bin is the basemap's version (little endian u32) followed by the packed pixels
+    Err fetch_basemap(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index)
+    {
+        basemap::FlashWriter writer(inky_frame.ramDisplay);
+        uint8_t version_bytes[4];
+        size_t version_len = 0;
+        bool started = false;
+
+        ChunkSink sink;
+        sink.consume = [&](const uint8_t *data, size_t len) -> Err
+        {
+            if (!started)
+            {
+                size_t const n = MIN(len, sizeof(version_bytes) - version_len);
+                memcpy(version_bytes + version_len, data, n);
+                version_len += n;
+                data += n;
+                len -= n;
+                if (version_len < sizeof(version_bytes))
+                {
+                    return Err::OK;
+                }
+                uint32_t const version = version_bytes[0] | (version_bytes[1] << 8) | (version_bytes[2] << 16) | ((uint32_t)version_bytes[3] << 24);
+                LOG_INFO("Downloading basemap version %lu\n", version);
+                Err err = writer.begin(version, board::WIDTH, board::HEIGHT);
+                if (err != Err::OK)
+                {
+                    return err;
+                }
+                started = true;
+            }
+            return len ? writer.write(data, len) : Err::OK;
+        };
+
+        Url url;
+        Err err = fetch_chunks(request_url(connected_ssid_index, "basemap.bin", url), sink);
+        if (err != Err::OK)
+        {
+            return err;
+        }
+        // the request's done, so holding off interrupts for the flash writes stalls nothing
+        return started ? writer.finish() : Err::NO_DATA;
+    }
+
+    ResultOr<datetime_t> fetch_rain_grid(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index, RainGrid &grid)
+    {
+        printf("Fetching rain grid for SSID index %d\n", connected_ssid_index);
+
+        if (!wifi_setup::is_connected())
+        {
+            printf("Not connected to WiFi!\n");
+            return Err::NO_CONNECTION;
+        }
+
+        // u32 magic, u32 basemap version, u16 width, u16 height, u32 text length,
+        // then the intensities a row at a time, then the text
+        constexpr uint32_t GRID_MAGIC = 0x47495252; // "RRIG"
+        constexpr size_t GRID_HEADER_LEN = 16;
+        constexpr size_t MAX_GRID_BYTES = 64 * 1024;
+        uint8_t header[GRID_HEADER_LEN];
+        size_t header_len = 0;
+        uint32_t basemap_version = 0;
+        size_t grid_bytes = 0;
+        size_t text_len = 0;
+
+        grid.intensities.clear();
+        grid.text.clear();
+
+        ChunkSink sink;
+        sink.consume = [&](const uint8_t *data, size_t len) -> Err
+        {
+            if (header_len < GRID_HEADER_LEN)
+            {
+                size_t const n = MIN(len, GRID_HEADER_LEN - header_len);
+                memcpy(header + header_len, data, n);
+                header_len += n;
+                data += n;
+                len -= n;
+                if (header_len < GRID_HEADER_LEN)
+                {
+                    return Err::OK;
+                }
+                uint32_t magic;
+                memcpy(&magic, header, 4);
+                memcpy(&basemap_version, header + 4, 4);
+                memcpy(&grid.width, header + 8, 2);
+                memcpy(&grid.height, header + 10, 2);
+                uint32_t declared_text_len;
+                memcpy(&declared_text_len, header + 12, 4);
+                grid_bytes = grid.width * grid.height;
+                text_len = declared_text_len;
+                if (magic != GRID_MAGIC || grid_bytes == 0 || grid_bytes > MAX_GRID_BYTES || text_len > overlays::MAX_TEXT_LEN)
+                {
+                    LOG_ERROR("Not a usable rain grid\n");
+                    return Err::INVALID_RESPONSE;
+                }
+                grid.intensities.reserve(grid_bytes);
+            }
+            size_t const n = MIN(len, grid_bytes - grid.intensities.size());
+            grid.intensities.insert(grid.intensities.end(), data, data + n);
+            data += n;
+            len -= n;
+            if (len > text_len - grid.text.size())
+            {
+                LOG_ERROR("Rain grid is longer than it says\n");
+                return Err::INVALID_RESPONSE;
+            }
+            grid.text.append((const char *)data, len);
+            return Err::OK;
+        };
+
+        Url url;
+        Err err = fetch_chunks(request_url(connected_ssid_index, "rain_grid.bin", url), sink);
+        if (err == Err::OK && (grid.intensities.size() != grid_bytes || grid.text.size() != text_len || grid_bytes == 0))
+        {
+            err = Err::NO_DATA;
+        }
+        if (err == Err::OK && basemap_version != basemap::stored_version(board::WIDTH, board::HEIGHT))
+        {
+            // the grid is drawn over the same basemap as the precip layer
+            printf("Rain grid wants basemap %lu\n", basemap_version);
+            err = fetch_basemap(inky_frame, connected_ssid_index);
+            if (err == Err::OK && basemap_version != basemap::stored_version(board::WIDTH, board::HEIGHT))
+            {
+                err = Err::BASEMAP_OUT_OF_DATE;
+            }
+        }
+        if (err != Err::OK)
+        {
+            return err;
+        }
+        if (sink.server_datetime.year == 0)
+        {
+            printf("No valid server datetime received\n");
+            return Err::COULDNT_PARSE_DATE;
+        }
+        return ResultOr<datetime_t>(sink.server_datetime);
+    }
+
+    ResultOr<datetime_t> fetch_forecast_bundle(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index)
+    {
+        printf("Fetching forecast bundle for SSID index %d\n", connected_ssid_index);
+
+        if (!wifi_setup::is_connected())
+        {
+            printf("Not connected to WiFi!\n");
+            return Err::NO_CONNECTION;
+        }
+
+        forecast_bundle::Writer writer(inky_frame.ramDisplay);
+        Err err = writer.begin();
+        if (err != Err::OK)
+        {
+            return err;
+        }
+
+        // into PSRAM as it arrives, it's too big to hold in RAM, and onto the SD card after
+        ChunkSink sink;
+        sink.consume = [&writer](const uint8_t *data, size_t len)
+        { return writer.write(data, len); };
+        Url url;
+        err = fetch_chunks(request_url(connected_ssid_index, "forecast_bundle.bin", url), sink);
+        if (err == Err::OK && sink.server_datetime.year == 0)
+        {
+            printf("No valid server datetime received\n");
+            err = Err::COULDNT_PARSE_DATE;
+        }
+        if (err != Err::OK)
+        {
+            // the previous bundle's still on the card
+            return err;
+        }
+        err = writer.finish(sink.server_datetime);
+        if (err != Err::OK)
+        {
+            return err;
+        }
+
+        // every frame is drawn over the basemap, so it has to be current before any are shown
+        uint32_t const wanted = writer.bundle_basemap_version();
+        if (wanted != basemap::stored_version(board::WIDTH, board::HEIGHT))
+        {
+            printf("Forecast bundle wants basemap %lu\n", wanted);
+            err = fetch_basemap(inky_frame, connected_ssid_index);
+            if (err == Err::OK && wanted != basemap::stored_version(board::WIDTH, board::HEIGHT))
+            {
+                err = Err::BASEMAP_OUT_OF_DATE;
+            }
+            if (err != Err::OK)
+            {
+                return err;
+            }
+        }
+        return ResultOr<datetime_t>(sink.server_datetime);
+    }
+
+    ResultOr<datetime_t> fetch_layered_image(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index)
+    {
+        printf("Fetching precip layer for SSID index %d\n", connected_ssid_index);
+
+        if (!wifi_setup::is_connected())
+        {
+            printf("Not connected to WiFi!\n");
+            return Err::NO_CONNECTION;
+        }
+
+        Url url;
+        request_url(connected_ssid_index, "precip_layer.bin", url);
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            basemap::PrecipCompositor compositor(inky_frame.ramDisplay);
+            ChunkSink sink;
+            sink.consume = [&compositor](const uint8_t *data, size_t len)
+            { return compositor.feed(data, len); };
+
+            Err err = fetch_chunks(url, sink);
+            if (err == Err::OK)
+            {
+                err = compositor.finish();
+            }
+            if (err == Err::BASEMAP_OUT_OF_DATE && attempt == 0)
+            {
+                // only the basemap is stale, grab the new one and go again
+                err = fetch_basemap(inky_frame, connected_ssid_index);
+                if (err != Err::OK)
+                {
+                    return err;
+                }
+                continue;
+            }
+            if (err != Err::OK)
+            {
+                return err;
+            }
+            if (sink.server_datetime.year == 0)
+            {
+                printf("No valid server datetime received\n");
+                return Err::COULDNT_PARSE_DATE;
+            }
+            return ResultOr<datetime_t>(sink.server_datetime);
+        }
+        return Err::BASEMAP_OUT_OF_DATE;
+    }
+
+    ResultOr<datetime_t> fetch_frame_container(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index, const char *file, frame_container::Info &info)
+    {
+        printf("Fetching %s for SSID index %d\n", file, connected_ssid_index);
+
+        if (!wifi_setup::is_connected())
+        {
+            printf("Not connected to WiFi!\n");
+            return Err::NO_CONNECTION;
+        }
+
+        Url url;
+        request_url(connected_ssid_index, file, url);
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            // straight into PSRAM, once the header has said what it is
+            frame_container::Decoder decoder(inky_frame.ramDisplay);
+            frame_container::Reader reader(
+                [&decoder](const frame_container::Info &header)
+                { return decoder.begin(header); },
+                [&decoder](const uint8_t *data, size_t len)
+                { return decoder.write(data, len); });
+
+            ChunkSink sink;
+            sink.consume = [&reader](const uint8_t *data, size_t len)
+            { return reader.feed(data, len); };
+
+            Err err = fetch_chunks(url, sink);
+            if (err == Err::OK)
+            {
+                err = reader.finish();
+            }
+            if (err == Err::OK)
+            {
+                err = decoder.finish();
+            }
+            if (err == Err::BASEMAP_OUT_OF_DATE && attempt == 0)
+            {
+                // same as the precip layer on its own
+                err = fetch_basemap(inky_frame, connected_ssid_index);
+                if (err != Err::OK)
+                {
+                    return err;
+                }
+                continue;
+            }
+            if (err != Err::OK)
+            {
+                return err;
+            }
+
+            info = reader.info();
+            if (sink.server_datetime.year == 0)
+            {
+                if (info.frame_time == 0)
+                {
+                    printf("No valid server datetime received\n");
+                    return Err::COULDNT_PARSE_DATE;
+                }
+                // at most one publish behind, better than throwing away a good frame
+                LOG_WARN("No Date header, going by the frame's time\n");
+                sink.server_datetime = time_util::from_unix(info.frame_time);
+            }
+            return ResultOr<datetime_t>(sink.server_datetime);
+        }
+        return Err::BASEMAP_OUT_OF_DATE;
+    }
+
+    // Body data that has arrived but not been pushed to the panel yet.
+    // The pbufs are held, and altcp_recved isn't called, until the panel side
+    // has consumed them. This keeps the TCP window closed so the server is
+    // throttled to the rate we can push pixels over SPI.
+    struct StreamReceiver
+    {
+        datetime_t server_datetime = {0};
+        u32_t const expected_len;
+        struct pbuf *queued = nullptr;
+        struct altcp_pcb *conn = nullptr;
+        bool complete = false;
+        Err result = Err::OK;
+
+        explicit StreamReceiver(u32_t expected_len) : expected_len(expected_len) {}
+    };
+
+    err_t stream_header_fn(__unused httpc_state_t *connection, void *arg, struct pbuf *hdr, u16_t hdr_len, u32_t content_len)
+    {
+        LOG_DEBUG("headers %u\n", hdr_len);
+        begin_body();
+        parse_retry_after(hdr);
+        StreamReceiver *rx = (StreamReceiver *)arg;
+        parse_date_header(hdr, &rx->server_datetime);
+
+        // content_len is 0xFFFFFFFF when the server didn't send one
+        if (content_len != 0xFFFFFFFF && content_len != rx->expected_len)
+        {
+            LOG_ERROR("Unexpected content length %lu, expected %lu\n", content_len, rx->expected_len);
+            rx->result = Err::INVALID_RESPONSE;
+            return ERR_VAL; // aborts the connection
+        }
+        return ERR_OK;
+    }
+
+    err_t HOT_PATH(stream_recv_fn)(void *arg, struct altcp_pcb *conn, struct pbuf *p, err_t err)
+    {
+        if (err != ERR_OK || p == NULL)
+        {
+            LOG_ERROR("Error in stream_recv_fn: %d\n", err);
+            return err;
+        }
+
+        StreamReceiver *rx = (StreamReceiver *)arg;
+        rx->conn = conn;
+        body_bytes += p->tot_len;
+        if (rx->queued)
+        {
+            pbuf_cat(rx->queued, p);
+        }
+        else
+        {
+            rx->queued = p;
+        }
+        return ERR_OK;
+    }
+
+    void stream_result_fn(void *arg, __unused httpc_result_t httpc_result, __unused u32_t rx_content_len, u32_t srv_res, __unused err_t err)
+    {
+        StreamReceiver *rx = (StreamReceiver *)arg;
+        if (rx->result == Err::OK)
+        {
+            rx->result = httpStatusToErr(srv_res);
+        }
+        // httpc frees the connection after this
+        rx->conn = nullptr;
+        rx->complete = true;
+    }
+
+    // Wait until there is body data queued or the request has finished.
+    bool wait_for_body(StreamReceiver &rx)
+    {
+        absolute_time_t const deadline = make_timeout_time_ms(STREAM_TIMEOUT_MS);
+        while (!time_reached(deadline))
+        {
+            cyw43_arch_lwip_begin();
+            bool const has_data = rx.queued != nullptr;
+            bool const finished = rx.complete;
+            cyw43_arch_lwip_end();
+            if (has_data)
+            {
+                return true;
+            }
+            if (finished)
+            {
+                return false;
+            }
+            cyw43_arch_wait_for_work_until(deadline);
+        }
+        return false;
+    }
+
+    // Copy exactly len body bytes out of the queue, blocking until they arrive.
+    bool read_body(StreamReceiver &rx, uint8_t *dst, size_t len)
+    {
+        size_t got = 0;
+        absolute_time_t deadline = make_timeout_time_ms(STREAM_TIMEOUT_MS);
+        while (got < len)
+        {
+            cyw43_arch_lwip_begin();
+            u16_t n = 0;
+            if (rx.queued)
+            {
+                n = (u16_t)MIN(len - got, rx.queued->tot_len);
+                pbuf_copy_partial(rx.queued, dst + got, n, 0);
+                rx.queued = pbuf_free_header(rx.queued, n);
+                if (rx.conn)
+                {
+                    // reopen the window now that we've used the data
+                    altcp_recved(rx.conn, n);
+                }
+            }
+            bool const finished = rx.complete;
+            cyw43_arch_lwip_end();
+
+            if (n)
+            {
+                got += n;
+                deadline = make_timeout_time_ms(STREAM_TIMEOUT_MS);
+                continue;
+            }
+            if (finished || time_reached(deadline))
+            {
+                return false;
+            }
+            cyw43_arch_wait_for_work_until(deadline);
+        }
+        return true;
+    }
+
+    // Drop anything still queued, e.g. after an error.
+    void discard_queued(StreamReceiver &rx)
+    {
+        cyw43_arch_lwip_begin();
+        if (rx.queued)
+        {
+            if (rx.conn)
+            {
+                altcp_recved(rx.conn, rx.queued->tot_len);
+            }
+            pbuf_free(rx.queued);
+            rx.queued = nullptr;
+        }
+        cyw43_arch_lwip_end();
+    }
+
+    ResultOr<datetime_t> stream_image_to_panel(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index, overlays::OverlayList &overlays, const std::function<void(const datetime_t &)> &on_server_time)
+    {
+        printf("Streaming image for SSID index %d\n", connected_ssid_index);
+
+        if (!wifi_setup::is_connected())
+        {
+            printf("Not connected to WiFi!\n");
+            return Err::NO_CONNECTION;
+        }
+
+        http_client_util::http_req_t req = {0};
+        req.hostname = HOST;
+        Url url;
+        req.url = request_url(connected_ssid_index, "quantized_packed.bin", url);
+        printf("Requesting URL: %s from %s\n", req.url, req.hostname);
+
+        // the server sends the panel's native format, two pixels per byte
+        StreamReceiver rx(board::PIXELS / 2);
+        req.callback_arg = &rx;
+        req.headers_fn = stream_header_fn;
+        req.recv_fn = stream_recv_fn;
+        req.result_fn = stream_result_fn;
+        struct altcp_tls_config *tls_config = tls_arena::create_config();
+        assert(tls_config);
+        req.tls_config = tls_config; // setting tls_config enables https
+
+        begin_request();
+        if (http_client_util::http_client_request_async(cyw43_arch_async_context(), &req))
+        {
+            tls_arena::free_config(tls_config);
+            return Err::ERROR;
+        }
+
+        // don't touch the panel until we know a body is coming
+        bool const has_body = wait_for_body(rx);
+        Err err = rx.result;
+        if (has_body && err == Err::OK)
+        {
+            if (rx.server_datetime.year != 0)
+            {
+                // headers are in, so the overlays that depend on the time can be added
+                on_server_time(rx.server_datetime);
+            }
+            // only the scheduler gets these, the overlays are already going out with the rows
+            rain_stats::begin();
+            bool const complete = panel_stream::stream_to_panel(
+                inky_frame,
+                [&rx](int y, uint8_t *packed_row, size_t len)
+                {
+                    if (!read_body(rx, packed_row, len))
+                    {
+                        return false;
+                    }
+                    rain_stats::add_packed_row(y, packed_row, len);
+                    return true;
+                },
+                overlays);
+            if (!complete)
+            {
+                err = rx.result != Err::OK ? rx.result : Err::NO_DATA;
+            }
+        }
+        else if (err == Err::OK)
+        {
+            err = rx.complete ? Err::NO_DATA : Err::TIMEOUT;
+        }
+
+        // let httpc finish up before the tls config goes away
+        do
+        {
+            discard_queued(rx);
+        } while (!rx.complete && wait_for_body(rx));
+        discard_queued(rx);
+        end_body();
+        tls_arena::free_config(tls_config);
+
+        if (err != Err::OK)
+        {
+            return err;
+        }
+        if (rx.server_datetime.year == 0)
+        {
+            printf("No valid server datetime received\n");
+            return Err::COULDNT_PARSE_DATE;
+        }
+        return ResultOr<datetime_t>(rx.server_datetime);
+    }
+
 }
\ No newline at end of file
@@ -1,8 +1,13 @@
 #pragma once
 
 #include "rain_radar_common.hpp"
+#include <functional>
 #include <string>
+#include <vector>
+#include "frame_container.hpp"
 #include "inky_frame_7.hpp"
+#include "overlays.hpp"
+#include "persistent_data.hpp"
 #include "pico/types.h"
 
 namespace data_fetching
@@ -16,7 +21,81 @@ namespace data_fetching
     //     // char image_text[64];
     // };
 
+    // Read while the radio is up and sent as query parameters on the requests that follow,
+    // so it rides along on the frame download rather than needing a connection of its own
+    struct Telemetry
+    {
+        uint16_t vsys_mv;
+        bool usb_powered;
+        int32_t rssi;
+    };
+
+    void set_telemetry(const Telemetry &telemetry);
+
+    // Once connected: the first request can go to the server's address from the last
+    // wake rather than waiting on a lookup, see dns_cache. now_unix is 0 if the RTC isn't set.
+    void prime_dns_cache(persistent::PersistentData &data, int64_t now_unix);
+
     // ResultOr<ImageInfo> fetch_image_info(int8_t connected_ssid_index);
     ResultOr<datetime_t> fetch_image(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index);
+
+    // Builds the frame in PSRAM from the basemap cached in flash plus the server's sparse
+    // precipitation layer. Downloads a new basemap first if the layer was made for a different one.
+    ResultOr<datetime_t> fetch_layered_image(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index);
+
+    // A frame container, frame.bin or one of the smaller quality tiers (see quality_tier::file):
+    // the frame in whichever encoding the server picked, with a header that says which, when
+    // the next one's due and how much rain there is at the points of interest (see
+    // frame_container.hpp). Decodes it into PSRAM as it streams in and fills in info.
+    // Err::UNSUPPORTED if it's in an encoding this firmware doesn't know.
+    ResultOr<datetime_t> fetch_frame_container(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index, const char *file, frame_container::Info &info);
+
+    // Downloads the next few frames onto the SD card, plus the basemap if that's out of date.
+    // Nothing is drawn, see forecast_bundle::show_frame.
+    ResultOr<datetime_t> fetch_forecast_bundle(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index);
+
+    // Rain intensities at a fraction of the display's resolution, for the device to dither itself
+    struct RainGrid
+    {
+        uint16_t width = 0;
+        uint16_t height = 0;
+        // dBZ, bit 7 set for snow, one byte per cell a row at a time
+        std::vector<uint8_t> intensities;
+        // the caption the server would have drawn
+        std::string text;
+    };
+
+    // Downloads the rain grid, and the basemap it goes over if the one in flash is out of date.
+    // Nothing is drawn, see rain_grid::render.
+    ResultOr<datetime_t> fetch_rain_grid(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index, RainGrid &grid);
+
+    // How a download went, times are from the request being made
+    struct TransferStats
+    {
+        uint32_t bytes = 0;
+        uint32_t first_byte_ms = 0;
+        uint32_t last_byte_ms = 0;
+    };
+
+    // kB/s over all the bodies downloaded this wake, 0 if there's been too little to tell
+    uint32_t body_throughput();
+
+    // The longest the server has asked us to wait before trying again this wake, in a
+    // Retry-After with a 429 or 503. 0 if it hasn't.
+    uint32_t retry_after_s();
+
+    // When the server's time that the fetches return came in, ms since boot. It's to the
+    // second, and by the time the frame's in it's a few seconds old. 0 if the latest request
+    // had no Date header, when the time returned is the frame's, not the server's clock.
+    uint32_t server_time_ms();
+
+    // Download a file from the server and throw it away, for benchmarks
+    ResultOr<TransferStats> fetch_and_discard(int8_t connected_ssid_index, const char *file);
+
+    // Direct streaming mode: the server sends the frame packed 4 bits per pixel and each
+    // scanline goes straight to the Inky73 as it arrives, with the overlays composited inline.
+    // on_server_time is called once the Date header is in, before any rows are drawn, so that
+    // time dependent overlays can still be added. Returns once the panel refresh has started.
+    ResultOr<datetime_t> stream_image_to_panel(pimoroni::InkyFrame &inky_frame, int8_t connected_ssid_index, overlays::OverlayList &overlays, const std::function<void(const datetime_t &)> &on_server_time);
     
 }
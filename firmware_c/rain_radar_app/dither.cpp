@@ -0,0 +1,206 @@
+#include "dither.hpp"
+
+#include <array>
+#include <cstring>
+
+namespace dither
+{
+    namespace
+    {
+        struct Rgb
+        {
+            int16_t r, g, b;
+        };
+
+        // same order as the Inky73 pens and the server's INKY_FRAME_PALETTE
+        constexpr Rgb PALETTE[] = {
+            {0, 0, 0},       // BLACK
+            {255, 255, 255}, // WHITE
+            {0, 255, 0},     // GREEN
+            {0, 0, 255},     // BLUE
+            {255, 0, 0},     // RED
+            {255, 255, 0},   // YELLOW
+            {255, 140, 0},   // ORANGE
+        };
+        constexpr uint8_t PALETTE_SIZE = sizeof(PALETTE) / sizeof(PALETTE[0]);
+
+        struct Stop
+        {
+            int intensity;
+            Rgb colour;
+        };
+
+        // must match the color_stops in the server's intensity_to_color
+        constexpr Stop STOPS[] = {
+            {0, PALETTE[0]},
+            {10, PALETTE[2]},
+            {30, PALETTE[3]},
+            {50, PALETTE[5]},
+            {70, PALETTE[6]},
+            {100, PALETTE[4]},
+            {127, PALETTE[1]},
+        };
+        constexpr int INTENSITY_MAX = 127;
+
+        constexpr int16_t lerp(int16_t c1, int16_t c2, int num, int den)
+        {
+            // the server truncates the whole sum with int(), which for a falling ramp isn't the
+            // same as truncating the step. The sum's never negative, so this matches it.
+            return (c1 * den + (c2 - c1) * num) / den;
+        }
+
+        constexpr Rgb stop_colour(int intensity)
+        {
+            for (size_t i = 0; i + 1 < sizeof(STOPS) / sizeof(STOPS[0]); i++)
+            {
+                const Stop &a = STOPS[i];
+                const Stop &b = STOPS[i + 1];
+                if (a.intensity <= intensity && intensity <= b.intensity)
+                {
+                    int const num = intensity - a.intensity;
+                    int const den = b.intensity - a.intensity;
+                    return {lerp(a.colour.r, b.colour.r, num, den), lerp(a.colour.g, b.colour.g, num, den), lerp(a.colour.b, b.colour.b, num, den)};
+                }
+            }
+            return PALETTE[1];
+        }
+
+        // the colour the server would paint each grid value, before quantising
+        constexpr std::array<Rgb, 256> make_lut()
+        {
+            std::array<Rgb, 256> lut = {};
+            for (int v = 0; v < 256; v++)
+            {
+                if (v & SNOW_BIT)
+                {
+                    lut[v] = PALETTE[1];
+                }
+                else
+                {
+                    lut[v] = stop_colour(v < INTENSITY_MAX ? v : INTENSITY_MAX);
+                }
+            }
+            return lut;
+        }
+
+        constexpr std::array<Rgb, 256> LUT = make_lut();
+
+        inline bool has_rain(uint8_t v)
+        {
+            return (v & SNOW_BIT) || v >= INTENSITY_MIN;
+        }
+
+        inline int16_t clamp(int v)
+        {
+            return v < 0 ? 0 : (v > 255 ? 255 : v);
+        }
+
+        inline uint8_t closest(int16_t r, int16_t g, int16_t b)
+        {
+            uint8_t best = 0;
+            int32_t best_dist = INT32_MAX;
+            for (uint8_t i = 0; i < PALETTE_SIZE; i++)
+            {
+                int32_t const dr = r - PALETTE[i].r;
+                int32_t const dg = g - PALETTE[i].g;
+                int32_t const db = b - PALETTE[i].b;
+                int32_t const dist = dr * dr + dg * dg + db * db;
+                if (dist < best_dist)
+                {
+                    best_dist = dist;
+                    best = i;
+                }
+            }
+            return best;
+        }
+    }
+
+    void ramp_colour(uint8_t intensity, uint8_t rgb[3])
+    {
+        const Rgb &c = LUT[intensity];
+        rgb[0] = (uint8_t)c.r;
+        rgb[1] = (uint8_t)c.g;
+        rgb[2] = (uint8_t)c.b;
+    }
+
+    uint8_t nearest_colour(uint8_t intensity)
+    {
+        if (!has_rain(intensity))
+        {
+            return TRANSPARENT;
+        }
+        const Rgb &c = LUT[intensity];
+        return closest(c.r, c.g, c.b);
+    }
+
+    template <int WIDTH, int HEIGHT>
+    void GridDitherer<WIDTH, HEIGHT>::begin(const uint8_t *grid, int grid_width, int grid_height)
+    {
+        this->grid = grid;
+        this->grid_width = grid_width;
+        this->grid_height = grid_height;
+        y = 0;
+        err_this = err_rows[0];
+        err_next = err_rows[1];
+        memset(err_rows, 0, sizeof(err_rows));
+    }
+
+    template <int WIDTH, int HEIGHT>
+    bool GridDitherer<WIDTH, HEIGHT>::next_row(uint8_t *out)
+    {
+        if (y >= HEIGHT)
+        {
+            return false;
+        }
+
+        const uint8_t *src = grid + (y * grid_height / HEIGHT) * grid_width;
+        memset(err_next, 0, sizeof(err_rows[0]));
+
+        // step through the grid row with an accumulator rather than a divide per pixel
+        int gx = 0;
+        int acc = 0;
+        for (int x = 0; x < WIDTH; x++)
+        {
+            uint8_t const v = src[gx];
+            acc += grid_width;
+            while (acc >= WIDTH)
+            {
+                acc -= WIDTH;
+                gx++;
+            }
+
+            if (!has_rain(v))
+            {
+                out[x] = TRANSPARENT;
+                continue;
+            }
+
+            int16_t *e = err_this + (x + 1) * 3;
+            int16_t const r = clamp(LUT[v].r + e[0]);
+            int16_t const g = clamp(LUT[v].g + e[1]);
+            int16_t const b = clamp(LUT[v].b + e[2]);
+            uint8_t const c = closest(r, g, b);
+            out[x] = c;
+
+            int const err[3] = {r - PALETTE[c].r, g - PALETTE[c].g, b - PALETTE[c].b};
+            int16_t *below = err_next + x * 3;
+            for (int ch = 0; ch < 3; ch++)
+            {
+                // 7/16 right, 3/16 below left, 5/16 below, 1/16 below right
+                e[3 + ch] += (err[ch] * 7) >> 4;
+                below[ch] += (err[ch] * 3) >> 4;
+                below[3 + ch] += (err[ch] * 5) >> 4;
+                below[6 + ch] += err[ch] >> 4;
+            }
+        }
+
+        int16_t *swap = err_this;
+        err_this = err_next;
+        err_next = swap;
+        y++;
+        return true;
+    }
+
+    template class GridDitherer<board::WIDTH, board::HEIGHT>;
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "board.hpp"
+
+// Floyd-Steinberg on the device, for when the server sends the rain as a low resolution
+// grid of dBZ values instead of dithered palette indices.
+// No pico headers in here so the host benchmark in host_tools can build it too.
+namespace dither
+{
+    // grid cells below this are drawn as nothing, same as the server's INTENSITY_MIN
+    constexpr uint8_t INTENSITY_MIN = 20;
+    // bit 7 set means snow
+    constexpr uint8_t SNOW_BIT = 0x80;
+    // output for pixels with no rain, so the basemap shows through
+    constexpr uint8_t TRANSPARENT = 0xFF;
+
+    // Upscales the grid (nearest neighbour) and error diffuses it to the Inky73 palette one
+    // output row at a time. Integer only, with two rows of error, so about 10KB all in.
+    // Error isn't carried across pixels without rain, the basemap there isn't ours to change.
+    // The output size is a template argument so the row loop's bounds and the accumulator's
+    // divisor are constants. dither.cpp instantiates it for the board being built.
+    template <int WIDTH, int HEIGHT>
+    class GridDitherer
+    {
+    public:
+        void begin(const uint8_t *grid, int grid_width, int grid_height);
+
+        // Writes the next row of palette indices (or TRANSPARENT) into out, WIDTH bytes.
+        // Returns false once every row has been produced.
+        bool next_row(uint8_t *out);
+
+        int row() const { return y; }
+
+    private:
+        const uint8_t *grid = nullptr;
+        int grid_width = 0;
+        int grid_height = 0;
+        int y = 0;
+
+        // r, g, b error per pixel with a pixel of padding each side, this row and the next
+        int16_t err_rows[2][(WIDTH + 2) * 3];
+        int16_t *err_this = err_rows[0];
+        int16_t *err_next = err_rows[1];
+    };
+
+    // the one the firmware uses, full panel size
+    using PanelDitherer = GridDitherer<board::WIDTH, board::HEIGHT>;
+
+    // The colour the server's intensity_to_color paints a grid value, before it's quantised.
+    // Meaningless without rain, see nearest_colour.
+    void ramp_colour(uint8_t intensity, uint8_t rgb[3]);
+
+    // Palette index the server would colour a grid value with, ignoring dithering.
+    // TRANSPARENT if there's no rain.
+    uint8_t nearest_colour(uint8_t intensity);
+
+}
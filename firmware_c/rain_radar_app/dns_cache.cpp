@@ -0,0 +1,139 @@
+#include "dns_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include "frame_container.hpp"
+#include "logging.hpp"
+#include "lwip/dns.h"
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
+
+namespace dns_cache
+{
+    namespace
+    {
+        // null until prime, bench never calls it
+        persistent::PersistentData *data = nullptr;
+        uint32_t host_crc = 0;
+        // the RTC at prime and the ms since boot then, for stamping the lookup's answer
+        int64_t prime_unix = 0;
+        uint32_t prime_ms = 0;
+
+        // the address prime put in lwIP's local host list, 0 if it didn't
+        uint32_t cached_addr = 0;
+        // it's still there
+        bool local_host = false;
+        // the first request went to it and hasn't failed yet
+        bool used_cached = false;
+        bool lookup_started = false;
+        bool data_changed = false;
+
+        uint32_t name_crc(const char *host)
+        {
+            return frame_container::crc32(0, (const uint8_t *)host, strlen(host));
+        }
+
+        void remove_local_host(const char *host)
+        {
+            if (local_host)
+            {
+                dns_local_removehost(host, nullptr);
+                local_host = false;
+            }
+        }
+
+        void found(__unused const char *name, const ip_addr_t *ipaddr, __unused void *arg)
+        {
+            if (!ipaddr || !IP_IS_V4(ipaddr))
+            {
+                // keep what we had, it may well still be right
+                LOG_WARN("DNS lookup failed\n");
+                return;
+            }
+            uint32_t const addr = ip4_addr_get_u32(ip_2_ip4(ipaddr));
+            LOG_INFO("DNS lookup gave %08lx\n", addr);
+            if (!data || !prime_unix)
+            {
+                return;
+            }
+            uint32_t const elapsed_s = (to_ms_since_boot(get_absolute_time()) - prime_ms) / 1000;
+            data->dns.host_crc = host_crc;
+            data->dns.addr = addr;
+            data->dns.resolved_at = (uint32_t)(prime_unix + elapsed_s);
+            data_changed = true;
+        }
+    }
+
+    void prime(persistent::PersistentData &persistent_data, const char *host, int64_t now_unix)
+    {
+        data = &persistent_data;
+        host_crc = name_crc(host);
+        prime_unix = now_unix;
+        prime_ms = to_ms_since_boot(get_absolute_time());
+
+        const persistent::DnsEntry &entry = persistent_data.dns;
+        if (!now_unix || !entry.addr || entry.host_crc != host_crc)
+        {
+            return;
+        }
+        int64_t const age_s = now_unix - entry.resolved_at;
+        if (age_s < 0 || age_s > MAX_AGE_S)
+        {
+            printf("Cached address for %s is %ld s old, looking it up\n", host, (long)age_s);
+            return;
+        }
+        ip_addr_t const addr = IPADDR4_INIT(entry.addr);
+        cyw43_arch_lwip_begin();
+        local_host = dns_local_addhost(host, &addr) == ERR_OK;
+        cyw43_arch_lwip_end();
+        cached_addr = local_host ? entry.addr : 0;
+        printf("Using the cached address for %s, %ld s old\n", host, (long)age_s);
+    }
+
+    void request_started(const char *host)
+    {
+        if (lookup_started)
+        {
+            return;
+        }
+        lookup_started = true;
+        used_cached = local_host;
+        // the request has its address, later ones wait on the real lookup
+        remove_local_host(host);
+
+        ip_addr_t addr;
+        // joins the request's own lookup if there's one in flight
+        err_t const err = dns_gethostbyname(host, &addr, found, nullptr);
+        if (err == ERR_OK)
+        {
+            found(host, &addr, nullptr);
+        }
+        else if (err != ERR_INPROGRESS)
+        {
+            LOG_WARN("Couldn't start a DNS lookup: %d\n", err);
+        }
+    }
+
+    bool connect_failed(const char *host)
+    {
+        remove_local_host(host);
+        if (!used_cached)
+        {
+            return false;
+        }
+        used_cached = false;
+        LOG_WARN("Couldn't connect to the cached address, forgetting it\n");
+        // unless the lookup has already come back with something else
+        if (data && data->dns.host_crc == host_crc && data->dns.addr == cached_addr)
+        {
+            data->dns.addr = 0;
+            data_changed = true;
+        }
+        return true;
+    }
+
+    bool changed()
+    {
+        return data_changed;
+    }
+}
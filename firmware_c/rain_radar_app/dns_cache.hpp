@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include "persistent_data.hpp"
+
+// The server's address is kept in persistent data between wakes, so the first request of a
+// wake can connect straight away rather than waiting on a lookup. It goes into lwIP's local
+// host list, so httpc still has the name for the Host header and SNI. Once that request is
+// under way the name is looked up for real alongside it, and the answer is what the rest of
+// the wake and the next one use. If the cached address won't take a connection it's
+// forgotten and a sync request tries again with the lookup.
+//
+// lwIP doesn't hand the record's TTL to the found callback, so a cached address is trusted
+// for MAX_AGE_S instead. Everything but prime runs in lwIP's callbacks, under its lock.
+namespace dns_cache
+{
+    constexpr uint32_t MAX_AGE_S = 24 * 60 * 60;
+
+    // Once the link is up. Uses data's address for host if it's younger than MAX_AGE_S,
+    // and keeps data up to date for the rest of the wake. now_unix is 0 if the RTC isn't
+    // set, which leaves the cache alone: there's no telling how old anything is.
+    void prime(persistent::PersistentData &data, const char *host, int64_t now_unix);
+
+    // A request to host has been made, the first of the wake starts the real lookup
+    void request_started(const char *host);
+
+    // A request to host couldn't connect. True if it went to the cached address, which
+    // has been forgotten, so trying again does the lookup.
+    bool connect_failed(const char *host);
+
+    // Whether the address in the data changed this wake
+    bool changed();
+}
@@ -0,0 +1,296 @@
+#include "forecast_bundle.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include "ff.h"
+#include "pico/stdlib.h"
+#include "basemap.hpp"
+#include "board.hpp"
+#include "frame_cache.hpp"
+
+using namespace pimoroni;
+
+#define BUNDLE_PATH "bundle.bin"
+#define BUNDLE_TMP_PATH "bundle.tmp"
+
+namespace forecast_bundle
+{
+    namespace
+    {
+        constexpr uint32_t BUNDLE_MAGIC = 0x42465252; // "RRFB"
+        constexpr uint32_t STORED_MAGIC = 0x53425252; // "RRBS"
+        // our header goes in front of the server's bytes, padded to a sector
+        constexpr size_t STORED_HEADER_SIZE = 512;
+        constexpr size_t BUNDLE_HEADER_LEN = 16;
+        constexpr uint16_t MAX_FRAMES = 8;
+        constexpr size_t CHUNK_SIZE = 16 * 512;
+
+        struct StoredHeader
+        {
+            uint32_t magic;
+            datetime_t server_time;
+            // bytes of bundle after our header
+            uint32_t length;
+        };
+
+        struct Layout
+        {
+            Info info;
+            uint32_t lengths[MAX_FRAMES];
+            // where frame 0 starts in the file
+            uint32_t frames_offset;
+        };
+
+        uint8_t chunk[CHUNK_SIZE];
+
+        uint16_t read_u16(const uint8_t *p)
+        {
+            return p[0] | (p[1] << 8);
+        }
+
+        uint32_t read_u32(const uint8_t *p)
+        {
+            return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        }
+
+        // Read our header, the server's header and the frame lengths, and check they add up
+        Err read_layout(FIL &fil, Layout &layout)
+        {
+            StoredHeader stored;
+            UINT br = 0;
+            if (f_read(&fil, &stored, sizeof(stored), &br) != FR_OK || br != sizeof(stored) || stored.magic != STORED_MAGIC)
+            {
+                return Err::NO_DATA;
+            }
+
+            uint8_t header[BUNDLE_HEADER_LEN];
+            if (f_lseek(&fil, STORED_HEADER_SIZE) != FR_OK || f_read(&fil, header, sizeof(header), &br) != FR_OK || br != sizeof(header))
+            {
+                return Err::NO_DATA;
+            }
+            if (read_u32(header) != BUNDLE_MAGIC)
+            {
+                printf("Not a forecast bundle\n");
+                return Err::INVALID_RESPONSE;
+            }
+            layout.info = {
+                .server_time = stored.server_time,
+                .basemap_version = read_u32(header + 4),
+                .frame_count = read_u16(header + 8),
+                .change_permille = read_u16(header + 10),
+                .step_mins = read_u16(header + 12),
+            };
+            if (layout.info.frame_count == 0 || layout.info.frame_count > MAX_FRAMES || layout.info.step_mins == 0)
+            {
+                printf("Bad forecast bundle header\n");
+                return Err::INVALID_RESPONSE;
+            }
+
+            uint8_t lengths[MAX_FRAMES * 4];
+            UINT const lengths_len = layout.info.frame_count * 4;
+            if (f_read(&fil, lengths, lengths_len, &br) != FR_OK || br != lengths_len)
+            {
+                return Err::NO_DATA;
+            }
+            uint32_t total = BUNDLE_HEADER_LEN + lengths_len;
+            for (uint16_t i = 0; i < layout.info.frame_count; i++)
+            {
+                layout.lengths[i] = read_u32(lengths + i * 4);
+                total += layout.lengths[i];
+            }
+            if (total != stored.length)
+            {
+                printf("Forecast bundle is %lu bytes, expected %lu\n", stored.length, total);
+                return Err::NO_DATA;
+            }
+            layout.frames_offset = STORED_HEADER_SIZE + BUNDLE_HEADER_LEN + lengths_len;
+            return Err::OK;
+        }
+    }
+
+    Writer::Writer(PSRamDisplay &psram)
+        : psram(psram)
+    {
+    }
+
+    Err Writer::begin()
+    {
+        // no point downloading it if there's nowhere to put it
+        Err err = frame_cache::mount();
+        if (err != Err::OK)
+        {
+            return err;
+        }
+        written = 0;
+        header_len = 0;
+        return Err::OK;
+    }
+
+    Err Writer::write(const uint8_t *data, size_t len)
+    {
+        if (written + len > board::PSRAM_STAGING_BYTES)
+        {
+            printf("Forecast bundle too big to stage\n");
+            return Err::NO_MEMORY;
+        }
+        if (header_len < sizeof(header))
+        {
+            size_t const n = MIN(len, sizeof(header) - header_len);
+            memcpy(header + header_len, data, n);
+            header_len += n;
+            if (header_len == sizeof(header))
+            {
+                basemap_version = read_u32(header + 4);
+            }
+        }
+        psram.write_span(board::PSRAM_STAGING_ADDRESS + written, len, data);
+        written += len;
+        return Err::OK;
+    }
+
+    Err Writer::finish(const datetime_t &server_time)
+    {
+        FIL fil;
+        FRESULT fr = f_open(&fil, BUNDLE_TMP_PATH, FA_WRITE | FA_CREATE_ALWAYS);
+        if (fr != FR_OK)
+        {
+            printf("Couldn't open " BUNDLE_TMP_PATH ": %d\n", fr);
+            return Err::ERROR;
+        }
+
+        // our header, padded to a sector, then the bundle a chunk at a time out of PSRAM
+        StoredHeader const stored = {
+            .magic = STORED_MAGIC,
+            .server_time = server_time,
+            .length = written,
+        };
+        memset(chunk, 0, STORED_HEADER_SIZE);
+        memcpy(chunk, &stored, sizeof(stored));
+        UINT bw = 0;
+        fr = f_write(&fil, chunk, STORED_HEADER_SIZE, &bw);
+        Err err = fr == FR_OK && bw == STORED_HEADER_SIZE ? Err::OK : Err::ERROR;
+        for (uint32_t offset = 0; err == Err::OK && offset < written; offset += CHUNK_SIZE)
+        {
+            UINT const len = MIN(CHUNK_SIZE, written - offset);
+            uint32_t const address = board::PSRAM_STAGING_ADDRESS + offset;
+            psram.read_pixel_span(Point(address % board::WIDTH, address / board::WIDTH), len, chunk);
+            fr = f_write(&fil, chunk, len, &bw);
+            if (fr != FR_OK || bw != len)
+            {
+                printf("Couldn't write the forecast bundle: %d\n", fr);
+                err = fr == FR_OK ? Err::NO_MEMORY : Err::ERROR;
+            }
+        }
+        if (f_close(&fil) != FR_OK && err == Err::OK)
+        {
+            err = Err::ERROR;
+        }
+
+        if (err == Err::OK)
+        {
+            // make sure it's all there before it replaces the last one
+            FIL check;
+            Layout layout;
+            err = Err::ERROR;
+            if (f_open(&check, BUNDLE_TMP_PATH, FA_READ) == FR_OK)
+            {
+                err = read_layout(check, layout);
+                f_close(&check);
+            }
+        }
+        if (err != Err::OK)
+        {
+            f_unlink(BUNDLE_TMP_PATH);
+            return err;
+        }
+
+        f_unlink(BUNDLE_PATH);
+        if (f_rename(BUNDLE_TMP_PATH, BUNDLE_PATH) != FR_OK)
+        {
+            return Err::ERROR;
+        }
+        printf("Saved forecast bundle, %lu bytes\n", written);
+        return Err::OK;
+    }
+
+    ResultOr<Info> read_info()
+    {
+        Err err = frame_cache::mount();
+        if (err != Err::OK)
+        {
+            return err;
+        }
+        FIL fil;
+        if (f_open(&fil, BUNDLE_PATH, FA_READ) != FR_OK)
+        {
+            return Err::NO_DATA;
+        }
+        Layout layout;
+        err = read_layout(fil, layout);
+        f_close(&fil);
+        if (err != Err::OK)
+        {
+            return err;
+        }
+        return ResultOr<Info>(layout.info);
+    }
+
+    Err show_frame(InkyFrame &inky_frame, uint16_t index)
+    {
+        Err err = frame_cache::mount();
+        if (err != Err::OK)
+        {
+            return err;
+        }
+        FIL fil;
+        if (f_open(&fil, BUNDLE_PATH, FA_READ) != FR_OK)
+        {
+            return Err::NO_DATA;
+        }
+
+        Layout layout;
+        err = read_layout(fil, layout);
+        if (err == Err::OK && index >= layout.info.frame_count)
+        {
+            err = Err::INVALID_ARGUMENT;
+        }
+        uint32_t offset = layout.frames_offset;
+        for (uint16_t i = 0; err == Err::OK && i < index; i++)
+        {
+            offset += layout.lengths[i];
+        }
+        if (err == Err::OK && f_lseek(&fil, offset) != FR_OK)
+        {
+            err = Err::NO_DATA;
+        }
+
+        basemap::PrecipCompositor compositor(inky_frame.ramDisplay);
+        uint32_t remaining = err == Err::OK ? layout.lengths[index] : 0;
+        while (err == Err::OK && remaining)
+        {
+            UINT const len = MIN(CHUNK_SIZE, remaining);
+            UINT br = 0;
+            if (f_read(&fil, chunk, len, &br) != FR_OK || br != len)
+            {
+                err = Err::NO_DATA;
+                break;
+            }
+            err = compositor.feed(chunk, len);
+            remaining -= len;
+        }
+        f_close(&fil);
+
+        if (err == Err::OK)
+        {
+            err = compositor.finish();
+        }
+        if (err != Err::OK)
+        {
+            printf("Couldn't show forecast frame %u: %s\n", index, errToString(err).data());
+            return err;
+        }
+        printf("Showing forecast frame %u of %u\n", index, layout.info.frame_count);
+        return Err::OK;
+    }
+
+}
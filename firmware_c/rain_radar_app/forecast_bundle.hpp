@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "inky_frame_7.hpp"
+#include "pico/types.h"
+#include "rain_radar_common.hpp"
+
+// The next few frames (now, +10, +20, +30 min) fetched in one go and kept on the SD card,
+// so the wakes in between can show the right one without turning the radio on.
+//
+// From the server the bundle is: u32 magic "RRFB", u32 basemap version, u16 frame count,
+// u16 change (per mille of pixels that differ between consecutive frames, at worst),
+// u16 minutes between frames, u16 reserved, then a u32 length per frame, then the frames,
+// each a whole precip layer (see basemap::PrecipCompositor). Everything is little endian.
+namespace forecast_bundle
+{
+    struct Info
+    {
+        // when the bundle was fetched, frame 0 is for then
+        datetime_t server_time;
+        uint32_t basemap_version;
+        uint16_t frame_count;
+        uint16_t change_permille;
+        uint16_t step_mins;
+    };
+
+    // Gathers a bundle in the PSRAM past the frame as it downloads, and copies it to the SD
+    // card once the request's done. The card shares SPI0 with the PSRAM and an 8 KB write
+    // takes a while, which from the recv callback would hold up the radio with the TCP window
+    // open. It only replaces the previous bundle once finish() has checked it's all there.
+    class Writer
+    {
+    public:
+        explicit Writer(pimoroni::PSRamDisplay &psram);
+
+        Err begin();
+        Err write(const uint8_t *data, size_t len);
+        // Writes the bundle to the card. Call outside any lwIP callback.
+        Err finish(const datetime_t &server_time);
+
+        // from the bundle's header, 0 until that has arrived
+        uint32_t bundle_basemap_version() const { return header_len >= 8 ? basemap_version : 0; }
+
+    private:
+        pimoroni::PSRamDisplay &psram;
+        // bundle bytes so far, not counting our header
+        uint32_t written = 0;
+        uint8_t header[8];
+        size_t header_len = 0;
+        uint32_t basemap_version = 0;
+    };
+
+    // Info about the bundle on the card
+    ResultOr<Info> read_info();
+
+    // Composite one frame of the bundle over the basemap into PSRAM
+    Err show_frame(pimoroni::InkyFrame &inky_frame, uint16_t index);
+}
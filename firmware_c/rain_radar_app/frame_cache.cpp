@@ -0,0 +1,240 @@
+#include "frame_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include "ff.h"
+#include "pico/stdlib.h"
+
+using namespace pimoroni;
+
+#define FRAME_DIR "frames"
+#define FRAME_TMP_PATH FRAME_DIR "/new.bin"
+
+namespace frame_cache
+{
+    namespace
+    {
+        constexpr uint32_t FRAME_MAGIC = 0x43465252; // "RRFC"
+        // the pixels start on a sector boundary so whole chunks go straight between
+        // the card and our buffer without fatfs copying them through its own sector
+        constexpr size_t HEADER_SIZE = 512;
+        constexpr size_t CHUNK_SIZE = 16 * 512;
+
+        struct Header
+        {
+            uint32_t magic;
+            // goes up by one with every frame saved, the newest has the highest
+            uint32_t sequence;
+            datetime_t server_time;
+            uint16_t width;
+            uint16_t height;
+            uint32_t length;
+        };
+
+        FATFS fs;
+        bool mounted = false;
+        uint8_t chunk[CHUNK_SIZE];
+
+        // a frame for this display, with a byte per pixel and no more. Whatever's on the card
+        // could have been written by anything, and the length bounds the copy into PSRAM.
+        bool usable(const Header &header, int width, int height)
+        {
+            return header.magic == FRAME_MAGIC && header.width == width && header.height == height &&
+                   header.length == (uint32_t)width * height;
+        }
+
+        void slot_path(uint8_t slot, char *path, size_t len)
+        {
+            snprintf(path, len, FRAME_DIR "/%u.bin", slot);
+        }
+
+        bool read_header(uint8_t slot, Header &header)
+        {
+            char path[24];
+            slot_path(slot, path, sizeof(path));
+            FIL fil;
+            if (f_open(&fil, path, FA_READ) != FR_OK)
+            {
+                return false;
+            }
+            UINT br = 0;
+            FRESULT fr = f_read(&fil, &header, sizeof(header), &br);
+            f_close(&fil);
+            return fr == FR_OK && br == sizeof(header);
+        }
+
+        // the slot holding the newest frame for this display, -1 if there isn't one
+        int newest_slot(int width, int height, uint32_t &sequence)
+        {
+            int newest = -1;
+            for (uint8_t slot = 0; slot < NUM_FRAMES; slot++)
+            {
+                Header header;
+                if (!read_header(slot, header) || !usable(header, width, height))
+                {
+                    continue;
+                }
+                if (newest < 0 || header.sequence > sequence)
+                {
+                    newest = slot;
+                    sequence = header.sequence;
+                }
+            }
+            return newest;
+        }
+    }
+
+    Err mount()
+    {
+        if (mounted)
+        {
+            return Err::OK;
+        }
+        FRESULT fr = f_mount(&fs, "", 1);
+        if (fr != FR_OK)
+        {
+            printf("Couldn't mount the SD card: %d\n", fr);
+            return Err::NOT_INITIALISED;
+        }
+        fr = f_mkdir(FRAME_DIR);
+        if (fr != FR_OK && fr != FR_EXIST)
+        {
+            printf("Couldn't make " FRAME_DIR ": %d\n", fr);
+            return Err::ERROR;
+        }
+        mounted = true;
+        return Err::OK;
+    }
+
+    Err save(InkyFrame &inky_frame, const datetime_t &server_time)
+    {
+        Err err = mount();
+        if (err != Err::OK)
+        {
+            return err;
+        }
+
+        uint32_t sequence = 0;
+        int const newest = newest_slot(inky_frame.width, inky_frame.height, sequence);
+        uint8_t const slot = newest < 0 ? 0 : (newest + 1) % NUM_FRAMES;
+
+        Header header = {
+            .magic = FRAME_MAGIC,
+            .sequence = newest < 0 ? 0 : sequence + 1,
+            .server_time = server_time,
+            .width = (uint16_t)inky_frame.width,
+            .height = (uint16_t)inky_frame.height,
+            .length = (uint32_t)(inky_frame.width * inky_frame.height),
+        };
+
+        // written under another name and renamed at the end, so a flat battery
+        // half way through never leaves a broken frame that looks like the newest
+        FIL fil;
+        FRESULT fr = f_open(&fil, FRAME_TMP_PATH, FA_WRITE | FA_CREATE_ALWAYS);
+        if (fr != FR_OK)
+        {
+            printf("Couldn't open " FRAME_TMP_PATH ": %d\n", fr);
+            return Err::ERROR;
+        }
+        memset(chunk, 0, HEADER_SIZE);
+        memcpy(chunk, &header, sizeof(header));
+        UINT bw = 0;
+        fr = f_write(&fil, chunk, HEADER_SIZE, &bw);
+        bool full = fr == FR_OK && bw != HEADER_SIZE;
+
+        uint32_t offset = 0;
+        while (fr == FR_OK && !full && offset < header.length)
+        {
+            UINT const len = MIN(CHUNK_SIZE, header.length - offset);
+            inky_frame.ramDisplay.read_pixel_span(Point(offset % header.width, offset / header.width), len, chunk);
+            fr = f_write(&fil, chunk, len, &bw);
+            full = bw != len;
+            offset += len;
+        }
+        FRESULT const close_fr = f_close(&fil);
+        if (full)
+        {
+            printf("SD card is full\n");
+            return Err::NO_MEMORY;
+        }
+        if (fr != FR_OK || close_fr != FR_OK)
+        {
+            printf("Couldn't write the frame to the SD card: %d\n", fr != FR_OK ? fr : close_fr);
+            return Err::ERROR;
+        }
+
+        char path[24];
+        slot_path(slot, path, sizeof(path));
+        f_unlink(path);
+        fr = f_rename(FRAME_TMP_PATH, path);
+        if (fr != FR_OK)
+        {
+            printf("Couldn't rename the frame to %s: %d\n", path, fr);
+            return Err::ERROR;
+        }
+        printf("Saved frame %lu to %s\n", header.sequence, path);
+        return Err::OK;
+    }
+
+    ResultOr<datetime_t> load_newest(InkyFrame &inky_frame)
+    {
+        Err err = mount();
+        if (err != Err::OK)
+        {
+            return err;
+        }
+
+        uint32_t sequence = 0;
+        int const slot = newest_slot(inky_frame.width, inky_frame.height, sequence);
+        if (slot < 0)
+        {
+            printf("No cached frames\n");
+            return Err::NO_DATA;
+        }
+
+        char path[24];
+        slot_path(slot, path, sizeof(path));
+        FIL fil;
+        FRESULT fr = f_open(&fil, path, FA_READ);
+        if (fr != FR_OK)
+        {
+            return Err::ERROR;
+        }
+
+        UINT br = 0;
+        fr = f_read(&fil, chunk, HEADER_SIZE, &br);
+        Header header;
+        memcpy(&header, chunk, sizeof(header));
+        // it's read again, newest_slot's look at it may not be what's there now
+        if (fr != FR_OK || br != HEADER_SIZE || !usable(header, inky_frame.width, inky_frame.height))
+        {
+            f_close(&fil);
+            printf("Couldn't read the header of %s: %d\n", path, fr);
+            return Err::NO_DATA;
+        }
+
+        // big reads in the same order the frame sits in PSRAM
+        uint32_t offset = 0;
+        while (fr == FR_OK && offset < header.length)
+        {
+            UINT const len = MIN(CHUNK_SIZE, header.length - offset);
+            fr = f_read(&fil, chunk, len, &br);
+            if (br != len)
+            {
+                break;
+            }
+            inky_frame.ramDisplay.write_span(offset, len, chunk);
+            offset += len;
+        }
+        f_close(&fil);
+        if (fr != FR_OK || offset != header.length)
+        {
+            printf("Couldn't read %s: %d\n", path, fr);
+            return Err::NO_DATA;
+        }
+
+        printf("Loaded frame %lu from %s\n", header.sequence, path);
+        return ResultOr<datetime_t>(header.server_time);
+    }
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+#include "inky_frame_7.hpp"
+#include "pico/types.h"
+#include "rain_radar_common.hpp"
+
+// The last few good frames on the SD card, straight out of PSRAM before the overlays go on.
+// Lets a button wake show something without Wi-Fi, and a failed fetch show the last frame
+// rather than an error over whatever was left in PSRAM.
+namespace frame_cache
+{
+    constexpr uint8_t NUM_FRAMES = 4;
+
+    // Mount the SD card, if it isn't already. Anything else on the card goes through this too.
+    Err mount();
+
+    // Copy the frame in PSRAM to the card, replacing the oldest one.
+    Err save(pimoroni::InkyFrame &inky_frame, const datetime_t &server_time);
+
+    // Load the newest frame into PSRAM. Returns the server time it was fetched at.
+    ResultOr<datetime_t> load_newest(pimoroni::InkyFrame &inky_frame);
+}
@@ -0,0 +1,293 @@
+#include "frame_container.hpp"
+
+#include <cstring>
+#include <utility>
+#include "pico/stdlib.h"
+#include "board.hpp"
+#include "logging.hpp"
+#include "rain_stats.hpp"
+
+namespace frame_container
+{
+    namespace
+    {
+        constexpr size_t FIXED_LEN = 32;
+        constexpr size_t POI_LEN = 6;
+
+        uint16_t read_u16(const uint8_t *p)
+        {
+            return p[0] | (p[1] << 8);
+        }
+
+        uint32_t read_u32(const uint8_t *p)
+        {
+            return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        }
+
+        // a half resolution row doubled up, written to PSRAM twice
+        uint8_t half_row[board::WIDTH];
+
+        // a nibble at a time, the full table would be another 1 KB of flash for not much
+        const uint32_t crc_table[16] = {
+            0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+            0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+        };
+    }
+
+    uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len)
+    {
+        crc = ~crc;
+        for (size_t i = 0; i < len; i++)
+        {
+            crc ^= data[i];
+            crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+            crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+        }
+        return ~crc;
+    }
+
+    Reader::Reader(HeaderFn on_header, PayloadFn on_payload)
+        : on_header(std::move(on_header))
+        , on_payload(std::move(on_payload))
+    {
+    }
+
+    Err Reader::feed(const uint8_t *data, size_t len)
+    {
+        // the fixed part first, then the rest of the header now its length is known
+        while (!has_header())
+        {
+            size_t const wanted = header_len ? header_len : FIXED_LEN;
+            size_t const n = MIN(len, wanted - pending_len);
+            memcpy(pending + pending_len, data, n);
+            pending_len += n;
+            data += n;
+            len -= n;
+            if (pending_len < wanted)
+            {
+                return Err::OK;
+            }
+            Err err = parse_header();
+            if (err == Err::OK && has_header())
+            {
+                err = on_header(frame_info);
+            }
+            if (err != Err::OK)
+            {
+                return err;
+            }
+        }
+
+        if (len > frame_info.payload_len - payload_seen)
+        {
+            LOG_ERROR("Frame is longer than its header says\n");
+            return Err::INVALID_RESPONSE;
+        }
+        payload_seen += len;
+        crc = crc32(crc, data, len);
+        return len ? on_payload(data, len) : Err::OK;
+    }
+
+    Err Reader::finish()
+    {
+        if (!has_header() || payload_seen != frame_info.payload_len)
+        {
+            LOG_ERROR("Frame cut short, %lu of %lu bytes\n", payload_seen, frame_info.payload_len);
+            return Err::NO_DATA;
+        }
+        if (crc != frame_info.payload_crc)
+        {
+            LOG_ERROR("Frame crc %08lx, header says %08lx\n", crc, frame_info.payload_crc);
+            return Err::INVALID_RESPONSE;
+        }
+        return Err::OK;
+    }
+
+    // Called with the fixed part, which says how long the whole header is, then again once
+    // that's all in
+    Err Reader::parse_header()
+    {
+        if (header_len == 0)
+        {
+            size_t const declared = read_u16(pending + 4);
+            uint8_t const text_len = pending[28];
+            uint8_t const poi_count = pending[29];
+            if (read_u32(pending) != MAGIC || declared < FIXED_LEN + text_len + poi_count * POI_LEN || declared > sizeof(pending))
+            {
+                LOG_ERROR("Not a frame container\n");
+                return Err::INVALID_RESPONSE;
+            }
+            frame_info.version = pending[6];
+            if (frame_info.version > VERSION)
+            {
+                LOG_WARN("Frame container version %u is newer than %u\n", frame_info.version, VERSION);
+                return Err::UNSUPPORTED;
+            }
+            header_len = declared;
+            if (pending_len < header_len)
+            {
+                return Err::OK;
+            }
+        }
+
+        frame_info.encoding = (Encoding)pending[7];
+        frame_info.width = read_u16(pending + 8);
+        frame_info.height = read_u16(pending + 10);
+        frame_info.frame_time = read_u32(pending + 12);
+        frame_info.next_publish = read_u32(pending + 16);
+        frame_info.payload_len = read_u32(pending + 20);
+        frame_info.payload_crc = read_u32(pending + 24);
+
+        size_t const text_len = pending[28];
+        size_t const copied = MIN(text_len, MAX_TEXT_LEN);
+        memcpy(frame_info.text, pending + FIXED_LEN, copied);
+        frame_info.text[copied] = '\0';
+
+        // any past the ones we've room for are dropped
+        const uint8_t *poi = pending + FIXED_LEN + text_len;
+        frame_info.poi_count = MIN(pending[29], MAX_POIS);
+        for (size_t i = 0; i < frame_info.poi_count; i++, poi += POI_LEN)
+        {
+            frame_info.pois[i] = {read_u16(poi), read_u16(poi + 2), poi[4], poi[5]};
+        }
+        LOG_INFO("Frame v%u encoding %u %ux%u, %lu bytes, next at %lu\n", frame_info.version, (unsigned)frame_info.encoding,
+                 frame_info.width, frame_info.height, frame_info.payload_len, frame_info.next_publish);
+        return Err::OK;
+    }
+
+    Decoder::Decoder(pimoroni::PSRamDisplay &psram)
+        : psram(psram)
+        , compositor(psram)
+    {
+    }
+
+    Err Decoder::begin(const Info &info)
+    {
+        if (info.width != board::WIDTH || info.height != board::HEIGHT)
+        {
+            LOG_ERROR("Frame is %ux%u, not for this display\n", info.width, info.height);
+            return Err::INVALID_RESPONSE;
+        }
+        encoding = info.encoding;
+        offset = 0;
+        // the smaller tiers are coloured differently to the basemap, the compositor does its own
+        if (encoding == Encoding::RAW_8BPP || encoding == Encoding::PACKED_4BPP)
+        {
+            rain_stats::begin();
+        }
+        else
+        {
+            rain_stats::reset();
+        }
+        size_t const pixels = board::PIXELS;
+        size_t expected;
+        switch (encoding)
+        {
+        case Encoding::RAW_8BPP:
+            expected = pixels;
+            break;
+        case Encoding::PACKED_4BPP:
+            expected = pixels / 2;
+            break;
+        case Encoding::PRECIP_LAYER:
+            // only the compositor can say
+            return Err::OK;
+        case Encoding::REDUCED_2BPP:
+            expected = pixels / 4;
+            break;
+        case Encoding::HALF_4BPP:
+            expected = pixels / 8;
+            break;
+        default:
+            LOG_WARN("Frame encoding %u isn't one we know\n", (unsigned)encoding);
+            return Err::UNSUPPORTED;
+        }
+        if (info.payload_len != expected)
+        {
+            LOG_ERROR("Frame payload is %lu bytes, expected %u\n", info.payload_len, expected);
+            return Err::INVALID_RESPONSE;
+        }
+        return Err::OK;
+    }
+
+    Err Decoder::write(const uint8_t *data, size_t len)
+    {
+        switch (encoding)
+        {
+        case Encoding::RAW_8BPP:
+            // as is
+            rain_stats::add_pixels(offset, data, len);
+            psram.write_span(offset, len, data);
+            offset += len;
+            return Err::OK;
+        case Encoding::PACKED_4BPP:
+            write_pixels<4>(data, len, nullptr);
+            return Err::OK;
+        case Encoding::PRECIP_LAYER:
+            return compositor.feed(data, len);
+        case Encoding::REDUCED_2BPP:
+            write_pixels<2>(data, len, REDUCED_PALETTE);
+            return Err::OK;
+        case Encoding::HALF_4BPP:
+            write_pixels<4>(data, len, nullptr);
+            return Err::OK;
+        }
+        return Err::UNSUPPORTED;
+    }
+
+    Err Decoder::finish()
+    {
+        // the reader has already checked the rest were the right length
+        return encoding == Encoding::PRECIP_LAYER ? compositor.finish() : Err::OK;
+    }
+
+    template <int BITS>
+    void Decoder::write_pixels(const uint8_t *data, size_t len, const uint8_t *palette)
+    {
+        constexpr int PER_BYTE = 8 / BITS;
+        constexpr uint8_t MASK = (1 << BITS) - 1;
+        uint8_t pixels[128];
+        while (len)
+        {
+            size_t const n = MIN(len, sizeof(pixels) / PER_BYTE);
+            size_t count = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                for (int shift = 8 - BITS; shift >= 0; shift -= BITS)
+                {
+                    uint8_t const index = (data[i] >> shift) & MASK;
+                    pixels[count++] = palette ? palette[index] : index;
+                }
+            }
+            if (encoding == Encoding::HALF_4BPP)
+            {
+                write_half(pixels, count);
+            }
+            else
+            {
+                rain_stats::add_pixels(offset, pixels, count);
+                psram.write_span(offset, count, pixels);
+                offset += count;
+            }
+            data += n;
+            len -= n;
+        }
+    }
+
+    void Decoder::write_half(const uint8_t *pixels, size_t count)
+    {
+        constexpr int HALF_WIDTH = board::WIDTH / 2;
+        for (size_t i = 0; i < count; i++, offset++)
+        {
+            int const x = offset % HALF_WIDTH;
+            half_row[x * 2] = pixels[i];
+            half_row[x * 2 + 1] = pixels[i];
+            if (x == HALF_WIDTH - 1)
+            {
+                size_t const y = offset / HALF_WIDTH * 2;
+                psram.write_span(y * board::WIDTH, board::WIDTH, half_row);
+                psram.write_span((y + 1) * board::WIDTH, board::WIDTH, half_row);
+            }
+        }
+    }
+}
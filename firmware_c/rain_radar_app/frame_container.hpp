@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "basemap.hpp"
+#include "psram_display.hpp"
+#include "rain_radar_common.hpp"
+
+// frame.bin wraps a frame in a header that says what it is, so one request brings everything
+// a wake needs and the firmware can tell a frame it can't decode from a broken one.
+//
+// The header is little endian:
+//   u32 magic "RRFR", u16 header length, u8 version, u8 encoding,
+//   u16 width, u16 height, u32 frame time, u32 next publish time (unix seconds),
+//   u32 payload length, u32 payload crc32, u8 text length, u8 poi count, u16 reserved,
+//   then the caption, then a (u16 x, u16 y, u8 now, u8 forecast) rain summary per POI.
+// Then the payload. Anything the server adds later goes on the end of the header and the
+// header length grows, older firmware skips it. The version only goes up if what's already
+// there changes.
+namespace frame_container
+{
+    constexpr uint32_t MAGIC = 0x52465252; // "RRFR"
+    constexpr uint8_t VERSION = 1;
+    constexpr size_t MAX_TEXT_LEN = 64;
+    constexpr size_t MAX_POIS = 8;
+
+    // What the payload is. A new one can go on the server as soon as firmware that knows it
+    // is out: older firmware reads the header, says Err::UNSUPPORTED and falls back to the
+    // files it always used.
+    enum class Encoding : uint8_t
+    {
+        // a palette index per byte, same as quantized.bin
+        RAW_8BPP = 0,
+        // two pixels per byte, high nibble first, same as quantized_packed.bin
+        PACKED_4BPP = 1,
+        // a precip layer over the cached basemap, same as precip_layer.bin
+        PRECIP_LAYER = 2,
+        // four pixels per byte, high bits first, each an index into REDUCED_PALETTE
+        REDUCED_2BPP = 3,
+        // half the width and height, packed like PACKED_4BPP. Each pixel is drawn 2x2.
+        HALF_4BPP = 4,
+    };
+
+    // the panel's black, white, blue and red
+    constexpr uint8_t REDUCED_PALETTE[4] = {0, 1, 3, 4};
+
+    // The most rain within a few pixels of a point of interest, in dBZ with bit 7 set
+    // for snow, 0 for none
+    struct PoiRain
+    {
+        uint16_t x;
+        uint16_t y;
+        uint8_t now;
+        uint8_t forecast;
+    };
+
+    struct Info
+    {
+        uint8_t version = 0;
+        Encoding encoding = Encoding::RAW_8BPP;
+        uint16_t width = 0;
+        uint16_t height = 0;
+        // when the rain on the map is from, and when the server expects to have the next one
+        uint32_t frame_time = 0;
+        uint32_t next_publish = 0;
+        uint32_t payload_len = 0;
+        uint32_t payload_crc = 0;
+        // the caption that's drawn into the frame, null terminated
+        char text[MAX_TEXT_LEN + 1] = "";
+        uint8_t poi_count = 0;
+        PoiRain pois[MAX_POIS] = {};
+    };
+
+    // Reads the header as it streams in, then hands the payload on a chunk at a time.
+    class Reader
+    {
+    public:
+        // Called once the header is in, to say whether the payload can be decoded
+        using HeaderFn = std::function<Err(const Info &)>;
+        using PayloadFn = std::function<Err(const uint8_t *, size_t)>;
+
+        Reader(HeaderFn on_header, PayloadFn on_payload);
+
+        Err feed(const uint8_t *data, size_t len);
+        // Checks the payload was all there and matches its crc. Call once the body's in.
+        Err finish();
+
+        bool has_header() const { return header_len != 0 && pending_len == header_len; }
+        const Info &info() const { return frame_info; }
+
+    private:
+        HeaderFn const on_header;
+        PayloadFn const on_payload;
+
+        Info frame_info;
+        uint8_t pending[512];
+        size_t pending_len = 0;
+        // 0 until the fixed part is in
+        size_t header_len = 0;
+        uint32_t payload_seen = 0;
+        uint32_t crc = 0;
+
+        Err parse_header();
+    };
+
+    // Decodes the payload into PSRAM as it streams in, whichever encoding it's in.
+    // Frames have to be the panel's size, see board.hpp.
+    class Decoder
+    {
+    public:
+        explicit Decoder(pimoroni::PSRamDisplay &psram);
+
+        // Whether the payload the header describes can be decoded for this display,
+        // Err::UNSUPPORTED for an encoding this firmware doesn't know
+        Err begin(const Info &info);
+        Err write(const uint8_t *data, size_t len);
+        // Call once the whole payload is in
+        Err finish();
+
+    private:
+        pimoroni::PSRamDisplay &psram;
+        Encoding encoding = Encoding::RAW_8BPP;
+        // pixels written so far, or for HALF_4BPP the half resolution pixels
+        size_t offset = 0;
+        basemap::PrecipCompositor compositor;
+
+        // unpacks BITS per pixel, through palette if there is one
+        template <int BITS>
+        void write_pixels(const uint8_t *data, size_t len, const uint8_t *palette);
+        void write_half(const uint8_t *pixels, size_t count);
+    };
+
+    // zlib's crc32, crc is 0 to start and the last result to carry on
+    uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len);
+}
@@ -11,7 +11,16 @@
 #include "pico/async_context.h"
 #include "lwip/altcp.h"
 #include "lwip/altcp_tls.h"
+#include "mbedtls/ssl.h"
+#include "dns_cache.hpp"
 #include "http_client_util.hpp"
+#include "logging.hpp"
+#include "rain_radar_common.hpp"
+
+// these run in lwIP's callbacks, see logging.hpp
+#define HTTP_INFO LOG_INFO
+#define HTTP_DEBUG LOG_DEBUG
+#define HTTP_ERROR LOG_ERROR
 
 #ifndef HTTP_INFO
 #define HTTP_INFO printf
@@ -53,7 +62,7 @@ namespace
         return ERR_OK;
     }
 
-    static err_t internal_recv_fn(void *arg, struct altcp_pcb *conn, struct pbuf *p, err_t err)
+    static err_t HOT_PATH(internal_recv_fn)(void *arg, struct altcp_pcb *conn, struct pbuf *p, err_t err)
     {
         assert(arg);
         http_req_t *req = (http_req_t *)arg;
@@ -71,6 +80,13 @@ namespace
         HTTP_DEBUG("result %d len %u server_response %u err %d\n", httpc_result, rx_content_len, srv_res, err);
         req->complete = true;
         req->result = httpc_result;
+        bool const no_connection = srv_res == 0 && (httpc_result == HTTPC_RESULT_ERR_CONNECT || httpc_result == HTTPC_RESULT_ERR_TIMEOUT);
+        if (no_connection && dns_cache::connect_failed(req->hostname) && req->retry_stale_address)
+        {
+            // http_client_request_sync makes it again, the caller hears how that one goes
+            req->retry_stale_address = 0;
+            return;
+        }
         if (req->result_fn)
         {
             req->result_fn(req->callback_arg, httpc_result, rx_content_len, srv_res, err);
@@ -88,7 +104,8 @@ namespace
             HTTP_ERROR("Failed to allocate PCB\n");
             return NULL;
         }
-        mbedtls_ssl_set_hostname((mbedtls_ssl_context *)altcp_tls_context(pcb), req->hostname);
+        mbedtls_ssl_context *ssl = (mbedtls_ssl_context *)altcp_tls_context(pcb);
+        mbedtls_ssl_set_hostname(ssl, req->hostname);
         return pcb;
     }
 
@@ -145,18 +162,20 @@ namespace http_client_util
         req->settings.result_fn = internal_result_fn;
         async_context_acquire_lock_blocking(context);
         err_t ret = httpc_get_file_dns(req->hostname, req->port ? req->port : default_port, req->url, &req->settings, internal_recv_fn, req, NULL);
+        if (ret == ERR_OK)
+        {
+            dns_cache::request_started(req->hostname);
+        }
         async_context_release_lock(context);
         if (ret != ERR_OK)
         {
-            HTTP_ERROR("http request failed: %d", ret);
+            HTTP_ERROR("http request failed: %d\n", ret);
         }
         return ret;
     }
 
-    // Make a http request and only return when it has completed.
-    int http_client_request_sync(async_context_t *context, http_req_t *req)
+    static int request_and_wait(async_context_t *context, http_req_t *req)
     {
-        assert(req);
         int ret = http_client_request_async(context, req);
         if (ret != 0)
         {
@@ -169,4 +188,18 @@ namespace http_client_util
         }
         return req->result;
     }
+
+    // Make a http request and only return when it has completed.
+    int http_client_request_sync(async_context_t *context, http_req_t *req)
+    {
+        assert(req);
+        req->retry_stale_address = 1;
+        int ret = request_and_wait(context, req);
+        if (!req->retry_stale_address)
+        {
+            HTTP_INFO("Trying again with a DNS lookup\n");
+            ret = request_and_wait(context, req);
+        }
+        return ret;
+    }
 }
@@ -73,6 +73,11 @@ namespace http_client_util
          * Overall result of http request, only valid when complete is set
          */
         httpc_result_t result;
+        /*!
+         * Set by \em http_client_request_sync, cleared if the connect to a cached address
+         * (see dns_cache) failed and the request is to be made again with a real lookup
+         */
+        int retry_stale_address;
 
     } http_req_t;
 
@@ -0,0 +1,220 @@
+#include "logging.hpp"
+
+#include "ff.h"
+#include "hardware/flash.h"
+#include "pico/stdio.h"
+#include "pico/stdio_usb.h"
+#include "pico/stdlib.h"
+#include "pico/sync.h"
+#include "frame_cache.hpp"
+#include "logging_format.hpp"
+#include "rain_radar_common.hpp"
+
+#define LOG_PATH "log.bin"
+
+namespace logging
+{
+    namespace
+    {
+        // 8 KB, a wake's worth at INFO
+        constexpr size_t RING_WORDS = 2048;
+        constexpr uint32_t RECORD_TAG = 0x4C; // "L" in the top byte of a record's first word
+        constexpr uint32_t FILE_MAGIC = 0x474C5252; // "RRLG"
+        // log.bin starts again past this
+        constexpr uint32_t MAX_FILE_BYTES = 1024 * 1024;
+
+        // in front of each wake's records in log.bin
+        struct FileChunk
+        {
+            uint32_t magic;
+            uint32_t words;
+            uint32_t dropped;
+            uint32_t reserved;
+        };
+
+        uint32_t ring[RING_WORDS];
+        size_t head = 0; // where the next record goes
+        size_t tail = 0; // the oldest record
+        size_t used = 0;
+        // oldest records overwritten to make room, or logged before init
+        uint32_t dropped = 0;
+        // both cores log, and interrupts
+        critical_section_t lock;
+        bool initialised = false;
+        // false until select_stdio finds a host, which offline wakes never ask, so their
+        // records go to the SD card rather than out of a USB port nobody's listening on
+        bool stdio_live = false;
+
+        uint32_t record[RECORD_HEADER_WORDS + MAX_ARG_WORDS];
+        char text[256];
+
+        // copy the oldest record out of the ring, returns its length in words
+        size_t pop()
+        {
+            critical_section_enter_blocking(&lock);
+            size_t len = 0;
+            if (used)
+            {
+                len = RECORD_HEADER_WORDS + (ring[tail] & 0xFF);
+                for (size_t i = 0; i < len; i++)
+                {
+                    record[i] = ring[(tail + i) % RING_WORDS];
+                }
+                tail = (tail + len) % RING_WORDS;
+                used -= len;
+            }
+            critical_section_exit(&lock);
+            return len;
+        }
+
+        // format strings and %s arguments in flash are still there to read
+        const char *resolve(uint32_t address, __unused void *ctx)
+        {
+            if (address >= XIP_BASE && address < XIP_BASE + PICO_FLASH_SIZE_BYTES)
+            {
+                return (const char *)(uintptr_t)address;
+            }
+            return nullptr;
+        }
+    }
+
+    void init()
+    {
+        critical_section_init(&lock);
+        initialised = true;
+    }
+
+    void HOT_PATH(write_record)(Level level, const char *fmt, const uint32_t *args, size_t arg_words)
+    {
+        if (!initialised)
+        {
+            dropped++;
+            return;
+        }
+        uint32_t const header[RECORD_HEADER_WORDS] = {
+            RECORD_TAG << 24 | (uint32_t)level << 16 | (uint32_t)arg_words,
+            time_us_32(),
+            (uint32_t)(uintptr_t)fmt,
+        };
+        size_t const len = RECORD_HEADER_WORDS + arg_words;
+
+        critical_section_enter_blocking(&lock);
+        while (RING_WORDS - used < len)
+        {
+            size_t const oldest = RECORD_HEADER_WORDS + (ring[tail] & 0xFF);
+            tail = (tail + oldest) % RING_WORDS;
+            used -= oldest;
+            dropped++;
+        }
+        for (size_t i = 0; i < len; i++)
+        {
+            ring[head] = i < RECORD_HEADER_WORDS ? header[i] : args[i - RECORD_HEADER_WORDS];
+            head = (head + 1) % RING_WORDS;
+        }
+        used += len;
+        critical_section_exit(&lock);
+    }
+
+    void select_stdio(bool usb_powered)
+    {
+        stdio_live = usb_powered && stdio_usb_connected();
+        if (!stdio_live)
+        {
+            // nobody's reading, the printfs that are left needn't go through USB either
+            printf("No USB host, logging to the SD card\n");
+            stdio_set_driver_enabled(&stdio_usb, false);
+        }
+    }
+
+    void flush()
+    {
+        if (!stdio_live)
+        {
+            // they wait in the ring for save()
+            return;
+        }
+        critical_section_enter_blocking(&lock);
+        uint32_t const lost = dropped;
+        dropped = 0;
+        critical_section_exit(&lock);
+        if (lost)
+        {
+            printf("(%lu log records dropped)\n", lost);
+        }
+        while (size_t const len = pop())
+        {
+            const char *fmt = resolve(record[2], nullptr);
+            if (!fmt)
+            {
+                continue;
+            }
+            size_t const n = format(text, sizeof(text), fmt, record + RECORD_HEADER_WORDS, len - RECORD_HEADER_WORDS, resolve, nullptr);
+            uint32_t const us = record[1];
+            bool const newline = n && text[n - 1] == '\n';
+            printf("[%lu.%03lu] %s%s", us / 1000000, (us / 1000) % 1000, text, newline ? "" : "\n");
+        }
+    }
+
+    void save()
+    {
+        flush();
+        if (!used && !dropped)
+        {
+            return;
+        }
+        if (frame_cache::mount() != Err::OK)
+        {
+            return;
+        }
+        FIL fil;
+        if (f_open(&fil, LOG_PATH, FA_WRITE | FA_OPEN_APPEND) != FR_OK)
+        {
+            return;
+        }
+        if (f_size(&fil) > MAX_FILE_BYTES)
+        {
+            f_close(&fil);
+            if (f_open(&fil, LOG_PATH, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+            {
+                return;
+            }
+        }
+
+        // the card's far too slow to hold the lock for, anything logged meanwhile stays in the ring
+        critical_section_enter_blocking(&lock);
+        size_t const start = tail;
+        size_t const words = used;
+        uint32_t const lost = dropped;
+        critical_section_exit(&lock);
+
+        FileChunk const chunk = {
+            .magic = FILE_MAGIC,
+            .words = (uint32_t)words,
+            .dropped = lost,
+            .reserved = 0,
+        };
+        size_t const first = MIN(words, RING_WORDS - start);
+        UINT bw = 0;
+        FRESULT fr = f_write(&fil, &chunk, sizeof(chunk), &bw);
+        if (fr == FR_OK)
+        {
+            fr = f_write(&fil, ring + start, first * 4, &bw);
+        }
+        if (fr == FR_OK && words > first)
+        {
+            // wrapped round
+            fr = f_write(&fil, ring, (words - first) * 4, &bw);
+        }
+
+        critical_section_enter_blocking(&lock);
+        // unless the oldest of them were overwritten while we wrote
+        if (fr == FR_OK && tail == start)
+        {
+            tail = (start + words) % RING_WORDS;
+            used -= words;
+            dropped -= lost;
+        }
+        critical_section_exit(&lock);
+        f_close(&fil);
+    }
+}
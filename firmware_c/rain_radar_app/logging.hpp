@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+// Log records for the paths where a printf costs too much: lwIP callbacks, ADC sampling,
+// waiting on the join. A record is the format string's address plus the raw argument
+// words, copied into a RAM ring in a few hundred cycles. Nothing is formatted until
+// flush(), and only then if a host is reading USB; otherwise save() appends the ring to
+// log.bin on the SD card at the end of the wake, for host_tools/log_decode to turn back
+// into text with the firmware's ELF.
+//
+// Format strings have to be literals so they're in flash, and %s arguments only decode if
+// they point into flash too. Records below RAIN_RADAR_LOG_LEVEL compile to nothing.
+
+#ifndef RAIN_RADAR_LOG_LEVEL
+#define RAIN_RADAR_LOG_LEVEL 3
+#endif
+
+namespace logging
+{
+    enum class Level : uint8_t
+    {
+        ERROR = 1,
+        WARN,
+        INFO,
+        DEBUG,
+    };
+
+    // records are a word of level and argument count, the time in us, the format string's address, then the arguments
+    constexpr size_t RECORD_HEADER_WORDS = 3;
+    constexpr size_t MAX_ARG_WORDS = 16;
+
+    namespace detail
+    {
+        template <typename T>
+        constexpr size_t arg_words()
+        {
+            static_assert(std::is_arithmetic_v<T> || std::is_pointer_v<T> || std::is_enum_v<T>, "log arguments are numbers and pointers, format anything else first");
+            return std::is_integral_v<T> && sizeof(T) > 4 ? 2 : 1;
+        }
+
+        inline void pack(uint32_t *) {}
+
+        template <typename T, typename... Rest>
+        inline void pack(uint32_t *dst, T value, Rest... rest)
+        {
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                float const f = (float)value;
+                memcpy(dst, &f, sizeof(f));
+            }
+            else if constexpr (std::is_pointer_v<T>)
+            {
+                *dst = (uint32_t)(uintptr_t)value;
+            }
+            else if constexpr (std::is_enum_v<T>)
+            {
+                *dst = (uint32_t)static_cast<std::underlying_type_t<T>>(value);
+            }
+            else if constexpr (sizeof(T) > 4)
+            {
+                dst[0] = (uint32_t)(uint64_t)value;
+                dst[1] = (uint32_t)((uint64_t)value >> 32);
+            }
+            else
+            {
+                *dst = (uint32_t)value;
+            }
+            pack(dst + arg_words<T>(), rest...);
+        }
+    }
+
+    void write_record(Level level, const char *fmt, const uint32_t *args, size_t arg_words);
+
+    template <typename... Args>
+    inline void write(Level level, const char *fmt, Args... args)
+    {
+        constexpr size_t words = (0 + ... + detail::arg_words<Args>());
+        static_assert(words <= MAX_ARG_WORDS, "too many log arguments");
+        uint32_t packed[words + 1];
+        detail::pack(packed, args...);
+        write_record(level, fmt, packed, words);
+    }
+
+    // Before anything is logged, records written earlier are counted as dropped
+    void init();
+
+    // Whether records get printed over USB: only once we know we're on USB power and
+    // there's a host at the other end. Otherwise USB stdio is switched off altogether.
+    void select_stdio(bool usb_powered);
+
+    // Print what's in the ring, if there's a host to print it to. Not from callbacks.
+    void flush();
+
+    // Append what's left in the ring to log.bin on the SD card
+    void save();
+}
+
+#define LOG_AT(level, fmt, ...)                                           \
+    do                                                                    \
+    {                                                                     \
+        if constexpr ((int)(level) <= RAIN_RADAR_LOG_LEVEL)               \
+        {                                                                 \
+            (void)sizeof(printf(fmt, ##__VA_ARGS__)); /* format checks */ \
+            logging::write(level, fmt, ##__VA_ARGS__);                    \
+        }                                                                 \
+    } while (0)
+
+#define LOG_ERROR(fmt, ...) LOG_AT(logging::Level::ERROR, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) LOG_AT(logging::Level::WARN, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOG_AT(logging::Level::INFO, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_AT(logging::Level::DEBUG, fmt, ##__VA_ARGS__)
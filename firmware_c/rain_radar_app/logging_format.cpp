@@ -0,0 +1,253 @@
+#include "logging_format.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+namespace logging
+{
+    namespace
+    {
+        struct Output
+        {
+            char *out;
+            size_t len;
+            size_t written = 0;
+
+            template <typename... Args>
+            void append(const char *fmt, Args... args)
+            {
+                if (written + 1 >= len)
+                {
+                    return;
+                }
+                int const n = snprintf(out + written, len - written, fmt, args...);
+                if (n > 0)
+                {
+                    written += (size_t)n < len - written ? (size_t)n : len - written - 1;
+                }
+            }
+        };
+
+        struct Args
+        {
+            const uint32_t *words;
+            size_t count;
+            size_t next = 0;
+
+            bool take(uint32_t &word)
+            {
+                if (next >= count)
+                {
+                    return false;
+                }
+                word = words[next++];
+                return true;
+            }
+
+            bool take64(uint64_t &value)
+            {
+                uint32_t lo, hi;
+                if (!take(lo) || !take(hi))
+                {
+                    return false;
+                }
+                value = lo | ((uint64_t)hi << 32);
+                return true;
+            }
+        };
+
+        // width or precision, either digits or a * taken from the arguments
+        bool copy_number(const char *&f, char *&spec, Args &args)
+        {
+            if (*f == '*')
+            {
+                uint32_t n;
+                if (!args.take(n))
+                {
+                    return false;
+                }
+                spec += sprintf(spec, "%d", (int)n);
+                f++;
+                return true;
+            }
+            // more digits than any sane width would overrun spec
+            for (int i = 0; i < 6 && *f >= '0' && *f <= '9'; i++)
+            {
+                *spec++ = *f++;
+            }
+            return true;
+        }
+    }
+
+    size_t format(char *out, size_t out_len, const char *fmt, const uint32_t *args, size_t arg_words, ResolveFn resolve, void *ctx)
+    {
+        if (!out_len)
+        {
+            return 0;
+        }
+        out[0] = '\0';
+        Output o{out, out_len};
+        Args a{args, arg_words};
+
+        const char *f = fmt;
+        while (*f)
+        {
+            const char *const literal = f;
+            while (*f && *f != '%')
+            {
+                f++;
+            }
+            if (f != literal)
+            {
+                o.append("%.*s", (int)(f - literal), literal);
+            }
+            if (!*f)
+            {
+                break;
+            }
+            if (f[1] == '%')
+            {
+                o.append("%%");
+                f += 2;
+                continue;
+            }
+
+            // rebuilt with the length that matches how the device packed the argument,
+            // as long and size_t aren't the same size here as there
+            char spec[32];
+            char *s = spec;
+            *s++ = *f++;
+            while (*f && strchr("-+ #0", *f) && s < spec + 8)
+            {
+                *s++ = *f++;
+            }
+            bool ok = copy_number(f, s, a);
+            if (*f == '.')
+            {
+                *s++ = *f++;
+                ok = ok && copy_number(f, s, a);
+            }
+            bool wide = false;
+            const char *narrow = "";
+            if (f[0] == 'h' && f[1] == 'h')
+            {
+                narrow = "hh";
+                f += 2;
+            }
+            else if (f[0] == 'l' && f[1] == 'l')
+            {
+                wide = true;
+                f += 2;
+            }
+            else if (*f == 'h')
+            {
+                narrow = "h";
+                f++;
+            }
+            else if (*f == 'j')
+            {
+                wide = true;
+                f++;
+            }
+            else if (*f && strchr("lztL", *f))
+            {
+                f++;
+            }
+            char const conv = *f;
+            if (!conv)
+            {
+                break;
+            }
+            f++;
+
+            uint32_t word = 0;
+            if (!ok)
+            {
+                o.append("<?>");
+                continue;
+            }
+            switch (conv)
+            {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c':
+                if (wide)
+                {
+                    uint64_t value;
+                    if (!a.take64(value))
+                    {
+                        o.append("<?>");
+                        break;
+                    }
+                    sprintf(s, "ll%c", conv);
+                    o.append(spec, (long long)value);
+                }
+                else
+                {
+                    if (!a.take(word))
+                    {
+                        o.append("<?>");
+                        break;
+                    }
+                    sprintf(s, "%s%c", narrow, conv);
+                    o.append(spec, (int)word);
+                }
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            {
+                if (!a.take(word))
+                {
+                    o.append("<?>");
+                    break;
+                }
+                float value;
+                memcpy(&value, &word, sizeof(value));
+                sprintf(s, "%c", conv);
+                o.append(spec, (double)value);
+                break;
+            }
+            case 's':
+            {
+                if (!a.take(word))
+                {
+                    o.append("<?>");
+                    break;
+                }
+                const char *str = resolve ? resolve(word, ctx) : nullptr;
+                if (!str)
+                {
+                    // a string that only ever lived in RAM
+                    o.append("<str %08lx>", (unsigned long)word);
+                    break;
+                }
+                sprintf(s, "s");
+                o.append(spec, str);
+                break;
+            }
+            case 'p':
+                if (!a.take(word))
+                {
+                    o.append("<?>");
+                    break;
+                }
+                o.append("0x%08lx", (unsigned long)word);
+                break;
+            default:
+                // %n and anything we don't know, best left alone
+                break;
+            }
+        }
+        return o.written;
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Turns a log record's format string and argument words back into text. Shared by the
+// firmware, when a host is attached, and host_tools/log_decode for the records on the SD card.
+namespace logging
+{
+    // The string a %s argument pointed at on the device, nullptr if it can't be found
+    using ResolveFn = const char *(*)(uint32_t address, void *ctx);
+
+    // Writes at most out_len - 1 chars and a terminator, returns how many were written.
+    // The words are what logging::write packed: one per argument, two for 64 bit integers,
+    // floats as their bits.
+    size_t format(char *out, size_t out_len, const char *fmt, const uint32_t *args, size_t arg_words, ResolveFn resolve, void *ctx);
+}
@@ -24,7 +24,9 @@
 #endif
 #define MEMP_NUM_TCP_SEG            32
 #define MEMP_NUM_ARP_QUEUE          10
-#define PBUF_POOL_SIZE              24
+// the pool the receive window lands in has the RAM mbedtls no longer takes from the heap,
+// see tls_arena. The window itself is set for altcp_tls at the bottom.
+#define PBUF_POOL_SIZE              32
 #define LWIP_ARP                    1
 #define LWIP_ETHERNET               1
 #define LWIP_ICMP                   1
@@ -48,6 +50,9 @@
 #define LWIP_TCP                    1
 #define LWIP_UDP                    1
 #define LWIP_DNS                    1
+// dns_cache hands lwIP the server's address from the last wake
+#define DNS_LOCAL_HOSTLIST          1
+#define DNS_LOCAL_HOSTLIST_IS_DYNAMIC 1
 #define LWIP_TCP_KEEPALIVE          1
 #define LWIP_NETIF_TX_SINGLE_PBUF   1
 #define DHCP_DOES_ARP_CHECK         0
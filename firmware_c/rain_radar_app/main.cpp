@@ -1,44 +1,67 @@
 
-#include <chrono>
 #include <cstdio>
-#include <iomanip>
 #include <math.h>
-#include <sstream>
 #include <stdio.h>
-#include <string>
-#include <time.h>
+#include <string_view>
+#include <utility>
 
 
+#include "basemap.hpp"
 #include "battery.hpp"
+#include "board.hpp"
+#include "boot.hpp"
+#include "clock_model.hpp"
+#include "clock_governor.hpp"
+#include "core1_tasks.hpp"
 #include "data_fetching.hpp"
+#include "dns_cache.hpp"
 #include "drivers/inky73/inky73.hpp"
 #include "drivers/pcf85063a/pcf85063a.hpp"
 #include "drivers/psram_display/psram_display.hpp"
+#include "forecast_bundle.hpp"
+#include "frame_cache.hpp"
+#include "frame_container.hpp"
 #include "hardware/clocks.h"
 #include "hardware/gpio.h"
 #include "hardware/spi.h"
 #include "hardware/uart.h"
 #include "hardware/watchdog.h"
 #include "inky_frame_7.hpp"
+#include "logging.hpp"
+#include "overlays.hpp"
+#include "panel_stream.hpp"
 #include "persistent_data.hpp"
+#include "pico/cyw43_arch.h"
 #include "pico/stdlib.h"
+#include "pico/unique_id.h"
+#include "profiler.hpp"
+#include "quality_tier.hpp"
+#include "rain_grid.hpp"
+#include "rain_stats.hpp"
 #include "pico/util/datetime.h"
 #include "pico/types.h"
 #include "pimoroni_common.hpp"
 #include "rain_radar_common.hpp"
+#include "schedule.hpp"
 #include "secrets.h"
+#include "ssid_stats.hpp"
+#include "time_util.hpp"
 #include "wifi_setup.hpp"
 
 using namespace pimoroni;
 
 InkyFrame inky_frame;
-void draw_error(InkyFrame &graphics, const std::string_view &msg)
-{
 
-    graphics.set_pen(Inky73::RED);
-    graphics.rectangle(Rect(graphics.width / 3, graphics.height * 2 / 3, graphics.width / 3, graphics.height / 4));
-    graphics.set_pen(Inky73::WHITE);
-    graphics.text(msg, Point(graphics.width / 3 + 5, graphics.height * 2 / 3 + 5), graphics.width / 3 - 5, 2);
+// Everything drawn over the radar image this wake. Declared once so it can be composited
+// inline by the direct stream path or flushed to PSRAM in one go.
+overlays::OverlayList overlay_list;
+
+void draw_error(overlays::OverlayList &overlays, const std::string_view &msg)
+{
+    int const width = inky_frame.width;
+    int const height = inky_frame.height;
+    overlays.add_rect(Rect(width / 3, height * 2 / 3, width / 3, height / 4), Inky73::RED);
+    overlays.add_text_box(msg, Rect(width / 3 + 5, height * 2 / 3 + 5, width / 3 - 5, height / 4 - 5), 2, Inky73::WHITE);
 }
 
 // void draw_lower_left_text(InkyFrame &graphics, const std::string_view &msg)
@@ -49,15 +72,22 @@ void draw_error(InkyFrame &graphics, const std::string_view &msg)
 //     graphics.text(msg, Point(5, graphics.height - 17), graphics.width / 2, 2);
 // }
 
-void draw_battery_status(InkyFrame &graphics, const char *status)
+void draw_battery_status(overlays::OverlayList &overlays, const char *status)
 {
-    graphics.set_pen(Inky73::WHITE);
-
     // Measure text width to right-align it
-    int text_width = graphics.measure_text(status, 1);
-    int x_position = graphics.width - text_width - 5; // 5 pixels from right edge
+    int text_width = overlays::OverlayList::measure_text(status, 1);
+    int x_position = inky_frame.width - text_width - 5; // 5 pixels from right edge
 
-    graphics.text(status, Point(x_position, 5), graphics.width, 1); // Small text at top
+    overlays.add_text(status, Point(x_position, 5), 1, Inky73::WHITE); // Small text at top
+}
+
+void draw_points_of_interest(overlays::OverlayList &overlays)
+{
+    for (const auto &poi : secrets::POINTS_OF_INTEREST_XY)
+    {
+        overlays.add_circle(Point(poi[0], poi[1]), 3, Inky73::WHITE);
+        overlays.add_circle(Point(poi[0], poi[1]), 2, Inky73::RED);
+    }
 }
 
 datetime_t dt = {
@@ -71,48 +101,401 @@ datetime_t dt = {
 };
 
 
-void draw_next_wakeup(InkyFrame &graphics, int hour, int minute)
+// the schedule works in local time, see clock_model
+uint32_t time_of_day(const datetime_t &t)
+{
+    datetime_t const local = clock_model::local(t);
+    return schedule::time_of_day(local.hour, local.min, local.sec);
+}
+
+// How many seconds after each update this frame wakes, the same every time, see schedule.hpp
+uint32_t wake_jitter_s()
+{
+    pico_unique_board_id_t id;
+    pico_get_unique_board_id(&id);
+    return schedule::jitter_s(id.id, sizeof(id.id), RAIN_RADAR_WAKE_JITTER_S);
+}
+
+void next_wakeup_text(uint32_t now_s, const schedule::Wake &wake, char *text, size_t len)
 {
-    std::ostringstream oss;
-    if (hour >= 0) {
-        oss << "Next update at " << std::setfill('0') << std::setw(2) << hour << ":"
-            << std::setfill('0') << std::setw(2) << minute;
+    uint32_t const in_s = schedule::seconds_until(now_s, wake);
+    if (in_s > 60 * 60) {
+        snprintf(text, len, "Next update at %02d:%02d", wake.hour, wake.minute);
     } else {
-        int mins_to_wakeup;
-        if (minute < dt.min) {
-            mins_to_wakeup = (minute + 60) - dt.min;
-        } else {
-            mins_to_wakeup = minute - dt.min;
-        }
-        oss << "Next update in " << mins_to_wakeup << " min";
+        snprintf(text, len, "Next update in %lu min", (in_s + 59) / 60);
+    }
+}
+
+void draw_next_wakeup(overlays::OverlayList &overlays, uint32_t now_s, const schedule::Wake &wake)
+{
+    char text[32];
+    next_wakeup_text(now_s, wake, text, sizeof(text));
+    int text_width = overlays::OverlayList::measure_text(text, 1);
+
+    overlays.add_text(text, Point(inky_frame.width-60 - text_width, 5), 1, Inky73::WHITE);
+}
+
+// Whether there's rain near any of the points of interest, counted as the frame came in
+void draw_rain_status(overlays::OverlayList &overlays, const rain_stats::Summary &rain)
+{
+    for (size_t i = 0; i < rain.poi_count; i++) {
+        printf("Rain within %d km of %d,%d: %u px\n", RAIN_RADAR_RAIN_NEAR_KM,
+               secrets::POINTS_OF_INTEREST_XY[i][0], secrets::POINTS_OF_INTEREST_XY[i][1], rain.near_poi[i]);
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%s within %d km", rain.rain_near_any() ? "Rain" : "No rain", RAIN_RADAR_RAIN_NEAR_KM);
+    int const text_width = overlays::OverlayList::measure_text(text, 1);
+    overlays.add_text(text, Point(inky_frame.width - text_width - 5, 17), 1, Inky73::WHITE);
+}
+
+// Send the frame in PSRAM to the panel with the overlays on it and start the refresh.
+// The overlays are composited on the way out, so PSRAM still has the bare frame for the SD card.
+void start_refresh()
+{
+#if RAIN_RADAR_LEGACY_OVERLAYS
+    {
+        profiler::Scope scope(profiler::Phase::OVERLAYS);
+        // pixel by pixel through pico_graphics, for comparison
+        overlay_list.draw_direct(inky_frame);
     }
+    overlay_list.clear();
+#endif
+    panel_stream::refresh_from_psram(inky_frame, overlay_list);
+}
+
+// set when a frame was streamed straight to the panel and it is already refreshing
+bool panel_refreshing = false;
+
+// read in run_app while cyw43 is up, drawn once the radio is off
+Battery battery;
+int32_t link_rssi = 0;
+
+// Read the battery and hand it to data_fetching to go out with the frame request.
+// MUST BE CALLED AFTER WIFI SETUP ON PICO W
+// for some reason it needs cyw43_arch_init() to have been called first,
+// so it's done straight after connecting rather than with the radio idling later
+void sample_battery()
+{
+    battery.init();
+    const char *status = battery.get_status_string();
+    printf("Battery status: %s\n", status);
+    printf("%s", battery.last_usb_powered() ? "USB powered\n" : "Battery powered\n");
+    logging::select_stdio(battery.last_usb_powered());
+
+    cyw43_wifi_get_rssi(&cyw43_state, &link_rssi);
+    float const voltage = battery.last_voltage();
+    data_fetching::set_telemetry({
+        .vsys_mv = (uint16_t)(voltage > 0 ? voltage * 1000 : 0),
+        .usb_powered = battery.last_usb_powered(),
+        .rssi = link_rssi,
+    });
+}
+
+// Power the radio down as soon as the last byte is in, everything after that is local
+void radio_off()
+{
+    wifi_setup::network_deinit(inky_frame);
+    profiler::end(profiler::Phase::RADIO_ON);
+    // out of the callbacks now, what they logged can be printed
+    logging::flush();
+}
 
-    int text_width = graphics.measure_text(oss.str(), 1);
+persistent::PersistentData persistent_data;
+// written to flash while the panel refreshes, it's nothing the frame needs
+bool persistent_data_changed = false;
 
-    graphics.set_pen(Inky73::WHITE);
-    graphics.text(oss.str(), Point(graphics.width-60 - text_width, 5), graphics.width, 1);
+// the RTC with its drift since the server last set it taken off
+datetime_t rtc_now()
+{
+    return clock_model::now(persistent_data, inky_frame.rtc.get_datetime());
 }
 
+// The RTC is only set from the server once it's drifted far enough to matter, so the
+// drift can be measured. dt is from the Date header, which came in a while ago.
+void sync_clock()
+{
+    uint32_t const date_ms = data_fetching::server_time_ms();
+    if (!date_ms) {
+        // dt is when the radar frame was made, which could be minutes ago
+        printf("No Date header, leaving the RTC as it is\n");
+        return;
+    }
+    uint32_t const since_ms = to_ms_since_boot(get_absolute_time()) - date_ms;
+    int64_t const server_now = time_util::to_unix(dt) + (since_ms + 500) / 1000;
+    if (clock_model::sync(persistent_data, inky_frame.rtc.get_datetime(), server_now)) {
+        datetime_t set = time_util::from_unix(server_now);
+        inky_frame.rtc.set_datetime(&set);
+        persistent_data_changed = true;
+    }
+}
 
+// the quarter of the day the SSID stats are kept under this wake, see ssid_stats
+int ssid_bucket = 0;
 
-std::pair<Err, std::string> run_app()
+void record_join(int8_t ssid_index, bool joined, uint32_t ms)
 {
+    ssid_stats::record_join(persistent_data, ssid_bucket, ssid_index, joined, ms);
+    persistent_data_changed = true;
+}
 
-    persistent::PersistentData payload = persistent::read();
+// How fast the frame came in, for ordering the networks next time
+void record_throughput(int8_t connected_ssid_index)
+{
+    uint32_t const kbytes_per_s = data_fetching::body_throughput();
+    printf("Body throughput: %lu kB/s\n", kbytes_per_s);
+    ssid_stats::record_throughput(persistent_data, ssid_bucket, connected_ssid_index, kbytes_per_s);
+}
 
-    ResultOr<int8_t> new_preferred_ssid_index = wifi_setup::wifi_connect(inky_frame, payload.wifi_preferred_ssid_index);
-    if (!new_preferred_ssid_index.ok())
+#if RAIN_RADAR_DIRECT_STREAM
+// In direct mode the frame never lands in PSRAM, so the overlays have to be known
+// up front and are composited inline as each scanline goes out to the panel.
+std::pair<Err, const char *> stream_frame(int8_t connected_ssid_index)
+{
+    draw_battery_status(overlay_list, battery.last_status());
+
+    profiler::Scope scope(profiler::Phase::FETCH);
+    ResultOr<datetime_t> const res = data_fetching::stream_image_to_panel(
+        inky_frame, connected_ssid_index, overlay_list,
+        [](const datetime_t &server_time)
+        {
+            dt = server_time;
+            uint32_t const now_s = time_of_day(server_time);
+            draw_next_wakeup(overlay_list, now_s, schedule::next_update(now_s, wake_jitter_s()));
+        });
+    panel_refreshing = panel_stream::refresh_started();
+    if (!res.ok())
     {
-        return {new_preferred_ssid_index.err, "WiFi connect failed"};
+        return {res.err, "Image stream failed"};
     }
-    int8_t connected_ssid_index = new_preferred_ssid_index.unwrap();
-    if (connected_ssid_index != payload.wifi_preferred_ssid_index)
+    dt = res.unwrap();
+    return {Err::OK, ""};
+}
+#endif
+
+// Prefer frame.bin, whose header says when the next frame is due, then the sparse precip layer
+// over the cached basemap, it's a fraction of the size. If anything about those goes wrong
+// fall back to the full frame, which overwrites all of PSRAM.
+#if RAIN_RADAR_DEVICE_DITHER
+// Fetch the rain as a low resolution intensity grid and dither it over the basemap here,
+// core1 doing the dithering. The server's caption comes along as text so we draw it ourselves.
+ResultOr<datetime_t> fetch_rain_grid_frame(int8_t connected_ssid_index)
+{
+    static data_fetching::RainGrid grid;
+    ResultOr<datetime_t> const res = data_fetching::fetch_rain_grid(inky_frame, connected_ssid_index, grid);
+    if (!res.ok())
     {
-        payload.wifi_preferred_ssid_index = connected_ssid_index;
-        printf("New preferred SSID index: %d\n", payload.wifi_preferred_ssid_index);
-        persistent::save(&payload);
+        return res;
     }
 
+    Err err;
+    {
+        profiler::Scope scope(profiler::Phase::DITHER);
+        err = rain_grid::render(inky_frame.ramDisplay, grid.intensities.data(), grid.width, grid.height);
+    }
+    if (err != Err::OK)
+    {
+        return err;
+    }
+
+    int const text_width = overlays::OverlayList::measure_text(grid.text, 2);
+    overlay_list.add_rect(Rect(4, inky_frame.height - 28, text_width + 8, 24), Inky73::BLACK);
+    overlay_list.add_text(grid.text, Point(8, inky_frame.height - 24), 2, Inky73::WHITE);
+    return res;
+}
+#endif
+
+#if RAIN_RADAR_LOG_BENCH
+// What logging from a callback costs, printf against a log record, for lines like the ones
+// the recv and ADC paths used to print
+void run_log_benchmark()
+{
+    constexpr int CALLS = 100;
+    uint64_t printf_us[2] = {0, 0};
+    uint64_t log_us[2] = {0, 0};
+    for (int i = 0; i < CALLS; i++)
+    {
+        uint64_t t = time_us_64();
+        printf("Received image data chunk of %u bytes\n", 1460u + i);
+        printf_us[0] += time_us_64() - t;
+        t = time_us_64();
+        LOG_INFO("Received image data chunk of %u bytes\n", 1460u + i);
+        log_us[0] += time_us_64() - t;
+
+        t = time_us_64();
+        printf("ADC avg: %lu, voltage: %.3f\n", (uint32_t)1500 + i, 3.9f);
+        printf_us[1] += time_us_64() - t;
+        t = time_us_64();
+        LOG_INFO("ADC avg: %lu, voltage: %.3f\n", (uint32_t)1500 + i, 3.9f);
+        log_us[1] += time_us_64() - t;
+    }
+    const char *const names[2] = {"recv_chunk", "adc_avg"};
+    printf("line,printf_us_per_call,log_us_per_call\n");
+    for (int i = 0; i < 2; i++)
+    {
+        printf("%s,%.2f,%.2f\n", names[i], printf_us[i] / (float)CALLS, log_us[i] / (float)CALLS);
+    }
+}
+#endif
+
+#if RAIN_RADAR_WIFI_PM_BENCH
+// Download the full frame a few times with each cyw43 power management setting for the body,
+// to pick the setting for wifi_setup from numbers rather than guesses. The XIP columns show
+// how much of the receive path still runs from flash, compare with RAIN_RADAR_RAM_HOT_PATHS off.
+void run_pm_benchmark(int8_t connected_ssid_index)
+{
+    struct Setting
+    {
+        const char *name;
+        uint32_t pm;
+    };
+    const Setting settings[] = {
+        {"performance", CYW43_PERFORMANCE_PM},
+        {"default", CYW43_DEFAULT_PM},
+        {"aggressive", CYW43_AGGRESSIVE_PM},
+        {"pm2_20ms", cyw43_pm_value(CYW43_PM2_POWERSAVE_MODE, 20, 1, 1, 1)},
+        {"none", cyw43_pm_value(CYW43_NO_POWERSAVE_MODE, 0, 0, 0, 0)},
+    };
+    constexpr int RUNS = 3;
+
+    printf("pm,run,bytes,first_byte_ms,last_byte_ms,kbytes_per_s,xip_accesses,xip_misses\n");
+    for (const Setting &setting : settings)
+    {
+        wifi_setup::set_power_mode(wifi_setup::PowerPhase::TRANSFER, setting.pm);
+        for (int run = 0; run < RUNS; run++)
+        {
+            profiler::XipCounts const xip_before = profiler::xip_counts();
+            ResultOr<data_fetching::TransferStats> const res = data_fetching::fetch_and_discard(connected_ssid_index, "quantized.bin");
+            profiler::XipCounts const xip_after = profiler::xip_counts();
+            if (!res.ok())
+            {
+                printf("%s,%d,error,%s\n", setting.name, run, errToString(res.err).data());
+                continue;
+            }
+            const data_fetching::TransferStats &stats = res.unwrap();
+            uint32_t const body_ms = stats.last_byte_ms - stats.first_byte_ms;
+            printf("%s,%d,%lu,%lu,%lu,%lu,%llu,%llu\n", setting.name, run, stats.bytes, stats.first_byte_ms, stats.last_byte_ms,
+                   body_ms ? stats.bytes / body_ms : 0, xip_after.accesses - xip_before.accesses,
+                   xip_after.misses() - xip_before.misses());
+        }
+    }
+    // back to what the normal fetch uses
+    wifi_setup::set_power_mode(wifi_setup::PowerPhase::TRANSFER, CYW43_PERFORMANCE_PM);
+}
+#endif
+
+// The smaller frames are for links and batteries that can't spare the radio time, see quality_tier
+quality_tier::Tier choose_tier(int8_t connected_ssid_index)
+{
+    quality_tier::Conditions const conditions = {
+        .rssi = link_rssi,
+        .kbytes_per_s = ssid_stats::throughput(persistent_data, ssid_bucket, connected_ssid_index),
+        .battery_percent = battery.last_percentage(),
+        .usb_powered = battery.last_usb_powered(),
+    };
+    quality_tier::Tier const tier = quality_tier::choose(conditions);
+    printf("Quality tier %s (rssi %ld, %u kB/s, battery %d%%)\n", quality_tier::name(tier), conditions.rssi,
+           conditions.kbytes_per_s, conditions.battery_percent);
+    return tier;
+}
+
+// The server's turning requests away, asking it for something else would only add to that
+bool server_busy(Err err)
+{
+    return err == Err::HTTP_TOO_MANY_REQUESTS || err == Err::HTTP_SERVICE_UNAVAILABLE;
+}
+
+// What frame.bin's header said, if that's where the frame came from. Zeroed otherwise.
+frame_container::Info frame_info;
+
+ResultOr<datetime_t> fetch_frame(int8_t connected_ssid_index, quality_tier::Tier tier)
+{
+#if RAIN_RADAR_FORECAST_BUNDLE
+    ResultOr<datetime_t> const bundle = data_fetching::fetch_forecast_bundle(inky_frame, connected_ssid_index);
+    Err const bundle_err = bundle.ok() ? forecast_bundle::show_frame(inky_frame, 0) : bundle.err;
+    if (bundle_err == Err::OK)
+    {
+        return bundle;
+    }
+    if (server_busy(bundle_err))
+    {
+        return bundle_err;
+    }
+    printf("Forecast bundle failed (%s), fetching a single frame\n", errToString(bundle_err).data());
+#endif
+#if RAIN_RADAR_DEVICE_DITHER
+    ResultOr<datetime_t> const grid = fetch_rain_grid_frame(connected_ssid_index);
+    if (grid.ok() || server_busy(grid.err))
+    {
+        return grid;
+    }
+    printf("Rain grid failed (%s), trying the frame container\n", errToString(grid.err).data());
+#endif
+    if (tier != quality_tier::Tier::FULL)
+    {
+        ResultOr<datetime_t> const smaller = data_fetching::fetch_frame_container(inky_frame, connected_ssid_index, quality_tier::file(tier), frame_info);
+        if (smaller.ok() || server_busy(smaller.err))
+        {
+            return smaller;
+        }
+        printf("Quality tier failed (%s), fetching the full frame\n", errToString(smaller.err).data());
+        frame_info = {};
+    }
+    ResultOr<datetime_t> const container = data_fetching::fetch_frame_container(inky_frame, connected_ssid_index, quality_tier::file(quality_tier::Tier::FULL), frame_info);
+    if (container.ok() || server_busy(container.err))
+    {
+        return container;
+    }
+    printf("Frame container failed (%s), trying the precip layer\n", errToString(container.err).data());
+    frame_info = {};
+    ResultOr<datetime_t> const layered = data_fetching::fetch_layered_image(inky_frame, connected_ssid_index);
+    if (layered.ok() || server_busy(layered.err))
+    {
+        return layered;
+    }
+    printf("Layered fetch failed (%s), fetching the full frame\n", errToString(layered.err).data());
+    return data_fetching::fetch_image(inky_frame, connected_ssid_index);
+}
+
+std::pair<Err, const char *> run_app()
+{
+
+    // started at boot, see boot_radio
+    ResultOr<int8_t> connect_result = wifi_setup::finish_connect(inky_frame, record_join);
+    profiler::end(profiler::Phase::WIFI_CONNECT);
+    if (!connect_result.ok())
+    {
+        if (connect_result.err == Err::NOT_INITIALISED)
+        {
+            // cyw43 never came up
+            profiler::end(profiler::Phase::RADIO_ON);
+        }
+        else
+        {
+            radio_off();
+        }
+        return {connect_result.err, "WiFi connect failed"};
+    }
+    int8_t connected_ssid_index = connect_result.unwrap();
+    data_fetching::prime_dns_cache(persistent_data, time_util::is_set(dt) ? time_util::to_unix(dt) : 0);
+
+    // the TLS handshake and decoding are CPU bound, see clock_governor for why this is safe for cyw43
+    clock_governor::set(clock_governor::Level::FAST);
+    sample_battery();
+
+#if RAIN_RADAR_WIFI_PM_BENCH
+    run_pm_benchmark(connected_ssid_index);
+#endif
+#if RAIN_RADAR_LOG_BENCH
+    run_log_benchmark();
+#endif
+
+#if RAIN_RADAR_DIRECT_STREAM
+    std::pair<Err, const char *> const streamed = stream_frame(connected_ssid_index);
+    radio_off();
+    record_throughput(connected_ssid_index);
+    return streamed;
+#endif
+
     inky_frame.set_pen(Inky73::GREEN);
     // inky_frame.clear();
 
@@ -150,7 +533,13 @@ std::pair<Err, std::string> run_app()
     // }
 
     // fetching the image will write to the PSRAM display directly
-    ResultOr<datetime_t> const res = data_fetching::fetch_image(inky_frame, connected_ssid_index);
+    profiler::begin(profiler::Phase::FETCH);
+    ResultOr<datetime_t> const res = fetch_frame(connected_ssid_index, choose_tier(connected_ssid_index));
+    profiler::end(profiler::Phase::FETCH);
+    // the fallbacks in fetch_frame might still need it, but nothing from here on does
+    radio_off();
+    record_throughput(connected_ssid_index);
+
     if (!res.ok())
     {
         return {res.err, "Image fetch failed"};
@@ -158,93 +547,390 @@ std::pair<Err, std::string> run_app()
         dt = res.unwrap();
     }
 
-    // points of interest
-    for (const auto &poi : secrets::POINTS_OF_INTEREST_XY)
+    draw_battery_status(overlay_list, battery.last_status());
+
+    return {Err::OK, ""};
+
+}
+
+// How old the frame on show is, for when it came from the SD card rather than the server
+void draw_frame_age(overlays::OverlayList &overlays, const datetime_t &frame_time)
+{
+    // the RTC keeps going while we're asleep, so it's a good enough "now"
+    datetime_t const now = rtc_now();
+    datetime_t const local = clock_model::local(frame_time);
+    char text[48];
+    if (time_util::is_set(now) && time_util::is_set(frame_time))
     {
-        inky_frame.set_pen(Inky73::WHITE);
-        inky_frame.circle(Point(poi[0], poi[1]), 3);
-        inky_frame.set_pen(Inky73::RED);
-        inky_frame.circle(Point(poi[0], poi[1]), 2);
+        int64_t const mins = (time_util::to_unix(now) - time_util::to_unix(frame_time)) / 60;
+        snprintf(text, sizeof(text), "From %02d:%02d, %lld min ago", local.hour, local.min, mins);
     }
+    else
+    {
+        snprintf(text, sizeof(text), "From %02d:%02d", local.hour, local.min);
+    }
+    int const text_width = overlays::OverlayList::measure_text(text, 2);
+    overlays.add_rect(Rect(0, 0, text_width + 10, 24), Inky73::BLACK);
+    overlays.add_text(text, Point(5, 4), 2, Inky73::WHITE);
+}
 
-    // Initialize battery monitoring
-    // MUST BE INITIALIZED AFTER WIFI SETUP ON PICO W
-    // for some reason it needs cyw43_arch_init() to have been called first
-    Battery battery;
-    battery.init();
-    const char *status = battery.get_status_string();
-    printf("Battery status: %s\n", status);
-    printf("%s", battery.is_usb_powered() ? "USB powered\n" : "Battery powered\n");
-    draw_battery_status(inky_frame, status);
+// Put the newest frame from the SD card in PSRAM, with its age on it
+bool show_cached_frame()
+{
+    profiler::Scope scope(profiler::Phase::SD_CACHE);
+    ResultOr<datetime_t> const cached = frame_cache::load_newest(inky_frame);
+    if (!cached.ok())
+    {
+        return false;
+    }
+    draw_frame_age(overlay_list, cached.unwrap());
+    return true;
+}
 
-    return {Err::OK, ""};
+#if RAIN_RADAR_FORECAST_BUNDLE
+// Between radio wakes show whichever frame of the bundle is due now, unless the server
+// said the rain was changing too quickly for its forecast to be worth showing.
+bool show_bundle_frame()
+{
+    if (!time_util::is_set(dt))
+    {
+        return false;
+    }
+    ResultOr<forecast_bundle::Info> const res = forecast_bundle::read_info();
+    if (!res.ok())
+    {
+        return false;
+    }
+    const forecast_bundle::Info &info = res.unwrap();
+    if (info.change_permille > RAIN_RADAR_BUNDLE_MAX_CHANGE)
+    {
+        printf("Rain is changing quickly (%u per mille), fetching a fresh frame\n", info.change_permille);
+        return false;
+    }
 
+    int64_t const step_secs = info.step_mins * 60;
+    int64_t const age_secs = time_util::to_unix(dt) - time_util::to_unix(info.server_time);
+    // the nearest frame, frame 0 went up when the bundle was fetched
+    int64_t const index = (age_secs + step_secs / 2) / step_secs;
+    if (age_secs < 0 || index < 1 || index >= info.frame_count)
+    {
+        return false;
+    }
+
+    profiler::Scope scope(profiler::Phase::SD_CACHE);
+    if (forecast_bundle::show_frame(inky_frame, index) != Err::OK)
+    {
+        return false;
+    }
+    return true;
 }
+#endif
 
-int main()
+// Copy the frame in PSRAM, without its overlays, to the SD card
+void save_frame_task(__unused void *arg)
+{
+    profiler::Scope scope(profiler::Phase::SD_CACHE);
+    frame_cache::save(inky_frame, dt);
+}
+
+// set at boot when there's something to show without the radio
+bool offline = false;
+// someone pressed a button, they get the last frame from the SD card before anything else
+bool button_wake = false;
+
+enum BootStep : size_t
+{
+    BOOT_INKY,
+    BOOT_STDIO,
+    BOOT_CLOCKS,
+    BOOT_WAKE,
+    BOOT_PERSISTENT,
+    BOOT_RADIO,
+    BOOT_SD_CARD,
+    BOOT_OFFLINE,
+    BOOT_BASE_FRAME,
+    BOOT_POINTS,
+};
+
+void boot_inky()
 {
     inky_frame.init();
+    // everything that touches pixels is sized for the board at compile time
+    if (inky_frame.width != board::WIDTH || inky_frame.height != board::HEIGHT)
+    {
+        panic("Built for %s, but this frame is %dx%d\n", board::ACTIVE.name, inky_frame.width, inky_frame.height);
+    }
     inky_frame.rtc.unset_alarm();
     inky_frame.rtc.clear_alarm_flag();
     inky_frame.rtc.unset_timer();
     inky_frame.rtc.clear_timer_flag();
 
-    // get the rtc ticking
-    inky_frame.rtc.set_datetime(&dt);
+    // the rtc keeps time while we sleep, once a server has told it the time
+    datetime_t const rtc_now = inky_frame.rtc.get_datetime();
+    if (time_util::is_set(rtc_now)) {
+        dt = rtc_now;
+    } else {
+        // get the rtc ticking
+        inky_frame.rtc.set_datetime(&dt);
+    }
+}
 
+void boot_stdio()
+{
     stdio_init_all();
-    sleep_ms(100);
-
-    // Reducing system clocked resulted in wifi connection issues
-    // I think the pico couldn't keep up with the data rate
-    // Reduce CPU clock to 96 MHz to lower power consumption.
-    // set_sys_clock_khz takes kHz and returns true on success.
-    // const uint32_t target_khz = 96000;
-    // if (!set_sys_clock_khz(target_khz, true)) {
-    //     printf("Warning: failed to set system clock to %u kHz\n", target_khz);
-    // } else {
-    //     printf("System clock set to %u kHz\n", target_khz);
-    // }
+    logging::init();
+}
 
+void boot_clocks()
+{
+    // once the board's buses are set up, so it can keep their baud rates
+    clock_governor::init();
+}
+
+void boot_wake()
+{
     InkyFrame::WakeUpEvent event = inky_frame.get_wake_up_event();
     printf("Wakup event: %d\n", event);
+    button_wake = event >= InkyFrame::BUTTON_A_EVENT && event <= InkyFrame::BUTTON_E_EVENT;
+}
+
+// On core1, it's only flash reads
+void boot_persistent()
+{
+    persistent_data = persistent::read();
+    // all this wake has to go on until a server says otherwise
+    dt = clock_model::now(persistent_data, dt);
+}
+
+// Whether the SD card might have something to show, in which case the radio waits to hear
+bool may_be_offline()
+{
+#if RAIN_RADAR_FORECAST_BUNDLE
+    // the last bundle might have a frame for now
+    return true;
+#else
+    return button_wake;
+#endif
+}
+
+void start_radio()
+{
+    profiler::begin(profiler::Phase::RADIO_ON);
+    profiler::begin(profiler::Phase::WIFI_CONNECT);
+    // the firmware load is most of the time this takes, and the SSID stats are read on
+    // core1 meanwhile
+    if (wifi_setup::power_up(inky_frame) != Err::OK)
+    {
+        // run_app finds out from finish_connect
+        return;
+    }
+    int8_t order[persistent::MAX_SSIDS];
+    int count;
+    if (boot::finished(BOOT_PERSISTENT))
+    {
+        ssid_bucket = ssid_stats::time_bucket(clock_model::local(dt));
+        count = ssid_stats::plan(persistent_data, ssid_bucket, order);
+    }
+    else
+    {
+        // not worth holding the join up for, dt is core1's until then
+        printf("No SSID stats yet, trying the networks in the usual order\n");
+        ssid_bucket = ssid_stats::time_bucket(clock_model::local(inky_frame.rtc.get_datetime()));
+        count = ssid_stats::default_order(order);
+    }
+    // run_app waits for it to finish
+    wifi_setup::begin_connect(inky_frame, order, count);
+}
 
-    auto [app_err, app_msg] = run_app();
+void boot_radio()
+{
+    if (may_be_offline()) {
+        // boot_offline starts it if the card has nothing
+        return;
+    }
+    start_radio();
+}
 
-    // the rain api updates every 10 mins, and the server runs on a 10 min schedule
-    int next_wakeup_min = 10;
-    int next_wakeup_hour = -1;
+void boot_sd_card()
+{
+    // the card's slow to start, better now than when the frame's ready to save
+    frame_cache::mount();
+}
+
+void boot_offline()
+{
+    if (!may_be_offline()) {
+        return;
+    }
+    // a button press means someone is looking, show them the last frame straight away
+    // rather than after the Wi-Fi and the download
+    bool const from_cache = button_wake && show_cached_frame();
+#if RAIN_RADAR_FORECAST_BUNDLE
+    // the radio stays off if the last bundle has a frame for now
+    bool const from_bundle = !button_wake && show_bundle_frame();
+#else
+    bool const from_bundle = false;
+#endif
+    offline = from_cache || from_bundle;
+    if (!offline) {
+        start_radio();
+    }
+}
+
+// The map goes into PSRAM while cyw43 associates, so a frame that doesn't arrive, or
+// arrives cut short, leaves the map under the error rather than what PSRAM woke up with
+void boot_base_frame()
+{
+    if (offline) {
+        // there's a frame there already
+        return;
+    }
+    if (basemap::load_frame(inky_frame.ramDisplay) != Err::OK) {
+        inky_frame.set_pen(Inky73::WHITE);
+        inky_frame.clear();
+    }
+}
+
+void boot_points()
+{
+    draw_points_of_interest(overlay_list);
+}
+
+// Ready steps run in this order, so the radio starts as soon as it knows it's needed,
+// and the rest happens while cyw43 loads its firmware and associates.
+const boot::Step boot_steps[] = {
+    // holds the power on, and everything else on the board goes through it
+    {"inky", boot_inky, 0},
+    {"stdio", boot_stdio, 0},
+    {"clocks", boot_clocks, boot::after(BOOT_INKY)},
+    {"wake", boot_wake, boot::after(BOOT_INKY) | boot::after(BOOT_STDIO)},
+    // takes the RTC's drift off the time boot_inky read, alongside the radio
+    {"persistent", boot_persistent, boot::after(BOOT_INKY), true},
+    // cyw43 takes its bus clock divider from the governor. The SSID order comes from the
+    // persistent data if core1 has read it by the time the firmware's loaded.
+    {"radio", boot_radio, boot::after(BOOT_CLOCKS) | boot::after(BOOT_WAKE)},
+    {"sd_card", boot_sd_card, boot::after(BOOT_WAKE)},
+    // the cached frame or the forecast bundle, which goes by the time
+    {"offline", boot_offline, boot::after(BOOT_CLOCKS) | boot::after(BOOT_PERSISTENT) | boot::after(BOOT_SD_CARD)},
+    {"base_frame", boot_base_frame, boot::after(BOOT_OFFLINE)},
+    {"points", boot_points, 0},
+};
+
+int main()
+{
+    {
+        profiler::Scope scope(profiler::Phase::BOOT);
+        boot::run(boot_steps);
+    }
+    profiler::mark_app_start();
+
+    auto [app_err, app_msg] = offline ? std::pair<Err, const char *>(Err::OK, "") : run_app();
+
+    uint32_t const jitter = wake_jitter_s();
+    printf("Waking %lu s after each update\n", jitter);
+    // the rtc is ticking even if no server has set it yet, which is all a retry needs
+    uint32_t planned_s = time_of_day(rtc_now());
+    schedule::Wake wake = schedule::retry(planned_s, schedule::INTERVAL_S, jitter);
 
     if (app_err != Err::OK) {
-        std::string error_msg = std::string(app_msg) + " (" + std::string(errToString(app_err)) + ")";
-        printf("Error: %s\n", error_msg.c_str());
-        draw_error(inky_frame, error_msg);
+        char error_msg[overlays::MAX_TEXT_LEN];
+        std::string_view const err_name = errToString(app_err);
+        snprintf(error_msg, sizeof(error_msg), "%s (%.*s)", app_msg, (int)err_name.size(), err_name.data());
+        printf("Error: %s\n", error_msg);
+        if (panel_refreshing) {
+            // those overlays went out with the streamed frame
+            overlay_list.clear();
+            draw_points_of_interest(overlay_list);
+        }
+        // better the last good frame under the error than whatever is left in PSRAM
+        show_cached_frame();
+        draw_error(overlay_list, error_msg);
+        // back off quickly rather than leaving the error up for the whole 10 mins
+        if (persistent_data.fetch_failures < UINT8_MAX) {
+            persistent_data.fetch_failures++;
+        }
+        persistent_data_changed = true;
+        uint32_t const delay_s = schedule::backoff_s(persistent_data.fetch_failures, data_fetching::retry_after_s());
+        printf("Failure %u in a row, trying again in %lu s\n", persistent_data.fetch_failures, delay_s + jitter);
+        wake = schedule::retry(planned_s, delay_s, jitter);
+    } else if (offline) {
+        if (time_util::is_set(dt)) {
+            planned_s = time_of_day(dt);
+            wake = schedule::next_update(planned_s, jitter);
+        }
     } else {
-        inky_frame.rtc.set_datetime(&dt);
-        if(dt.hour >= 23 || dt.hour <= 5) {
-            next_wakeup_hour = 6;
-            next_wakeup_min = 0;
-        } else {
-            next_wakeup_hour = -1;
-            next_wakeup_min = (dt.min+1 + 10) / 10 * 10;
-            if (next_wakeup_min >= 60)
-            {
-                next_wakeup_min -= 60;
-            }
+        sync_clock();
+        planned_s = time_of_day(dt);
+        // the server knows better than the clock when it'll have something new
+        int64_t const publish_in_s = frame_info.next_publish ? frame_info.next_publish - time_util::to_unix(dt) : 0;
+        wake = schedule::after_publish(planned_s, publish_in_s > 0 ? (uint32_t)publish_in_s : 0, jitter);
+        const rain_stats::Summary &rain = rain_stats::summary();
+        if (rain.valid && rain.rain_pixels == 0) {
+            printf("No rain on the map, waiting %lu updates\n", schedule::DRY_INTERVALS);
+            wake = schedule::next_update(planned_s, jitter, schedule::DRY_INTERVALS);
+        }
+        for (size_t i = 0; i < frame_info.poi_count; i++) {
+            const frame_container::PoiRain &poi = frame_info.pois[i];
+            printf("Rain at %u,%u: %u dBZ now, %u forecast\n", poi.x, poi.y, poi.now & 0x7F, poi.forecast & 0x7F);
         }
+        if (persistent_data.fetch_failures) {
+            persistent_data.fetch_failures = 0;
+            persistent_data_changed = true;
+        }
+    }
+
+    // a streamed frame went out with its overlays before it had been counted
+    const rain_stats::Summary &rain = rain_stats::summary();
+    if (app_err == Err::OK && rain.valid && rain.poi_count && !panel_refreshing) {
+        draw_rain_status(overlay_list, rain);
     }
 
-    draw_next_wakeup(inky_frame, next_wakeup_hour, next_wakeup_min);
+    // a streamed frame is already on its way to the panel, unless it went wrong part way
+    // through, in which case show the error from PSRAM as usual
+    bool const update_from_psram = !panel_refreshing || app_err != Err::OK;
+    // only a new frame, the cached ones are already on the card
+    bool save_frame = app_err == Err::OK && !offline && !panel_refreshing;
+#if RAIN_RADAR_LEGACY_OVERLAYS
+    // the overlays go into PSRAM in this mode, so the frame is saved before they do
+    if (save_frame) {
+        save_frame_task(nullptr);
+        save_frame = false;
+    }
+#endif
+
+    profiler::begin(profiler::Phase::PANEL_REFRESH);
+    if (update_from_psram) {
+        draw_next_wakeup(overlay_list, planned_s, wake);
+        // the streamed frame has to finish before the error can go out
+        panel_stream::wait_for_refresh(inky_frame);
+        start_refresh();
+    }
 
-    if (wifi_setup::is_connected()) {
-        wifi_setup::network_deinit(inky_frame);
+    // the rest of the wake's housekeeping happens while the panel refreshes, the SD card on
+    // core1 while core0 sleeps between looks at BUSY, none of it needs much clock
+    clock_governor::set(clock_governor::Level::IDLE);
+    if (save_frame) {
+        core1_tasks::run(save_frame_task, nullptr);
+    }
+    if (persistent_data_changed || dns_cache::changed()) {
+        persistent::save(&persistent_data);
     }
-    
-    inky_frame.update(true);
+    // powering the panel off goes over SPI0, which the SD card and PSRAM share with it, so the
+    // save on core1 has to be done first. The panel carries on refreshing meanwhile.
+    core1_tasks::wait();
+    panel_stream::wait_for_refresh(inky_frame);
+    profiler::end(profiler::Phase::PANEL_REFRESH);
+    // the SD card's free again, and whatever was logged goes on it unless a host has already printed it
+    logging::save();
 
     printf("done!\n");
+    profiler::report();
 
-    inky_frame.sleep_until(-1, next_wakeup_min, next_wakeup_hour, -1);
+    // in case the refresh took so long the alarm time has already gone by
+    datetime_t const now = rtc_now();
+    wake = schedule::still_ahead(wake, planned_s, time_of_day(now));
+    schedule::Wake const alarm = clock_model::alarm(persistent_data, now, wake);
+    inky_frame.sleep_until(alarm.second, alarm.minute, alarm.hour, -1);
 
     return 0;
 }
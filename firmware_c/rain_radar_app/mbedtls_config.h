@@ -9,6 +9,12 @@
 
 #define MBEDTLS_SSL_OUT_CONTENT_LEN    2048
 
+/* mbedtls allocates from tls_arena rather than the heap */
+#define MBEDTLS_PLATFORM_MEMORY
+/* ask for smaller records and shrink the receive buffer to them after the handshake */
+#define MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+#define MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH
+
 #define MBEDTLS_ALLOW_PRIVATE_ACCESS
 #define MBEDTLS_HAVE_TIME
 #define MBEDTLS_PLATFORM_MS_TIME_ALT
@@ -0,0 +1,223 @@
+#include "overlays.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "board.hpp"
+
+using namespace pimoroni;
+
+namespace overlays
+{
+    namespace
+    {
+        inline void set_packed_pixel(uint8_t *packed_row, int x, uint8_t c)
+        {
+            uint8_t &byte = packed_row[x >> 1];
+            byte = (x & 1) ? (byte & 0xF0) | (c & 0x0F) : (byte & 0x0F) | (c << 4);
+        }
+    }
+
+    Tile *OverlayList::new_tile(Tile::Kind kind, const Rect &bounds, uint8_t pen, bool solid)
+    {
+        if (count >= MAX_OVERLAYS)
+        {
+            printf("Too many overlays, dropping one\n");
+            return nullptr;
+        }
+        Tile &tile = tiles[count];
+        tile.kind = kind;
+        tile.pen = pen;
+        tile.bounds = bounds;
+        tile.scale = 1.0f;
+        tile.text[0] = '\0';
+        if (solid)
+        {
+            tile.pixels.reset();
+        }
+        else
+        {
+            tile.pixels.reset(new uint8_t[bounds.w * bounds.h]);
+            memset(tile.pixels.get(), TRANSPARENT, bounds.w * bounds.h);
+        }
+        count++;
+        return &tile;
+    }
+
+    void OverlayList::clear()
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            tiles[i].pixels.reset();
+        }
+        count = 0;
+    }
+
+    void OverlayList::add_circle(const Point &centre, int radius, uint8_t pen)
+    {
+        Tile *tile = new_tile(Tile::Kind::CIRCLE, Rect(centre.x - radius, centre.y - radius, radius * 2 + 1, radius * 2 + 1), pen);
+        if (!tile)
+        {
+            return;
+        }
+        PicoGraphics_PenP8 graphics(tile->bounds.w, tile->bounds.h, tile->pixels.get());
+        graphics.set_pen(pen);
+        graphics.circle(Point(radius, radius), radius);
+    }
+
+    void OverlayList::add_rect(const Rect &rect, uint8_t pen)
+    {
+        new_tile(Tile::Kind::RECT, rect, pen, true);
+    }
+
+    int32_t OverlayList::measure_text(std::string_view text, float scale)
+    {
+        // measure with a throwaway 1x1 canvas, the font is the same as the real one
+        uint8_t scratch;
+        PicoGraphics_PenP8 measure(1, 1, &scratch);
+        return measure.measure_text(text, scale);
+    }
+
+    void OverlayList::render_text(Tile &tile, std::string_view text, float scale, int32_t wrap)
+    {
+        size_t n = text.copy(tile.text, sizeof(tile.text) - 1);
+        tile.text[n] = '\0';
+        tile.scale = scale;
+
+        PicoGraphics_PenP8 graphics(tile.bounds.w, tile.bounds.h, tile.pixels.get());
+        graphics.set_pen(tile.pen);
+        graphics.text(tile.text, Point(0, 0), wrap, scale);
+    }
+
+    void OverlayList::add_text(std::string_view text, const Point &origin, float scale, uint8_t pen)
+    {
+        uint8_t scratch;
+        PicoGraphics_PenP8 measure(1, 1, &scratch);
+        int32_t width = measure_text(text, scale);
+        int32_t height = (int32_t)ceilf(measure.bitmap_font->height * scale);
+
+        Tile *tile = new_tile(Tile::Kind::TEXT, Rect(origin.x, origin.y, width, height), pen);
+        if (tile)
+        {
+            render_text(*tile, text, scale, width + 1);
+        }
+    }
+
+    void OverlayList::add_text_box(std::string_view text, const Rect &box, float scale, uint8_t pen)
+    {
+        Tile *tile = new_tile(Tile::Kind::TEXT, box, pen);
+        if (tile)
+        {
+            render_text(*tile, text, scale, box.w);
+        }
+    }
+
+    void OverlayList::composite_packed_row(int y, uint8_t *packed_row, int width) const
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const Tile &tile = tiles[i];
+            if (y < tile.bounds.y || y >= tile.bounds.y + tile.bounds.h)
+            {
+                continue;
+            }
+            int const x0 = std::max(0, tile.bounds.x);
+            int const x1 = std::min(width, tile.bounds.x + tile.bounds.w);
+            if (!tile.pixels)
+            {
+                for (int x = x0; x < x1; x++)
+                {
+                    set_packed_pixel(packed_row, x, tile.pen);
+                }
+                continue;
+            }
+            const uint8_t *src = tile.pixels.get() + (y - tile.bounds.y) * tile.bounds.w - tile.bounds.x;
+            for (int x = x0; x < x1; x++)
+            {
+                if (src[x] != TRANSPARENT)
+                {
+                    set_packed_pixel(packed_row, x, src[x]);
+                }
+            }
+        }
+    }
+
+    void OverlayList::flush_to_psram(PSRamDisplay &psram, int width, int height) const
+    {
+        static uint8_t row[board::WIDTH];
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const Tile &tile = tiles[i];
+            int const x0 = std::max(0, tile.bounds.x);
+            int const x1 = std::min(std::min(width, board::WIDTH), tile.bounds.x + tile.bounds.w);
+            int const y0 = std::max(0, tile.bounds.y);
+            int const y1 = std::min(height, tile.bounds.y + tile.bounds.h);
+
+            for (int y = y0; y < y1 && x0 < x1; y++)
+            {
+                if (!tile.pixels)
+                {
+                    psram.write_pixel_span(Point(x0, y), x1 - x0, tile.pen);
+                    continue;
+                }
+
+                // only touch the part of the row that has something on it
+                const uint8_t *src = tile.pixels.get() + (y - tile.bounds.y) * tile.bounds.w - tile.bounds.x;
+                int first = x0;
+                while (first < x1 && src[first] == TRANSPARENT)
+                {
+                    first++;
+                }
+                int last = x1;
+                while (last > first && src[last - 1] == TRANSPARENT)
+                {
+                    last--;
+                }
+                if (first == last)
+                {
+                    continue;
+                }
+
+                uint const len = last - first;
+                psram.read_pixel_span(Point(first, y), len, row);
+                for (int x = first; x < last; x++)
+                {
+                    if (src[x] != TRANSPARENT)
+                    {
+                        row[x - first] = src[x];
+                    }
+                }
+                // same pixel offsets that data_fetching streams the frame into
+                psram.write_span((size_t)y * width + first, len, row);
+            }
+        }
+    }
+
+    void OverlayList::draw_direct(PicoGraphics &graphics) const
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const Tile &tile = tiles[i];
+            graphics.set_pen(tile.pen);
+            switch (tile.kind)
+            {
+            case Tile::Kind::CIRCLE:
+            {
+                int const radius = tile.bounds.w / 2;
+                graphics.circle(Point(tile.bounds.x + radius, tile.bounds.y + radius), radius);
+                break;
+            }
+            case Tile::Kind::RECT:
+                graphics.rectangle(tile.bounds);
+                break;
+            case Tile::Kind::TEXT:
+                graphics.text(tile.text, Point(tile.bounds.x, tile.bounds.y), tile.bounds.w + 1, tile.scale);
+                break;
+            }
+        }
+    }
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "pico_graphics.hpp"
+#include "psram_display.hpp"
+
+namespace overlays
+{
+    // palette index for tile pixels that the overlay does not cover
+    constexpr uint8_t TRANSPARENT = 0xFF;
+    constexpr size_t MAX_OVERLAYS = 16;
+    constexpr size_t MAX_TEXT_LEN = 96;
+
+    // One overlay primitive and, unless it is a solid rectangle, a small SRAM tile
+    // holding its palette indices (one byte per pixel) covering only its bounding box.
+    struct Tile
+    {
+        enum class Kind : uint8_t
+        {
+            CIRCLE,
+            RECT,
+            TEXT,
+        };
+
+        Kind kind;
+        uint8_t pen;
+        pimoroni::Rect bounds;
+        float scale;
+        char text[MAX_TEXT_LEN];
+        // null for solid rectangles
+        std::unique_ptr<uint8_t[]> pixels;
+    };
+
+    // The small things we draw over the radar image (POIs, battery, next update text, errors).
+    // The list is declared once per wake and each primitive is rendered into its own tile.
+    // It can then be applied inline to scanlines as a frame streams past, or flushed to
+    // PSRAM with a read-modify-write per tile row, instead of one SPI transaction per pixel.
+    class OverlayList
+    {
+    public:
+        void add_circle(const pimoroni::Point &centre, int radius, uint8_t pen);
+        void add_rect(const pimoroni::Rect &rect, uint8_t pen);
+        void add_text(std::string_view text, const pimoroni::Point &origin, float scale, uint8_t pen);
+        // text word wrapped to fit the box
+        void add_text_box(std::string_view text, const pimoroni::Rect &box, float scale, uint8_t pen);
+
+        // width in pixels the text would take up, so callers can align it
+        static int32_t measure_text(std::string_view text, float scale);
+
+        // Composite every tile that covers row y into a row packed in the Inky73's native
+        // 4 bits per pixel order (high nibble is the left pixel).
+        void composite_packed_row(int y, uint8_t *packed_row, int width) const;
+
+        // Write the overlays into the PSRAM frame, a couple of SPI transactions per tile row.
+        void flush_to_psram(pimoroni::PSRamDisplay &psram, int width, int height) const;
+
+        // The old way: draw the primitives through pico_graphics one pixel at a time.
+        // Kept so the two can be compared with the profiler.
+        void draw_direct(pimoroni::PicoGraphics &graphics) const;
+
+        size_t size() const { return count; }
+
+        // free all the tiles
+        void clear();
+
+    private:
+        Tile tiles[MAX_OVERLAYS];
+        size_t count = 0;
+
+        Tile *new_tile(Tile::Kind kind, const pimoroni::Rect &bounds, uint8_t pen, bool solid = false);
+        void render_text(Tile &tile, std::string_view text, float scale, int32_t wrap);
+    };
+
+}
@@ -0,0 +1,111 @@
+#include "panel_stream.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include "pico/stdlib.h"
+#include "drivers/inky73/inky73.hpp"
+#include "board.hpp"
+#include "profiler.hpp"
+
+using namespace pimoroni;
+
+namespace panel_stream
+{
+    namespace
+    {
+        // two white pixels, used to pad rows we could not fill
+        constexpr uint8_t WHITE_PAIR = (Inky73::WHITE << 4) | Inky73::WHITE;
+        constexpr size_t MAX_ROW_BYTES = board::WIDTH / 2;
+        // BUSY comes in through the shift register, so there's no GPIO to wake on.
+        // A refresh takes ~30 s, checking every so often and sleeping in between is plenty.
+        constexpr uint32_t BUSY_POLL_MS = 100;
+
+        bool started = false;
+    }
+
+    StreamingFrame::StreamingFrame(InkyFrame &inky_frame, RowSource source, const overlays::OverlayList &overlays)
+        : PicoGraphics_PenInky7(inky_frame.width, inky_frame.height, inky_frame.ramDisplay)
+        , source(std::move(source))
+        , overlays(overlays)
+    {
+    }
+
+    void StreamingFrame::frame_convert(PenType type, conversion_callback_func callback)
+    {
+        if (type != PEN_INKY7)
+        {
+            return;
+        }
+
+        static uint8_t row[MAX_ROW_BYTES];
+        size_t const row_bytes = bounds.w / 2;
+        assert(row_bytes <= MAX_ROW_BYTES);
+
+        for (int y = 0; y < bounds.h; y++)
+        {
+            // once the source has failed there is nothing more coming, just pad the rest
+            if (rows_failed || !source(y, row, row_bytes))
+            {
+                memset(row, WHITE_PAIR, row_bytes);
+                rows_failed++;
+            }
+            profiler::begin(profiler::Phase::OVERLAYS);
+            overlays.composite_packed_row(y, row, bounds.w);
+            profiler::end(profiler::Phase::OVERLAYS);
+            callback(row, row_bytes);
+        }
+
+        if (rows_failed)
+        {
+            printf("Streamed frame was missing %d rows\n", rows_failed);
+        }
+    }
+
+    bool stream_to_panel(InkyFrame &inky_frame, RowSource source, const overlays::OverlayList &overlays)
+    {
+        StreamingFrame frame(inky_frame, std::move(source), overlays);
+        // non blocking: update() returns as soon as the refresh command has been sent
+        inky_frame.inky73.set_blocking(false);
+        inky_frame.inky73.update(&frame);
+        started = true;
+        return frame.complete();
+    }
+
+    void refresh_from_psram(InkyFrame &inky_frame, const overlays::OverlayList &overlays)
+    {
+        PSRamDisplay &psram = inky_frame.ramDisplay;
+        stream_to_panel(inky_frame, [&psram](int y, uint8_t *packed_row, size_t len)
+        {
+            // a pen per byte in PSRAM, two to a byte for the panel
+            static uint8_t pixels[board::WIDTH];
+            psram.read_pixel_span(Point(0, y), board::WIDTH, pixels);
+            for (size_t i = 0; i < len; i++)
+            {
+                packed_row[i] = (pixels[i * 2] << 4) | (pixels[i * 2 + 1] & 0x0f);
+            }
+            return true;
+        }, overlays);
+    }
+
+    bool refresh_started()
+    {
+        return started;
+    }
+
+    void wait_for_refresh(InkyFrame &inky_frame)
+    {
+        if (!started)
+        {
+            return;
+        }
+        // sleep_ms waits for the timer alarm in WFE rather than spinning
+        while (inky_frame.inky73.is_busy())
+        {
+            sleep_ms(BUSY_POLL_MS);
+        }
+        inky_frame.inky73.power_off();
+        started = false;
+    }
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "inky_frame_7.hpp"
+#include "overlays.hpp"
+
+namespace panel_stream
+{
+    // Fill one scanline of packed 4bpp pixels (high nibble is the left pixel).
+    // Returns false if the row could not be produced, e.g. the download was cut short.
+    using RowSource = std::function<bool(int y, uint8_t *packed_row, size_t len)>;
+
+    // A PicoGraphics that has no frame buffer of its own: when the Inky73 driver asks for
+    // the frame, rows are pulled from the source as they arrive and overlays are applied inline.
+    // This skips the PSRAM round trip entirely.
+    class StreamingFrame : public pimoroni::PicoGraphics_PenInky7
+    {
+    public:
+        StreamingFrame(pimoroni::InkyFrame &inky_frame, RowSource source, const overlays::OverlayList &overlays);
+
+        void frame_convert(PenType type, conversion_callback_func callback) override;
+
+        // true if every row came from the source
+        bool complete() const { return rows_failed == 0; }
+
+    private:
+        RowSource source;
+        const overlays::OverlayList &overlays;
+        int rows_failed = 0;
+    };
+
+    // Push a whole frame into the panel and start the refresh.
+    // Returns once the refresh has started, see wait_for_refresh.
+    bool stream_to_panel(pimoroni::InkyFrame &inky_frame, RowSource source, const overlays::OverlayList &overlays);
+
+    // Send the frame in PSRAM to the panel with the overlays composited on the way out, and
+    // start the refresh. PSRAM is left as it was, so it can be saved while the panel refreshes.
+    void refresh_from_psram(pimoroni::InkyFrame &inky_frame, const overlays::OverlayList &overlays);
+
+    // true once stream_to_panel has sent a frame, even an incomplete one
+    bool refresh_started();
+
+    // Sleep until the panel has finished refreshing then power it off.
+    // Does nothing if no refresh was started.
+    void wait_for_refresh(pimoroni::InkyFrame &inky_frame);
+
+}
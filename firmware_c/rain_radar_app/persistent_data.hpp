@@ -1,44 +1,147 @@
 #pragma once
 
 #include <stdio.h>
+#include <string.h>
 #include "pico/stdlib.h"
 #include "hardware/flash.h" // for the flash erasing and writing
 #include "hardware/sync.h"  // for the interrupts
+#include "core1_tasks.hpp"
 
 #define FLASH_TARGET_OFFSET (1536 * 1024) // choosing to start at 1.5MB into flash, so we don't overwrite the program
 
 namespace persistent
 {
+    constexpr uint32_t MAGIC = 0x50445252; // "RRDP"
+    // bump when PersistentData changes, older data is ignored
+    constexpr uint16_t VERSION = 3;
+
+    constexpr int MAX_SSIDS = 6;
+    // the day in quarters, which networks are around depends on where the frame is
+    constexpr int TIME_BUCKETS = 4;
+
+    // How a known network has done in one quarter of the day, see ssid_stats
+    struct SsidStats
+    {
+        uint16_t connect_ms;          // EWMA of the time to join, when it joined
+        uint16_t kbytes_per_s;        // EWMA of the body throughput through it, 0 until measured
+        uint8_t success;              // EWMA of the joins that worked, 255 is all of them
+        uint8_t attempts;             // up to 255, how far to trust the above
+        uint8_t consecutive_failures;
+        uint8_t backoff_wakes;        // wakes left before it's tried in its usual place again
+    };
+
+    // The server's address from the last lookup, see dns_cache
+    struct DnsEntry
+    {
+        uint32_t host_crc;    // of the name it's for, so a new HOST doesn't get the old address
+        uint32_t addr;        // IPv4, as lwIP keeps it, 0 for none
+        uint32_t resolved_at; // unix seconds
+    };
+
+    // How the RTC keeps time between server syncs, see clock_model
+    struct ClockStats
+    {
+        uint32_t set_at;    // unix seconds the RTC was last set from the server, 0 never
+        int32_t drift_ppb;  // how fast it runs, EWMA of the measurements, + is fast
+        uint8_t samples;    // up to 255, 0 until it's been measured
+        uint8_t reserved[3];
+    };
 
     struct PersistentData
     {
-        int8_t wifi_preferred_ssid_index; // index into the known SSIDs array
+        uint32_t magic;
+        uint16_t version;
+        uint8_t fetch_failures; // in a row, for the backoff in schedule
+        uint8_t reserved;
+        SsidStats ssid_stats[MAX_SSIDS][TIME_BUCKETS];
+        DnsEntry dns;
+        ClockStats clock;
     };
 
-    void save(PersistentData *myData)
+    // Each save goes in the next empty page of the sector, so it's only erased once every
+    // PAGES_PER_SECTOR saves. The stats change every wake that uses the radio.
+    static_assert(sizeof(PersistentData) <= FLASH_PAGE_SIZE, "PersistentData has to fit in a flash page");
+    constexpr uint32_t PAGES_PER_SECTOR = FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE;
+
+    inline const uint8_t *page_contents(uint32_t page)
+    {
+        return (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET + page * FLASH_PAGE_SIZE);
+    }
+
+    inline bool page_erased(uint32_t page)
+    {
+        const uint8_t *contents = page_contents(page);
+        for (uint32_t i = 0; i < sizeof(PersistentData); i++)
+        {
+            if (contents[i] != 0xFF)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline void save(PersistentData *myData)
     {
         if (!myData)
             return;
 
-        uint8_t *myDataAsBytes = (uint8_t *)myData;
-        size_t myDataSize = sizeof(*myData);
+        myData->magic = MAGIC;
+        myData->version = VERSION;
+
+        // flash is programmed a whole page at a time
+        static uint8_t page[FLASH_PAGE_SIZE];
+        memset(page, 0xFF, sizeof(page));
+        memcpy(page, myData, sizeof(*myData));
 
-        printf("Programming flash target region...\n");
+        uint32_t next = 0;
+        while (next < PAGES_PER_SECTOR && !page_erased(next))
+        {
+            next++;
+        }
+        bool const erase = next == PAGES_PER_SECTOR;
+        if (erase)
+        {
+            next = 0;
+        }
 
+        printf("Programming flash target region, page %lu...\n", next);
+
+        core1_tasks::FlashLockout lockout; // core1 can't be running from flash either
         uint32_t interrupts = save_and_disable_interrupts();
-        flash_range_erase(FLASH_TARGET_OFFSET, FLASH_PAGE_SIZE);             // erase 1 page
-        flash_range_program(FLASH_TARGET_OFFSET, myDataAsBytes, myDataSize); // write struct
+        if (erase)
+        {
+            flash_range_erase(FLASH_TARGET_OFFSET, FLASH_SECTOR_SIZE); // the sector is full, start again
+        }
+        flash_range_program(FLASH_TARGET_OFFSET + next * FLASH_PAGE_SIZE, page, FLASH_PAGE_SIZE);
         restore_interrupts(interrupts);
 
         printf("Done.\n");
     }
 
-    PersistentData read()
+    inline PersistentData read()
     {
-        PersistentData myData{
-            .wifi_preferred_ssid_index = 0};
-        const uint8_t *flash_target_contents = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET);
-        memcpy(&myData, flash_target_contents, sizeof(myData));
+        PersistentData myData;
+        memset(&myData, 0, sizeof(myData));
+        myData.magic = MAGIC;
+        myData.version = VERSION;
+
+        // the newest is the last one written before the empty pages
+        for (uint32_t page = PAGES_PER_SECTOR; page-- > 0;)
+        {
+            PersistentData stored;
+            memcpy(&stored, page_contents(page), sizeof(stored));
+            if (stored.magic == MAGIC && stored.version == VERSION)
+            {
+                return stored;
+            }
+            if (!page_erased(page))
+            {
+                // something older, or not ours
+                break;
+            }
+        }
+        printf("No persistent data, starting afresh\n");
         return myData;
     }
 
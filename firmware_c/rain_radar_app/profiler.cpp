@@ -0,0 +1,150 @@
+#include "profiler.hpp"
+
+#include <cstdio>
+#include <malloc.h>
+#include "pico/stdlib.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "hardware/sync.h"
+#include "clock_governor.hpp"
+#include "tls_arena.hpp"
+
+namespace profiler
+{
+    namespace
+    {
+        constexpr size_t NUM_PHASES = (size_t)Phase::COUNT;
+
+        const char *const PHASE_NAMES[NUM_PHASES] = {
+            "boot",
+            "wifi_connect",
+            "fetch",
+            "dither",
+            "overlays",
+            "sd_cache",
+            "panel_refresh",
+            "radio_on",
+        };
+
+        // Rough VSYS current for the energy estimate, from the datasheets rather than
+        // measured on this board. The CPU's depends on the clock level, the radio's and the
+        // panel's are on top of it while they're up.
+        constexpr float VSYS_VOLTS = 3.7f;
+        constexpr float CLOCK_LEVEL_MA[(size_t)clock_governor::Level::COUNT] = {
+            8.0f,  // IDLE
+            20.0f, // RADIO
+            30.0f, // FAST
+        };
+        constexpr float RADIO_ON_MA = 45.0f;
+        constexpr float PANEL_REFRESH_MA = 12.0f;
+
+        uint64_t started_us[NUM_PHASES] = {0};
+        uint64_t total_us[NUM_PHASES] = {0};
+        uint64_t app_start_us = 0;
+
+        XipCounts started_xip[NUM_PHASES];
+        XipCounts total_xip[NUM_PHASES];
+        size_t tls_peak[NUM_PHASES] = {0};
+
+        // The hardware counters saturate at 32 bits, around half a minute of misses at full
+        // clock, so they're folded into these and cleared at every begin and end
+        XipCounts xip;
+        spin_lock_t *xip_lock = nullptr;
+
+        XipCounts sample_xip()
+        {
+            if (!xip_lock)
+            {
+                // first used from core0 at boot, before core1 is running
+                xip_lock = spin_lock_init(spin_lock_claim_unused(true));
+            }
+            uint32_t const irq = spin_lock_blocking(xip_lock);
+            xip.hits += xip_ctrl_hw->ctr_hit;
+            xip.accesses += xip_ctrl_hw->ctr_acc;
+            // any write clears them
+            xip_ctrl_hw->ctr_hit = 0;
+            xip_ctrl_hw->ctr_acc = 0;
+            XipCounts const now = xip;
+            spin_unlock(xip_lock, irq);
+            return now;
+        }
+
+        // the TLS arena's peak since the last sample goes to every phase that's running
+        void sample_tls_peak()
+        {
+            size_t const peak = tls_arena::take_peak();
+            for (size_t i = 0; i < NUM_PHASES; i++)
+            {
+                if (started_us[i])
+                {
+                    tls_peak[i] = MAX(tls_peak[i], peak);
+                }
+            }
+        }
+    }
+
+    void begin(Phase phase)
+    {
+        started_xip[(size_t)phase] = sample_xip();
+        sample_tls_peak();
+        started_us[(size_t)phase] = time_us_64();
+    }
+
+    void end(Phase phase)
+    {
+        size_t const i = (size_t)phase;
+        if (started_us[i])
+        {
+            total_us[i] += time_us_64() - started_us[i];
+            sample_tls_peak();
+            started_us[i] = 0;
+            XipCounts const now = sample_xip();
+            total_xip[i].accesses += now.accesses - started_xip[i].accesses;
+            total_xip[i].hits += now.hits - started_xip[i].hits;
+        }
+    }
+
+    uint64_t duration_us(Phase phase)
+    {
+        return total_us[(size_t)phase];
+    }
+
+    XipCounts xip_counts()
+    {
+        return sample_xip();
+    }
+
+    void mark_app_start()
+    {
+        app_start_us = time_us_64();
+    }
+
+    void report()
+    {
+        printf("phase,ms,xip_accesses,xip_misses,tls_peak_bytes\n");
+        for (size_t i = 0; i < NUM_PHASES; i++)
+        {
+            printf("%s,%llu.%03llu,%llu,%llu,%u\n", PHASE_NAMES[i], total_us[i] / 1000, total_us[i] % 1000,
+                   total_xip[i].accesses, total_xip[i].misses(), (unsigned)tls_peak[i]);
+        }
+        printf("boot_to_app,%llu.%03llu\n", app_start_us / 1000, app_start_us % 1000);
+        printf("awake,%llu\n", time_us_64() / 1000);
+        // newlib never gives memory back to sbrk, so this is the most the heap has been
+        printf("heap_bytes,%u\n", (unsigned)mallinfo().arena);
+        printf("tls_arena_bytes,%u\n", (unsigned)tls_arena::size());
+
+        // mA * us * V = nJ
+        float energy_nj = 0;
+        for (size_t i = 0; i < (size_t)clock_governor::Level::COUNT; i++)
+        {
+            clock_governor::Level const level = (clock_governor::Level)i;
+            uint64_t const us = clock_governor::duration_us(level);
+            printf("clock_%lu_khz,%llu\n", clock_governor::khz(level), us / 1000);
+            energy_nj += CLOCK_LEVEL_MA[i] * us;
+        }
+        energy_nj += RADIO_ON_MA * total_us[(size_t)Phase::RADIO_ON];
+        energy_nj += PANEL_REFRESH_MA * total_us[(size_t)Phase::PANEL_REFRESH];
+        energy_nj *= VSYS_VOLTS;
+        printf("energy_mj,%.1f\n", energy_nj / 1e6f);
+    }
+
+}
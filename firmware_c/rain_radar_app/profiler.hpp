@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+// Wall clock timing of the phases of a wake cycle, printed as one table at the end.
+namespace profiler
+{
+    enum class Phase : uint8_t
+    {
+        BOOT, // boot::run, overlaps WIFI_CONNECT once the radio has started
+        WIFI_CONNECT,
+        FETCH,
+        DITHER, // inside FETCH, dithering the rain grid and writing it to PSRAM
+        OVERLAYS,
+        SD_CACHE,
+        PANEL_REFRESH,
+        RADIO_ON, // cyw43 powered, from before WIFI_CONNECT to network_deinit
+        COUNT
+    };
+
+    void begin(Phase phase);
+    void end(Phase phase);
+
+    // total time spent in the phase so far, phases can be entered more than once
+    uint64_t duration_us(Phase phase);
+
+    // The XIP cache's counters since boot, for both cores together. Flash reads that miss
+    // stall the core for the QSPI transfer, and the cyw43 driver's code is fighting ours
+    // for the 16 KB of cache while the radio's up. Each phase in the report gets its share.
+    struct XipCounts
+    {
+        uint64_t accesses = 0;
+        uint64_t hits = 0;
+
+        uint64_t misses() const { return accesses - hits; }
+    };
+    XipCounts xip_counts();
+
+    // End of boot, the time from reset to here is reported as boot_to_app. Includes the
+    // bootrom and the runtime's init before main, as the timer starts counting at reset.
+    void mark_app_start();
+
+    void report();
+
+    // times the enclosing block
+    class Scope
+    {
+    public:
+        explicit Scope(Phase phase) : phase(phase) { begin(phase); }
+        ~Scope() { end(phase); }
+
+    private:
+        Phase const phase;
+    };
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+
+// Which version of the frame to ask the server for. A frame on a poor link or a low battery
+// asks for a smaller one, so it spends less time with the radio on, and the rest get the
+// full frame. The server publishes each tier as its own frame container.
+namespace quality_tier
+{
+    enum class Tier : uint8_t
+    {
+        // all 7 colours at the panel's resolution
+        FULL,
+        // black, white, blue and red, 2 bits per pixel
+        REDUCED,
+        // half the resolution each way, doubled up on the device
+        HALF,
+    };
+
+    // What's known about the link and the battery when it's time to fetch
+    struct Conditions
+    {
+        // this wake's, 0 if cyw43 couldn't say
+        int32_t rssi;
+        // how fast frames have come through this network at this time of day, 0 if unknown
+        uint16_t kbytes_per_s;
+        // -1 if unknown
+        int battery_percent;
+        bool usb_powered;
+    };
+
+    constexpr int32_t GOOD_RSSI = -67;
+    constexpr int32_t WEAK_RSSI = -80;
+    constexpr uint16_t GOOD_KBYTES_PER_S = 40;
+    constexpr uint16_t WEAK_KBYTES_PER_S = 12;
+    constexpr int LOW_BATTERY_PERCENT = 40;
+    constexpr int CRITICAL_BATTERY_PERCENT = 15;
+
+    // 0 for a good link, 2 for a weak one. Either number being poor is enough.
+    inline int link_penalty(const Conditions &c)
+    {
+        bool const weak_rssi = c.rssi != 0 && c.rssi < WEAK_RSSI;
+        bool const weak_throughput = c.kbytes_per_s != 0 && c.kbytes_per_s < WEAK_KBYTES_PER_S;
+        if (weak_rssi || weak_throughput)
+        {
+            return 2;
+        }
+        bool const good_rssi = c.rssi == 0 || c.rssi >= GOOD_RSSI;
+        bool const good_throughput = c.kbytes_per_s == 0 || c.kbytes_per_s >= GOOD_KBYTES_PER_S;
+        return good_rssi && good_throughput ? 0 : 1;
+    }
+
+    // 0 on USB or with plenty left, 2 when nearly flat
+    inline int battery_penalty(const Conditions &c)
+    {
+        if (c.usb_powered || c.battery_percent < 0)
+        {
+            return 0;
+        }
+        if (c.battery_percent < CRITICAL_BATTERY_PERCENT)
+        {
+            return 2;
+        }
+        return c.battery_percent < LOW_BATTERY_PERCENT ? 1 : 0;
+    }
+
+    // A middling link or battery on its own still gets the full frame, a weak link or a
+    // nearly flat battery, or both being middling, the reduced one, and worse than that half
+    inline Tier choose(const Conditions &c)
+    {
+        int const penalty = link_penalty(c) + battery_penalty(c);
+        if (penalty >= 3)
+        {
+            return Tier::HALF;
+        }
+        return penalty == 2 ? Tier::REDUCED : Tier::FULL;
+    }
+
+    inline const char *file(Tier tier)
+    {
+        switch (tier)
+        {
+        case Tier::REDUCED:
+            return "frame_reduced.bin";
+        case Tier::HALF:
+            return "frame_half.bin";
+        default:
+            return "frame.bin";
+        }
+    }
+
+    inline const char *name(Tier tier)
+    {
+        switch (tier)
+        {
+        case Tier::REDUCED:
+            return "reduced";
+        case Tier::HALF:
+            return "half";
+        default:
+            return "full";
+        }
+    }
+}
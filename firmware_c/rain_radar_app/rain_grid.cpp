@@ -0,0 +1,99 @@
+#include "rain_grid.hpp"
+
+#include <cstdio>
+#include "pico/stdlib.h"
+#include "pico/util/queue.h"
+#include "basemap.hpp"
+#include "board.hpp"
+#include "core1_tasks.hpp"
+#include "dither.hpp"
+#include "rain_stats.hpp"
+
+using namespace pimoroni;
+
+namespace rain_grid
+{
+    namespace
+    {
+        // rows in flight between the cores
+        constexpr uint8_t NUM_SLOTS = 4;
+
+        uint8_t slots[NUM_SLOTS][board::WIDTH];
+        queue_t free_slots;
+        queue_t ready_slots;
+        bool queues_ready = false;
+
+        // lives here rather than on core1's small stack
+        dither::PanelDitherer ditherer;
+
+        // core1: dither rows into whichever slots core0 has finished with
+        void dither_rows(__unused void *arg)
+        {
+            while (true)
+            {
+                uint8_t slot;
+                queue_remove_blocking(&free_slots, &slot);
+                if (!ditherer.next_row(slots[slot]))
+                {
+                    break;
+                }
+                queue_add_blocking(&ready_slots, &slot);
+            }
+        }
+    }
+
+    Err render(PSRamDisplay &psram, const uint8_t *grid, int grid_width, int grid_height)
+    {
+        if (grid_width <= 0 || grid_height <= 0)
+        {
+            return Err::INVALID_ARGUMENT;
+        }
+        if (!basemap::stored_version(board::WIDTH, board::HEIGHT))
+        {
+            return Err::BASEMAP_OUT_OF_DATE;
+        }
+
+        uint8_t slot;
+        if (!queues_ready)
+        {
+            queue_init(&free_slots, sizeof(slot), NUM_SLOTS);
+            queue_init(&ready_slots, sizeof(slot), NUM_SLOTS);
+            queues_ready = true;
+        }
+        // core1 leaves the slots it didn't need last time in the queue
+        while (queue_try_remove(&free_slots, &slot))
+        {
+        }
+        for (slot = 0; slot < NUM_SLOTS; slot++)
+        {
+            queue_add_blocking(&free_slots, &slot);
+        }
+
+        ditherer.begin(grid, grid_width, grid_height);
+        core1_tasks::run(dither_rows, nullptr);
+
+        static uint8_t row[board::WIDTH];
+        rain_stats::begin();
+        for (int y = 0; y < board::HEIGHT; y++)
+        {
+            queue_remove_blocking(&ready_slots, &slot);
+            basemap::load_row(y, row);
+            const uint8_t *rain = slots[slot];
+            // rain dithered to the basemap's colour is still rain
+            rain_stats::add_span(y, 0, rain, nullptr, board::WIDTH);
+            for (int x = 0; x < board::WIDTH; x++)
+            {
+                if (rain[x] != dither::TRANSPARENT)
+                {
+                    row[x] = rain[x];
+                }
+            }
+            // hand the slot back before the SPI write so core1 keeps going meanwhile
+            queue_add_blocking(&free_slots, &slot);
+            psram.write_span(y * board::WIDTH, board::WIDTH, row);
+        }
+        core1_tasks::wait();
+        return Err::OK;
+    }
+
+}
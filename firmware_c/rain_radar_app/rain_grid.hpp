@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+#include "psram_display.hpp"
+#include "rain_radar_common.hpp"
+
+// Draws a low resolution grid of rain intensities over the basemap in PSRAM.
+// Core1 dithers rows while core0 merges them with the basemap and writes them out.
+namespace rain_grid
+{
+    // Scales it to the whole panel. The basemap in flash must be current before calling this.
+    Err render(pimoroni::PSRamDisplay &psram, const uint8_t *grid, int grid_width, int grid_height);
+}
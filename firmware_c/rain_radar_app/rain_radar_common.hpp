@@ -4,6 +4,15 @@
 #include <cstdio>
 #include <string_view>
 #include <cassert>
+#include "pico/platform.h"
+
+// Functions on the receive path run from SRAM rather than through the XIP cache, which the
+// cyw43 driver and lwIP are thrashing at the same time. See RAIN_RADAR_RAM_HOT_PATHS.
+#if RAIN_RADAR_RAM_HOT_PATHS
+#define HOT_PATH(func) __not_in_flash_func(func)
+#else
+#define HOT_PATH(func) func
+#endif
 
 enum class Err : int8_t
 {
@@ -39,7 +48,8 @@ enum class Err : int8_t
     HTTP_SERVER_ERROR = -23,          // Other 5xx codes
     HTTP_UNKNOWN_ERROR = -24,         // Unrecognized HTTP status
 
-    COULDNT_PARSE_DATE = -25
+    COULDNT_PARSE_DATE = -25,
+    BASEMAP_OUT_OF_DATE = -26
 };
 
 constexpr std::string_view errToString(Err r)
@@ -98,6 +108,8 @@ constexpr std::string_view errToString(Err r)
         return "HTTP_UNKNOWN_ERROR";
     case Err::COULDNT_PARSE_DATE:
         return "COULDNT_PARSE_DATE";
+    case Err::BASEMAP_OUT_OF_DATE:
+        return "BASEMAP_OUT_OF_DATE";
     default:
         return "UNKNOWN";
     }
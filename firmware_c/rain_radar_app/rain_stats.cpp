@@ -0,0 +1,143 @@
+#include "rain_stats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include "basemap.hpp"
+#include "rain_radar_common.hpp"
+#include "secrets.h"
+
+namespace rain_stats
+{
+    namespace
+    {
+        // Inky73::BLACK, what the server's colour ramp starts from, so never rain
+        constexpr uint8_t BLACK = 0;
+        constexpr int RAIN_ROWS = board::HEIGHT - CAPTION_ROWS;
+        constexpr size_t POI_COUNT = std::min(MAX_POIS, sizeof(secrets::POINTS_OF_INTEREST_XY) / sizeof(secrets::POINTS_OF_INTEREST_XY[0]));
+
+        // how far either side of a point the circle reaches, dy rows above or below it
+        constexpr std::array<int16_t, NEAR_RADIUS + 1> half_widths()
+        {
+            std::array<int16_t, NEAR_RADIUS + 1> widths = {};
+            for (int dy = 0; dy <= NEAR_RADIUS; dy++)
+            {
+                int dx = NEAR_RADIUS;
+                while (dx * dx + dy * dy > NEAR_RADIUS * NEAR_RADIUS)
+                {
+                    dx--;
+                }
+                widths[dy] = (int16_t)dx;
+            }
+            return widths;
+        }
+        constexpr std::array<int16_t, NEAR_RADIUS + 1> HALF_WIDTHS = half_widths();
+
+        Summary stats;
+
+        // the columns each point's circle covers on row near_y, none if near_x0 > near_x1
+        int near_y = -1;
+        int16_t near_x0[MAX_POIS];
+        int16_t near_x1[MAX_POIS];
+
+        // the basemap under the row add_pixels is part way through
+        int base_y = -1;
+        uint8_t base_row[board::WIDTH];
+        uint8_t unpacked_row[board::WIDTH];
+
+        void set_near_row(int y)
+        {
+            for (size_t i = 0; i < POI_COUNT; i++)
+            {
+                int const dy = std::abs(y - secrets::POINTS_OF_INTEREST_XY[i][1]);
+                int const x = secrets::POINTS_OF_INTEREST_XY[i][0];
+                near_x0[i] = dy <= NEAR_RADIUS ? (int16_t)(x - HALF_WIDTHS[dy]) : 1;
+                near_x1[i] = dy <= NEAR_RADIUS ? (int16_t)(x + HALF_WIDTHS[dy]) : 0;
+            }
+            near_y = y;
+        }
+    }
+
+    void begin()
+    {
+        stats = Summary();
+        stats.valid = basemap::stored_version(board::WIDTH, board::HEIGHT) != 0;
+        stats.poi_count = (uint8_t)POI_COUNT;
+        near_y = -1;
+        base_y = -1;
+    }
+
+    void reset()
+    {
+        stats = Summary();
+    }
+
+    void HOT_PATH(add_span)(int y, int x, const uint8_t *pixels, const uint8_t *base, size_t len)
+    {
+        if (!stats.valid || y >= RAIN_ROWS)
+        {
+            return;
+        }
+        if (y != near_y)
+        {
+            set_near_row(y);
+        }
+        for (size_t i = 0; i < len; i++)
+        {
+            uint8_t const p = pixels[i];
+            if ((base && p == base[i]) || p == BLACK || p >= board::ACTIVE.colours)
+            {
+                continue;
+            }
+            stats.rain_pixels++;
+            stats.by_colour[p]++;
+            int const px = x + (int)i;
+            for (size_t poi = 0; poi < POI_COUNT; poi++)
+            {
+                if (px >= near_x0[poi] && px <= near_x1[poi] && stats.near_poi[poi] < UINT16_MAX)
+                {
+                    stats.near_poi[poi]++;
+                }
+            }
+        }
+    }
+
+    void HOT_PATH(add_pixels)(size_t offset, const uint8_t *pixels, size_t len)
+    {
+        while (stats.valid && len)
+        {
+            int const y = offset / board::WIDTH;
+            int const x = offset % board::WIDTH;
+            size_t const n = std::min<size_t>(len, board::WIDTH - x);
+            if (y >= RAIN_ROWS)
+            {
+                return;
+            }
+            if (y != base_y)
+            {
+                basemap::load_row(y, base_row);
+                base_y = y;
+            }
+            add_span(y, x, pixels, base_row + x, n);
+            offset += n;
+            pixels += n;
+            len -= n;
+        }
+    }
+
+    void add_packed_row(int y, const uint8_t *packed, size_t len)
+    {
+        len = std::min<size_t>(len, board::WIDTH / 2);
+        for (size_t i = 0; i < len; i++)
+        {
+            unpacked_row[i * 2] = packed[i] >> 4;
+            unpacked_row[i * 2 + 1] = packed[i] & 0x0F;
+        }
+        add_pixels((size_t)y * board::WIDTH, unpacked_row, len * 2);
+    }
+
+    const Summary &summary()
+    {
+        return stats;
+    }
+}
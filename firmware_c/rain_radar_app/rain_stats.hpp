@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "board.hpp"
+
+#ifndef RAIN_RADAR_RAIN_NEAR_KM
+#define RAIN_RADAR_RAIN_NEAR_KM 5
+#endif
+
+// Counts the rain in a frame as each fetch path writes it to PSRAM, from the pixels it
+// already has in hand, so nothing is read back. A pixel is rain if it's a colour and isn't
+// the basemap's, so it needs the basemap in flash. That only holds because the server puts
+// every pixel outside the rain back to the quantized basemap's after dithering (see quantize
+// in server/main.py), where the rain is the dBZ it draws at all. The device-dithered grid
+// knows its rain without the basemap. Gives how much of each colour there is, which is how
+// heavy, and how much falls within RAIN_RADAR_RAIN_NEAR_KM of each of
+// secrets::POINTS_OF_INTEREST_XY.
+namespace rain_stats
+{
+    constexpr size_t MAX_POIS = 8;
+    // the server's map, zoom 7 tiles of the UK cropped and scaled up to 800x480
+    constexpr float KM_PER_PIXEL = 0.34f;
+    constexpr int NEAR_RADIUS = (int)(RAIN_RADAR_RAIN_NEAR_KM / KM_PER_PIXEL + 0.5f);
+    // the server draws the legend and the caption along the bottom
+    constexpr int CAPTION_ROWS = 32;
+    // less than this near a point is the ragged edge of a shower just outside the circle
+    constexpr uint16_t NEAR_MIN_PIXELS = 8;
+
+    struct Summary
+    {
+        // false if there's no frame, or no basemap to tell the rain from
+        bool valid = false;
+        uint32_t rain_pixels = 0;
+        // by palette index, green the lightest up through blue, yellow, orange, red to white
+        uint32_t by_colour[8] = {};
+        uint8_t poi_count = 0;
+        // rain pixels within NEAR_RADIUS of each point
+        uint16_t near_poi[MAX_POIS] = {};
+
+        bool rain_near(size_t poi) const { return near_poi[poi] >= NEAR_MIN_PIXELS; }
+
+        bool rain_near_any() const
+        {
+            for (size_t i = 0; i < poi_count; i++)
+            {
+                if (rain_near(i))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    // A new frame is about to be written. Each fetch path calls it before its first pixel.
+    void begin();
+    // The frame being written can't be compared with the basemap, or there isn't one
+    void reset();
+
+    // pixels at offset in the frame, a palette index each. Reads the basemap from flash
+    // a row at a time to compare with.
+    void add_pixels(size_t offset, const uint8_t *pixels, size_t len);
+    // Part of row y where whoever's writing it already has the basemap under it in base, or
+    // null if every pixel is rain bar the ones past the palette, like dither::TRANSPARENT.
+    // Those are never rain either way.
+    void add_span(int y, int x, const uint8_t *pixels, const uint8_t *base, size_t len);
+    // A whole row two pixels a byte, high nibble first, len bytes of it
+    void add_packed_row(int y, const uint8_t *packed, size_t len);
+
+    const Summary &summary();
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// When to wake up next. All of it works in seconds since midnight, as the RTC alarm only
+// matches on the time of day, so host_tools/fleet_sim can run it as is.
+//
+// Every frame in the fleet used to wake on the same 10 minute boundary and hit the server
+// in the same second. Each device now wakes a fixed number of seconds after the boundary,
+// worked out from its board id, so the requests spread over the jitter window but each
+// device's stay 10 minutes apart.
+namespace schedule
+{
+    // the rain api updates every 10 mins, and the server runs on a 10 min schedule
+    constexpr uint32_t INTERVAL_S = 10 * 60;
+    constexpr uint32_t DAY_S = 24 * 60 * 60;
+    // no updates overnight, the first one is at 06:00
+    constexpr int NIGHT_START_HOUR = 23;
+    constexpr int NIGHT_END_HOUR = 6;
+    // a failed fetch tries again after 1, 2, 4, 8 then every 10 mins
+    constexpr uint32_t FIRST_BACKOFF_S = 60;
+    // the longest a Retry-After from the server is followed for
+    constexpr uint32_t MAX_RETRY_AFTER_S = 60 * 60;
+    // with no rain anywhere on the map there's little for the next frame to change, so a
+    // dry frame waits this many intervals. Rain coming in off the edge is a frame late.
+    constexpr uint32_t DRY_INTERVALS = 3;
+
+    // hour is -1 for whichever hour the minute and second come round in first
+    struct Wake
+    {
+        int hour;
+        int minute;
+        int second;
+    };
+
+    inline uint32_t time_of_day(int hour, int minute, int second)
+    {
+        return (uint32_t)(hour * 3600 + minute * 60 + second);
+    }
+
+    // Seconds after each boundary this device wakes, from FNV-1a of its id so it's the
+    // same every wake and spread evenly across devices. Under one interval.
+    inline uint32_t jitter_s(const uint8_t *id, size_t len, uint32_t window_s)
+    {
+        if (window_s == 0)
+        {
+            return 0;
+        }
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < len; i++)
+        {
+            hash = (hash ^ id[i]) * 16777619u;
+        }
+        uint32_t const window = window_s < INTERVAL_S ? window_s : INTERVAL_S - 1;
+        return hash % (window + 1);
+    }
+
+    // The next update after a good fetch at now: the boundary after next if this one is
+    // less than a minute away, then this device's jitter on top. intervals more than 1
+    // skips that many less one boundaries, up to 4.
+    inline Wake next_update(uint32_t now_s, uint32_t jitter, uint32_t intervals = 1)
+    {
+        int const hour = now_s / 3600;
+        if (hour >= NIGHT_START_HOUR || hour < NIGHT_END_HOUR)
+        {
+            return {NIGHT_END_HOUR, (int)(jitter / 60), (int)(jitter % 60)};
+        }
+        int const minute = (now_s / 60) % 60;
+        uint32_t const boundary_min = (minute + 1 + 10) / 10 * 10 + (intervals - 1) * 10;
+        uint32_t const wake_s = boundary_min * 60 + jitter;
+        return {-1, (int)(wake_s / 60) % 60, (int)(wake_s % 60)};
+    }
+
+    // When the server's said its next frame is publish_in_s from now, this device's jitter
+    // after that. Without a hint, or with one that's more than a couple of intervals off or
+    // lands overnight, the usual next_update.
+    inline Wake after_publish(uint32_t now_s, uint32_t publish_in_s, uint32_t jitter)
+    {
+        if (publish_in_s == 0 || publish_in_s > 2 * INTERVAL_S)
+        {
+            return next_update(now_s, jitter);
+        }
+        uint32_t const wake_s = (now_s + publish_in_s + jitter) % DAY_S;
+        int const hour = wake_s / 3600;
+        if (hour >= NIGHT_START_HOUR || hour < NIGHT_END_HOUR)
+        {
+            return next_update(now_s, jitter);
+        }
+        return {hour, (int)(wake_s / 60) % 60, (int)(wake_s % 60)};
+    }
+
+    // How long to wait after failures in a row (1 for the first), at least as long as the
+    // server asked for in a Retry-After, 0 if it didn't
+    inline uint32_t backoff_s(uint8_t failures, uint32_t retry_after_s)
+    {
+        uint32_t const doublings = failures > 1 ? failures - 1 : 0;
+        uint32_t delay = doublings < 4 ? FIRST_BACKOFF_S << doublings : INTERVAL_S;
+        if (delay > INTERVAL_S)
+        {
+            delay = INTERVAL_S;
+        }
+        uint32_t const asked = retry_after_s < MAX_RETRY_AFTER_S ? retry_after_s : MAX_RETRY_AFTER_S;
+        return delay > asked ? delay : asked;
+    }
+
+    // A retry delay_s after now, with the device's jitter so the retries spread out too
+    inline Wake retry(uint32_t now_s, uint32_t delay_s, uint32_t jitter)
+    {
+        uint32_t const wake_s = (now_s + delay_s + jitter) % DAY_S;
+        return {(int)(wake_s / 3600), (int)(wake_s / 60) % 60, (int)(wake_s % 60)};
+    }
+
+    // How long from now until the alarm for wake goes off
+    inline uint32_t seconds_until(uint32_t now_s, const Wake &wake)
+    {
+        uint32_t const period = wake.hour < 0 ? 3600 : DAY_S;
+        uint32_t const from = wake.hour < 0 ? now_s % 3600 : now_s;
+        uint32_t const at = time_of_day(wake.hour < 0 ? 0 : wake.hour, wake.minute, wake.second);
+        // an alarm for this very second has already been missed
+        return at > from ? at - from : at + period - from;
+    }
+
+    // wake as planned at planned_s, unless it's already gone by at now_s, which would
+    // mean sleeping for an hour or a day. Then a minute from now instead.
+    inline Wake still_ahead(const Wake &wake, uint32_t planned_s, uint32_t now_s)
+    {
+        uint32_t const elapsed = (now_s + DAY_S - planned_s) % DAY_S;
+        if (elapsed < seconds_until(planned_s, wake))
+        {
+            return wake;
+        }
+        return retry(now_s, FIRST_BACKOFF_S, 0);
+    }
+}
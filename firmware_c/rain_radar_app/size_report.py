@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Flash and RAM used per module, from the linker's map file.
+
+usage: size_report.py rain_radar.elf.map [--flash-budget-kb N] [--ram-budget-kb N]
+
+Exits 1 if the totals are over either budget, so the build target fails. The heap isn't
+in the map: it's whatever RAM is left over, and the firmware prints the most it used
+(heap_bytes in the profiler table).
+"""
+
+import argparse
+import os
+import re
+import sys
+from collections import defaultdict
+
+FLASH = (0x10000000, 0x11000000)
+RAM = (0x20000000, 0x20042000)
+
+# input sections in RAM that aren't copied there from flash at boot
+NOT_COPIED = (".bss", "COMMON", ".heap", ".stack", ".uninitialized", ".scratch_x.stack", ".scratch_y.stack")
+
+SECTION_LINE = re.compile(r"^ (\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(.+)$")
+NAME_ONLY = re.compile(r"^ (\S+)$")
+CONTINUATION = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(.+)$")
+
+# where the next directory down names the component, outermost first
+COMPONENT_MARKERS = ("/rp2_common/", "/rp2040/", "/common/", "/lib/", "/drivers/", "/libraries/")
+
+
+def module_for(path):
+    """A short name for the object or archive a section came from."""
+    archive = re.match(r"(.*\.a)\((.*)\)$", path)
+    if archive:
+        return os.path.basename(archive.group(1))
+    rel = path.split(".dir/", 1)[-1]
+    if "/" not in rel:
+        # the app's own sources
+        return re.sub(r"\.(obj|o)$", "", rel)
+    top = "pimoroni" if "pimoroni" in rel else "pico-sdk" if "pico-sdk" in rel else None
+    for marker in COMPONENT_MARKERS:
+        if marker in rel:
+            component = rel.split(marker, 1)[1].split("/", 1)[0]
+            return f"{top}/{component}" if top else component
+    return os.path.dirname(rel)
+
+
+def in_range(addr, region):
+    return region[0] <= addr < region[1]
+
+
+def parse(map_path):
+    flash = defaultdict(int)
+    ram = defaultdict(int)
+    with open(map_path) as f:
+        lines = iter(f.read().splitlines())
+    for line in lines:
+        if line.startswith("Linker script and memory map"):
+            break
+
+    pending = None
+    for line in lines:
+        if pending:
+            m = CONTINUATION.match(line)
+            name, pending = pending, None
+            if not m:
+                continue
+            addr, size, path = int(m.group(1), 16), int(m.group(2), 16), m.group(3)
+        else:
+            m = SECTION_LINE.match(line)
+            if not m:
+                m = NAME_ONLY.match(line)
+                if m and m.group(1).startswith((".", "COMMON")):
+                    pending = m.group(1)
+                continue
+            name, addr, size, path = m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4)
+        if size == 0 or path.startswith("load address") or path.startswith("*fill*"):
+            continue
+        module = module_for(path.strip())
+        if in_range(addr, FLASH):
+            flash[module] += size
+        elif in_range(addr, RAM):
+            ram[module] += size
+            if not name.startswith(NOT_COPIED):
+                # initialised data and RAM functions are copied from flash
+                flash[module] += size
+    return flash, ram
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map")
+    parser.add_argument("--flash-budget-kb", type=float)
+    parser.add_argument("--ram-budget-kb", type=float)
+    parser.add_argument("--top", type=int, default=25, help="modules to list, the rest are summed")
+    args = parser.parse_args()
+
+    flash, ram = parse(args.map)
+    modules = sorted(set(flash) | set(ram), key=lambda m: -(flash[m] + ram[m]))
+    print(f"{'module':<36}{'flash':>10}{'ram':>10}")
+    for m in modules[: args.top]:
+        print(f"{m:<36}{flash[m]:>10}{ram[m]:>10}")
+    rest = modules[args.top:]
+    if rest:
+        print(f"{f'({len(rest)} more)':<36}{sum(flash[m] for m in rest):>10}{sum(ram[m] for m in rest):>10}")
+    total_flash = sum(flash.values())
+    total_ram = sum(ram.values())
+    print(f"{'total':<36}{total_flash:>10}{total_ram:>10}")
+
+    over = False
+    for what, total, budget in (("flash", total_flash, args.flash_budget_kb), ("ram", total_ram, args.ram_budget_kb)):
+        if budget is None:
+            continue
+        used_kb = total / 1024
+        print(f"{what}: {used_kb:.1f} of {budget:g} KB")
+        if used_kb > budget:
+            print(f"{what} is over budget by {used_kb - budget:.1f} KB", file=sys.stderr)
+            over = True
+    return 1 if over else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,166 @@
+#include "ssid_stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include "secrets.h"
+#include "time_util.hpp"
+
+namespace ssid_stats
+{
+    static_assert(secrets::NUM_KNOWN_SSIDS <= persistent::MAX_SSIDS, "not enough room for every known SSID's stats");
+
+    namespace
+    {
+        // a failed join costs wifi_setup's settle wait plus its timeout
+        constexpr float JOIN_TIMEOUT_MS = 12000.0f;
+        // what the frame is, a packed 4bpp 800x480
+        constexpr float FRAME_KBYTES = 192.0f;
+
+        // for networks we've no numbers for yet
+        constexpr float DEFAULT_SUCCESS = 0.5f;
+        constexpr float DEFAULT_CONNECT_MS = 4000.0f;
+        constexpr float DEFAULT_DOWNLOAD_MS = 1000.0f;
+        // a network that always fails still gets a finite score
+        constexpr float MIN_SUCCESS = 0.02f;
+
+        constexpr uint8_t MAX_BACKOFF_WAKES = 63;
+
+        // new = old + (sample - old) / 4, the first sample is taken as is
+        uint16_t ewma(uint16_t old, uint32_t sample, bool first)
+        {
+            sample = std::min<uint32_t>(sample, UINT16_MAX);
+            if (first)
+            {
+                return (uint16_t)sample;
+            }
+            return (uint16_t)((old * 3 + sample) / 4);
+        }
+
+        persistent::SsidStats *stats_for(persistent::PersistentData &data, int bucket, int8_t ssid)
+        {
+            if (ssid < 0 || ssid >= secrets::NUM_KNOWN_SSIDS || bucket < 0 || bucket >= persistent::TIME_BUCKETS)
+            {
+                return nullptr;
+            }
+            return &data.ssid_stats[ssid][bucket];
+        }
+
+        // expected ms until the frame is in if this network is tried first, over the chance it works
+        float score(const persistent::SsidStats &stats)
+        {
+            float const p = stats.attempts ? std::max(stats.success / 255.0f, MIN_SUCCESS) : DEFAULT_SUCCESS;
+            float const connect_ms = stats.success ? stats.connect_ms : DEFAULT_CONNECT_MS;
+            float const download_ms = stats.kbytes_per_s ? FRAME_KBYTES * 1000.0f / stats.kbytes_per_s : DEFAULT_DOWNLOAD_MS;
+            float const cost = p * (connect_ms + download_ms) + (1.0f - p) * JOIN_TIMEOUT_MS;
+            return cost / p;
+        }
+    }
+
+    int time_bucket(const datetime_t &dt)
+    {
+        if (!time_util::is_set(dt))
+        {
+            return 0;
+        }
+        return dt.hour * persistent::TIME_BUCKETS / 24;
+    }
+
+    int plan(persistent::PersistentData &data, int bucket, int8_t *order)
+    {
+        int const count = secrets::NUM_KNOWN_SSIDS;
+        float scores[persistent::MAX_SSIDS];
+        bool backed_off[persistent::MAX_SSIDS];
+        for (int8_t i = 0; i < count; i++)
+        {
+            persistent::SsidStats &stats = data.ssid_stats[i][bucket];
+            scores[i] = score(stats);
+            backed_off[i] = stats.backoff_wakes > 0;
+            if (backed_off[i])
+            {
+                stats.backoff_wakes--;
+            }
+            order[i] = i;
+        }
+        auto const sooner = [&](int8_t a, int8_t b)
+        {
+            if (backed_off[a] != backed_off[b])
+            {
+                return !backed_off[a];
+            }
+            return scores[a] < scores[b];
+        };
+        // stable so that ties keep the order in secrets.h
+        std::stable_sort(order, order + count, sooner);
+
+        for (int i = 0; i < count; i++)
+        {
+            int8_t const ssid = order[i];
+            printf("SSID %d: score %.0f ms%s\n", ssid, scores[ssid], backed_off[ssid] ? ", backed off" : "");
+        }
+        return count;
+    }
+
+    int default_order(int8_t *order)
+    {
+        for (int8_t i = 0; i < secrets::NUM_KNOWN_SSIDS; i++)
+        {
+            order[i] = i;
+        }
+        return secrets::NUM_KNOWN_SSIDS;
+    }
+
+    void record_join(persistent::PersistentData &data, int bucket, int8_t ssid, bool joined, uint32_t ms)
+    {
+        persistent::SsidStats *stats = stats_for(data, bucket, ssid);
+        if (!stats)
+        {
+            return;
+        }
+        bool const first = stats->attempts == 0;
+        stats->success = (uint8_t)ewma(stats->success, joined ? 255 : 0, first);
+        if (stats->attempts < UINT8_MAX)
+        {
+            stats->attempts++;
+        }
+
+        if (joined)
+        {
+            // the connect time only means anything for joins that worked
+            stats->connect_ms = ewma(stats->connect_ms, ms, stats->connect_ms == 0);
+            stats->consecutive_failures = 0;
+            stats->backoff_wakes = 0;
+            return;
+        }
+
+        if (stats->consecutive_failures < UINT8_MAX)
+        {
+            stats->consecutive_failures++;
+        }
+        // one failure could be anything, after that sit out 1, 3, 7... wakes
+        uint8_t const n = stats->consecutive_failures;
+        if (n >= 2)
+        {
+            stats->backoff_wakes = n > 6 ? MAX_BACKOFF_WAKES : (uint8_t)((1u << (n - 1)) - 1);
+            printf("SSID %d has failed %u times running, backing off for %u wakes\n", ssid, n, stats->backoff_wakes);
+        }
+    }
+
+    void record_throughput(persistent::PersistentData &data, int bucket, int8_t ssid, uint32_t kbytes_per_s)
+    {
+        persistent::SsidStats *stats = stats_for(data, bucket, ssid);
+        if (!stats || kbytes_per_s == 0)
+        {
+            return;
+        }
+        stats->kbytes_per_s = ewma(stats->kbytes_per_s, kbytes_per_s, stats->kbytes_per_s == 0);
+    }
+
+    uint16_t throughput(const persistent::PersistentData &data, int bucket, int8_t ssid)
+    {
+        if (ssid < 0 || ssid >= secrets::NUM_KNOWN_SSIDS || bucket < 0 || bucket >= persistent::TIME_BUCKETS)
+        {
+            return 0;
+        }
+        return data.ssid_stats[ssid][bucket].kbytes_per_s;
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include "pico/types.h"
+#include "persistent_data.hpp"
+
+// Which known network to try first, from how each has done before at this time of day.
+// Each network gets a score of its expected join and download time over the chance the
+// join works, and they're tried lowest first. That's the order that gets a frame in
+// soonest on average when a failed join costs the whole timeout. Networks that keep
+// failing are put to the back for a few wakes, more each time, then tried again.
+namespace ssid_stats
+{
+    // which of persistent::TIME_BUCKETS this time falls in, 0 if the RTC isn't set
+    int time_bucket(const datetime_t &dt);
+
+    // Fills order with the known SSID indexes in the order to try them and returns how
+    // many. Counts this wake off any backoff, so the data wants saving afterwards.
+    int plan(persistent::PersistentData &data, int bucket, int8_t *order);
+
+    // The known SSID indexes in the order secrets.h has them, for when there are no stats
+    // to go on. Returns how many.
+    int default_order(int8_t *order);
+
+    // How a join went, ms is from starting it to the link coming up or the timeout
+    void record_join(persistent::PersistentData &data, int bucket, int8_t ssid, bool joined, uint32_t ms);
+    // The body throughput the frame came in at through this network
+    void record_throughput(persistent::PersistentData &data, int bucket, int8_t ssid, uint32_t kbytes_per_s);
+    // The average of those, 0 until there's been one
+    uint16_t throughput(const persistent::PersistentData &data, int bucket, int8_t ssid);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include "pico/types.h"
+
+namespace time_util
+{
+    // Seconds since 1970 for a UTC datetime_t, ignoring dotw.
+    // Howard Hinnant's days_from_civil, so no libc time zone handling gets pulled in.
+    inline int64_t to_unix(const datetime_t &dt)
+    {
+        int const y = dt.year - (dt.month <= 2);
+        int const era = (y >= 0 ? y : y - 399) / 400;
+        unsigned const yoe = (unsigned)(y - era * 400);
+        unsigned const doy = (153 * (dt.month + (dt.month > 2 ? -3 : 9)) + 2) / 5 + dt.day - 1;
+        unsigned const doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        int64_t const days = (int64_t)era * 146097 + doe - 719468;
+        return days * 86400 + dt.hour * 3600 + dt.min * 60 + dt.sec;
+    }
+
+    // The other way, civil_from_days. dotw is filled in too, 0 for Sunday like the RTC.
+    inline datetime_t from_unix(int64_t t)
+    {
+        int64_t const days = (t >= 0 ? t : t - 86399) / 86400;
+        int const secs = (int)(t - days * 86400);
+        int64_t const z = days + 719468;
+        int const era = (int)((z >= 0 ? z : z - 146096) / 146097);
+        unsigned const doe = (unsigned)(z - (int64_t)era * 146097);
+        unsigned const yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        unsigned const doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        unsigned const mp = (5 * doy + 2) / 153;
+        unsigned const month = mp < 10 ? mp + 3 : mp - 9;
+
+        datetime_t dt;
+        dt.year = (int16_t)(yoe + era * 400 + (month <= 2));
+        dt.month = (int8_t)month;
+        dt.day = (int8_t)(doy - (153 * mp + 2) / 5 + 1);
+        dt.dotw = (int8_t)((days % 7 + 11) % 7); // 1970-01-01 was a Thursday
+        dt.hour = (int8_t)(secs / 3600);
+        dt.min = (int8_t)(secs / 60 % 60);
+        dt.sec = (int8_t)(secs % 60);
+        return dt;
+    }
+
+    // 01:00 UTC on the last Sunday of a month with 31 days, when the UK's clocks change
+    inline int64_t last_sunday_1am(int year, int month)
+    {
+        datetime_t last = {};
+        last.year = (int16_t)year;
+        last.month = (int8_t)month;
+        last.day = 31;
+        last.hour = 1;
+        int64_t const t = to_unix(last);
+        return t - from_unix(t).dotw * 86400;
+    }
+
+    // Seconds to add to UTC for Europe/London: BST is an hour ahead, from the last Sunday
+    // in March to the last Sunday in October, both at 01:00 UTC. Compiled in, the frame
+    // only ever lives in the UK.
+    inline int32_t london_offset_s(int64_t utc)
+    {
+        int const year = from_unix(utc).year;
+        bool const summer = utc >= last_sunday_1am(year, 3) && utc < last_sunday_1am(year, 10);
+        return summer ? 3600 : 0;
+    }
+
+    // The RTC starts at year 0 until something sets it
+    inline bool is_set(const datetime_t &dt)
+    {
+        return dt.year >= 2020;
+    }
+}
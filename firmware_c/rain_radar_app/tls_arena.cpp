@@ -0,0 +1,203 @@
+#include "tls_arena.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include "lwip/altcp_tls.h"
+// lwIP's own definition of altcp_tls_config, from src/apps/altcp_tls, see CMakeLists.txt
+#include "altcp_tls_mbedtls_structs.h"
+#include "mbedtls/platform.h"
+#include "pico/stdlib.h"
+#include "logging.hpp"
+
+namespace tls_arena
+{
+    namespace
+    {
+        // First fit with neighbours merged on free. The handshake's bignum code frees
+        // in no particular order, so a plain bump allocator would run out.
+        struct Block
+        {
+            // whole block including this header, multiple of ALIGN, bit 0 set while in use
+            uint32_t size;
+            // size of the block before, 0 for the first
+            uint32_t prev_size;
+        };
+        constexpr uint32_t ALIGN = 8;
+        constexpr uint32_t IN_USE = 1;
+        constexpr uint32_t MIN_BLOCK = sizeof(Block) + ALIGN;
+        constexpr uint32_t ARENA_SIZE = RAIN_RADAR_TLS_ARENA_KB * 1024;
+        static_assert(sizeof(Block) % ALIGN == 0);
+
+        alignas(ALIGN) uint8_t arena[ARENA_SIZE];
+        // everything here is only touched from lwIP's callbacks and the fetch on core0
+        size_t used = 0;
+        size_t blocks = 0;
+        size_t peak = 0;
+        size_t request_peak = 0;
+        uint32_t failed = 0;
+        // frees of pointers that were never the arena's
+        uint32_t stray = 0;
+
+        Block *block_at(uint32_t offset)
+        {
+            return (Block *)(arena + offset);
+        }
+
+        uint32_t block_size(const Block *block)
+        {
+            return block->size & ~IN_USE;
+        }
+
+        void reset()
+        {
+            Block *first = block_at(0);
+            first->size = ARENA_SIZE;
+            first->prev_size = 0;
+            used = 0;
+            blocks = 0;
+            request_peak = 0;
+            failed = 0;
+            stray = 0;
+        }
+
+        void note_used()
+        {
+            peak = MAX(peak, used);
+            request_peak = MAX(request_peak, used);
+        }
+
+        void *arena_calloc(size_t count, size_t size)
+        {
+            if (count && size > (ARENA_SIZE - sizeof(Block)) / count)
+            {
+                failed++;
+                return nullptr;
+            }
+            uint32_t const need = MAX(MIN_BLOCK, (count * size + sizeof(Block) + ALIGN - 1) & ~(ALIGN - 1));
+            for (uint32_t offset = 0; offset < ARENA_SIZE; offset += block_size(block_at(offset)))
+            {
+                Block *block = block_at(offset);
+                if ((block->size & IN_USE) || block->size < need)
+                {
+                    continue;
+                }
+                uint32_t const spare = block->size - need;
+                if (spare >= MIN_BLOCK)
+                {
+                    Block *rest = block_at(offset + need);
+                    rest->size = spare;
+                    rest->prev_size = need;
+                    if (offset + block->size < ARENA_SIZE)
+                    {
+                        block_at(offset + block->size)->prev_size = spare;
+                    }
+                    block->size = need;
+                }
+                used += block->size;
+                blocks++;
+                note_used();
+                block->size |= IN_USE;
+                void *const p = block + 1;
+                memset(p, 0, block_size(block) - sizeof(Block));
+                return p;
+            }
+            failed++;
+            return nullptr;
+        }
+
+        void arena_free(void *p)
+        {
+            if (!p)
+            {
+                return;
+            }
+            // from some other allocator, working a block out from it would wreck the arena
+            if ((uint8_t *)p < arena + sizeof(Block) || (uint8_t *)p >= arena + ARENA_SIZE)
+            {
+                stray++;
+                return;
+            }
+            uint32_t offset = (uint8_t *)p - arena - sizeof(Block);
+            Block *block = block_at(offset);
+            uint32_t size = block_size(block);
+            used -= size;
+            blocks--;
+
+            uint32_t const next_offset = offset + size;
+            if (next_offset < ARENA_SIZE && !(block_at(next_offset)->size & IN_USE))
+            {
+                size += block_at(next_offset)->size;
+            }
+            if (block->prev_size && !(block_at(offset - block->prev_size)->size & IN_USE))
+            {
+                offset -= block->prev_size;
+                size += block_at(offset)->size;
+                block = block_at(offset);
+            }
+            block->size = size;
+            if (offset + size < ARENA_SIZE)
+            {
+                block_at(offset + size)->prev_size = size;
+            }
+        }
+    }
+
+    struct altcp_tls_config *create_config()
+    {
+        if (blocks == 0)
+        {
+            reset();
+        }
+        else
+        {
+            LOG_ERROR("TLS arena not reset, %u blocks still allocated\n", blocks);
+        }
+        /* No CA certificate checking */
+        struct altcp_tls_config *config = altcp_tls_create_config_client(NULL, 0);
+        if (config)
+        {
+            // Ask for 4 KB records, before any connection's set up from the config. If the
+            // server agrees the receive buffer shrinks to match once the handshake is done
+            // (MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH).
+            mbedtls_ssl_conf_max_frag_len(&config->conf, MBEDTLS_SSL_MAX_FRAG_LEN_4096);
+        }
+        return config;
+    }
+
+    void free_config(struct altcp_tls_config *config)
+    {
+        altcp_tls_free_config(config);
+        if (blocks)
+        {
+            LOG_WARN("TLS leaked %u bytes in %u blocks\n", used, blocks);
+        }
+        if (failed)
+        {
+            LOG_ERROR("TLS arena ran out %lu times\n", failed);
+        }
+        if (stray)
+        {
+            LOG_ERROR("TLS freed %lu blocks that weren't the arena's\n", stray);
+        }
+        LOG_INFO("TLS arena peak %u of %lu bytes\n", request_peak, ARENA_SIZE);
+    }
+
+    size_t size()
+    {
+        return ARENA_SIZE;
+    }
+
+    size_t take_peak()
+    {
+        size_t const taken = peak;
+        peak = used;
+        return taken;
+    }
+}
+
+// lwIP's altcp_tls_create_config calls this before it allocates anything, wrapped by the
+// linker (see CMakeLists.txt) so mbedTLS allocates from the arena from the very start
+extern "C" void __wrap_altcp_mbedtls_mem_init(void)
+{
+    mbedtls_platform_set_calloc_free(tls_arena::arena_calloc, tls_arena::arena_free);
+}
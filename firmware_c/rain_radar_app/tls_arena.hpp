@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+struct altcp_tls_config;
+
+// mbedTLS allocates from a fixed arena rather than the heap, one request at a time. The
+// arena starts empty for each request, so nothing left over from the last one fragments
+// it, and its high water mark is exactly what TLS needs (see RAIN_RADAR_TLS_ARENA_KB).
+namespace tls_arena
+{
+    // Resets the arena and creates the client config for a request, asking for 4 KB records.
+    // Whatever mbedTLS allocates setting it up comes from the arena too, see
+    // __wrap_altcp_mbedtls_mem_init.
+    struct altcp_tls_config *create_config();
+
+    // Frees the config once httpc has finished with the connection and logs the
+    // request's peak. Anything mbedTLS still has allocated is a leak, which keeps the
+    // arena from being reset for the next request.
+    void free_config(struct altcp_tls_config *config);
+
+    size_t size();
+
+    // Most bytes in use, counting block headers, since the last call. The profiler uses
+    // this to give each phase its peak.
+    size_t take_peak();
+}
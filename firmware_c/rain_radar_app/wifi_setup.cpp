@@ -11,6 +11,7 @@
 #include "pico/cyw43_arch.h"
 #include "secrets.h"
 #include "rain_radar_common.hpp"
+#include "logging.hpp"
 
 using namespace pimoroni;
 
@@ -77,89 +78,197 @@ namespace
         }
     }
 
-    Err try_connect_to_ssid(const char *ssid, const char *password)
+    Err start_join(const char *ssid, const char *password)
     {
-        printf("Connecting to %s...\n", ssid);
+        LOG_INFO("Connecting to %s...\n", ssid);
         if (!cyw43_arch_wifi_connect_async(ssid, password, CYW43_AUTH_WPA2_AES_PSK))
         {
-            printf("Started connection attempt...\n");
+            LOG_INFO("Started connection attempt...\n");
+            return Err::OK;
         }
-        else
+        LOG_ERROR("failed to start connection\n");
+        return Err::ERROR;
+    }
+
+    // t_start is when start_join was called, association carries on in the background meanwhile
+    Err wait_for_join(uint32_t t_start)
+    {
+        // wait a bit before checking status, unless boot has already taken that long
+        uint32_t const settle_ms = 2000;
+        uint32_t const elapsed_ms = millis() - t_start;
+        if (elapsed_ms < settle_ms)
         {
-            printf("failed to start connection\n");
-            return Err::ERROR;
+            sleep_ms(settle_ms - elapsed_ms);
         }
 
-        uint32_t t_start = millis();
-
-        sleep_ms(2000); // wait a bit before checking status
-
         uint32_t timeout_ms = 10000;
-        while (millis() - t_start < timeout_ms)
+        // checked at least once, boot could have taken longer than the timeout
+        do
         {
             int link_status = cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA);
             switch (link_status)
             {
             case CYW43_LINK_DOWN:
-                printf("Wifi status: LINK_DOWN\n");
+                LOG_INFO("Wifi status: LINK_DOWN\n");
                 break;
             case CYW43_LINK_JOIN:
-                printf("Wifi status: LINK_JOIN (associating)\n");
-                printf("Connected!\n");
+                LOG_INFO("Wifi status: LINK_JOIN (associating)\n");
+                LOG_INFO("Connected!\n");
                 return Err::OK;
                 break;
             case CYW43_LINK_FAIL:
-                printf("Wifi status: LINK_FAIL (connection failed)\n");
+                LOG_INFO("Wifi status: LINK_FAIL (connection failed)\n");
                 break;
             case CYW43_LINK_NONET:
-                printf("Wifi status: LINK_NONET (SSID not found)\n");
+                LOG_INFO("Wifi status: LINK_NONET (SSID not found)\n");
                 break;
             case CYW43_LINK_BADAUTH:
-                printf("Wifi status: LINK_BADAUTH (authentication failure)\n");
+                LOG_INFO("Wifi status: LINK_BADAUTH (authentication failure)\n");
                 break;
             default:
                 if (link_status < 0)
                 {
-                    printf("Wifi status: Unknown error %d\n", link_status);
+                    LOG_WARN("Wifi status: Unknown error %d\n", link_status);
                 }
                 break;
             }
-            printf("Waiting to connect...\n");
+            LOG_DEBUG("Waiting to connect...\n");
             sleep_ms(1000);
-        }
+        } while (millis() - t_start < timeout_ms);
         return Err::TIMEOUT;
     }
 
+    // Power save trades latency for current: the radio dozes between beacons and buffered
+    // packets wait for it. That's what we want while nothing much is happening, but during
+    // the body it throttles throughput, so that gets performance mode.
+    uint32_t phase_pm[(size_t)wifi_setup::PowerPhase::COUNT] = {
+        CYW43_DEFAULT_PM,
+        CYW43_PERFORMANCE_PM,
+    };
+    uint32_t wanted_pm = CYW43_DEFAULT_PM;
+    uint32_t applied_pm = CYW43_DEFAULT_PM;
+
+    // cyw43_wifi_pm is an ioctl, which can't be made from inside cyw43's packet processing
+    // where the lwIP callbacks run, so it's done as async context work afterwards
+    void apply_pm(__unused async_context_t *context, __unused async_when_pending_worker_t *worker)
+    {
+        if (wanted_pm == applied_pm)
+        {
+            return;
+        }
+        int const err = cyw43_wifi_pm(&cyw43_state, wanted_pm);
+        if (err)
+        {
+            printf("Couldn't set the Wi-Fi power mode: %d\n", err);
+            return;
+        }
+        applied_pm = wanted_pm;
+    }
+
+    async_when_pending_worker_t pm_worker = {.do_work = apply_pm};
+    bool pm_worker_added = false;
+
+    std::unique_ptr<NetworkLedController> led_controller;
+    // cyw43_arch_init has been done and network_deinit hasn't undone it
+    bool powered = false;
+    // the join begin_connect started, NOT_INITIALISED if cyw43 didn't come up
+    Err begin_err = Err::NOT_INITIALISED;
+    // the known SSIDs in the order to try them, see ssid_stats::plan
+    int8_t attempt_order[secrets::NUM_KNOWN_SSIDS];
+    int attempt_count = 0;
+    uint32_t first_join_ms = 0;
+
 }
 
 namespace wifi_setup
 {
-    ResultOr<int8_t> wifi_connect(InkyFrame &inky_frame, int8_t preferred_ssid_index)
+    Err power_up(InkyFrame &inky_frame)
     {
-        NetworkLedController led_controller(&inky_frame, 1); // 1 Hz pulse
+        if (powered)
+        {
+            return Err::OK;
+        }
+        led_controller = std::make_unique<NetworkLedController>(&inky_frame, 1); // 1 Hz pulse
         if (cyw43_arch_init_with_country(CYW43_COUNTRY_UK))
         {
             printf("failed to initialise\n");
+            led_controller.reset();
             inky_frame.led(InkyFrame::LED_CONNECTION, 0); // solid off
-
             return Err::NOT_INITIALISED;
         }
         cyw43_arch_enable_sta_mode();
         printf("initialised\n");
+        applied_pm = CYW43_DEFAULT_PM; // what cyw43_arch_init leaves it on
+        wanted_pm = phase_pm[(size_t)PowerPhase::WAIT];
+        apply_pm(nullptr, nullptr);
+        pm_worker_added = async_context_add_when_pending_worker(cyw43_arch_async_context(), &pm_worker);
+        powered = true;
+        return Err::OK;
+    }
+
+    Err begin_connect(InkyFrame &inky_frame, const int8_t *order, int count)
+    {
+        Err const err = power_up(inky_frame);
+        if (err != Err::OK)
+        {
+            return err;
+        }
+
+        attempt_count = 0;
+        for (int i = 0; i < count && attempt_count < secrets::NUM_KNOWN_SSIDS; i++)
+        {
+            if (order[i] >= 0 && order[i] < secrets::NUM_KNOWN_SSIDS)
+            {
+                attempt_order[attempt_count++] = order[i];
+            }
+        }
+        if (attempt_count == 0)
+        {
+            printf("No SSIDs to try\n");
+            begin_err = Err::INVALID_ARGUMENT;
+            return begin_err;
+        }
+
+        int8_t const first = attempt_order[0];
+        first_join_ms = millis();
+        // a join that doesn't start is tried again by finish_connect
+        begin_err = start_join(secrets::KNOWN_SSIDS[first], secrets::KNOWN_WIFI_PASSWORDS[first]);
+        return Err::OK;
+    }
 
-        int8_t initial_ssid_index = 0;
-        if (preferred_ssid_index >= 0 && preferred_ssid_index < secrets::NUM_KNOWN_SSIDS)
+    ResultOr<int8_t> finish_connect(InkyFrame &inky_frame, const AttemptFn &on_attempt)
+    {
+        if (begin_err == Err::NOT_INITIALISED)
         {
-            initial_ssid_index = preferred_ssid_index;
-            printf("Trying preferred SSID index %d first\n", preferred_ssid_index);
+            return Err::NOT_INITIALISED;
         }
 
-        for (int i = 0; i < secrets::NUM_KNOWN_SSIDS; i++)
+        for (int i = 0; i < attempt_count; i++)
         {
-            int8_t ssid_attempt_index = (initial_ssid_index + i) % secrets::NUM_KNOWN_SSIDS;
-            Err err = try_connect_to_ssid(secrets::KNOWN_SSIDS[ssid_attempt_index], secrets::KNOWN_WIFI_PASSWORDS[ssid_attempt_index]);
+            int8_t ssid_attempt_index = attempt_order[i];
+            Err err;
+            uint32_t t_start = first_join_ms;
+            if (i == 0 && begin_err == Err::OK)
+            {
+                // already under way since begin_connect
+                err = wait_for_join(t_start);
+            }
+            else
+            {
+                t_start = millis();
+                err = start_join(secrets::KNOWN_SSIDS[ssid_attempt_index], secrets::KNOWN_WIFI_PASSWORDS[ssid_attempt_index]);
+                if (err == Err::OK)
+                {
+                    err = wait_for_join(t_start);
+                }
+            }
+            if (on_attempt)
+            {
+                on_attempt(ssid_attempt_index, err == Err::OK, millis() - t_start);
+            }
             if (err == Err::OK)
             {
+                led_controller.reset();
                 inky_frame.led(InkyFrame::LED_CONNECTION, 100); // solid on
 
                 return ResultOr<int8_t>(ssid_attempt_index);
@@ -169,6 +278,7 @@ namespace wifi_setup
                 printf("Connection attempt timed out: %s\n", errToString(err).data());
             }
         }
+        led_controller.reset();
         inky_frame.led(InkyFrame::LED_CONNECTION, 0); // solid off
         return Err::TIMEOUT;
     }
@@ -179,9 +289,29 @@ namespace wifi_setup
         return link_status == CYW43_LINK_JOIN;
     }
 
+    void set_power_phase(PowerPhase phase)
+    {
+        wanted_pm = phase_pm[(size_t)phase];
+        if (pm_worker_added && wanted_pm != applied_pm)
+        {
+            async_context_set_work_pending(cyw43_arch_async_context(), &pm_worker);
+        }
+    }
+
+    void set_power_mode(PowerPhase phase, uint32_t pm)
+    {
+        phase_pm[(size_t)phase] = pm;
+    }
+
     void network_deinit(InkyFrame &inky_frame)
     {
+        if (pm_worker_added)
+        {
+            async_context_remove_when_pending_worker(cyw43_arch_async_context(), &pm_worker);
+            pm_worker_added = false;
+        }
         cyw43_arch_deinit();
+        powered = false;
         inky_frame.led(InkyFrame::LED_CONNECTION, 0); // solid off
     }
 
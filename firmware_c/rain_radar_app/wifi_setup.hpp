@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include "pimoroni_common.hpp"
 #include "inky_frame_7.hpp"
 #include "rain_radar_common.hpp"
@@ -7,7 +8,36 @@
 namespace wifi_setup
 {
 
-    ResultOr<int8_t> wifi_connect(pimoroni::InkyFrame &inky_frame, int8_t preferred_ssid_index);
+    // Power up cyw43, loading its firmware. That's the slow part of starting the radio and
+    // needs nothing but the board, so it can go before anything else is known about the wake.
+    // Does nothing if it's already up.
+    Err power_up(pimoroni::InkyFrame &inky_frame);
+
+    // Power up cyw43 if power_up hasn't, and start joining order[0], order being known SSID
+    // indexes in the order to try them. The association carries on in the background, so
+    // the rest of boot can run before finish_connect waits for it.
+    Err begin_connect(pimoroni::InkyFrame &inky_frame, const int8_t *order, int count);
+
+    // Called after each join attempt with the SSID index, whether it joined and how long it took
+    using AttemptFn = std::function<void(int8_t ssid_index, bool joined, uint32_t ms)>;
+
+    // Wait for the join begin_connect started, trying the rest of the order if it fails.
+    // Returns the index of the one that worked.
+    ResultOr<int8_t> finish_connect(pimoroni::InkyFrame &inky_frame, const AttemptFn &on_attempt);
+
+    // Which part of a request we're in, each gets its own cyw43 power management setting
+    enum class PowerPhase : uint8_t
+    {
+        WAIT,     // joining, DNS, the TLS handshake and waiting on the server
+        TRANSFER, // the body coming in
+        COUNT
+    };
+
+    // Fine to call from lwIP callbacks, the setting changes once cyw43 has finished
+    // what it's in the middle of
+    void set_power_phase(PowerPhase phase);
+    // The cyw43_wifi_pm value for a phase, e.g. CYW43_PERFORMANCE_PM. For the PM benchmark.
+    void set_power_mode(PowerPhase phase, uint32_t pm);
     void network_deinit(pimoroni::InkyFrame &inky_frame);
     bool is_connected();
 
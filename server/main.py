@@ -13,6 +13,8 @@ import argparse
 import shutil
 from PIL import ImageDraw, ImageFont
 import io
+import struct
+import zlib
 import numpy as np
 
 IMAGES_DIR = Path("images")
@@ -24,7 +26,15 @@ MAP_TILE_FILE = IMAGES_DIR / ("map.png")
 QRCODE_FILE = IMAGES_DIR / ("qrcode.png")
 COMBINED_FILE = IMAGES_DIR / ("combined.jpg")
 QUANTIZED_BIN_FILE = IMAGES_DIR / ("quantized.bin")
+QUANTIZED_PACKED_BIN_FILE = IMAGES_DIR / ("quantized_packed.bin")
 QUANTIZED_PNG_FILE = IMAGES_DIR / ("quantized.png")
+BASEMAP_BIN_FILE = IMAGES_DIR / ("basemap.bin")
+PRECIP_LAYER_BIN_FILE = IMAGES_DIR / ("precip_layer.bin")
+RAIN_GRID_BIN_FILE = IMAGES_DIR / ("rain_grid.bin")
+FORECAST_BUNDLE_BIN_FILE = IMAGES_DIR / ("forecast_bundle.bin")
+FRAME_BIN_FILE = IMAGES_DIR / ("frame.bin")
+FRAME_REDUCED_BIN_FILE = IMAGES_DIR / ("frame_reduced.bin")
+FRAME_HALF_BIN_FILE = IMAGES_DIR / ("frame_half.bin")
 IMAGE_INFO_FILE = IMAGES_DIR / ("image_info.txt")
 
 INTENSITY_MIN = 20
@@ -48,6 +58,14 @@ INKY_FRAME_PALETTE = (
     *ORANGE,
 )
 
+# the reduced colour quality tier, the firmware maps these to the panel's indices 0, 1, 3, 4
+REDUCED_PALETTE = (
+    *BLACK,
+    *WHITE,
+    *BLUE,
+    *RED,
+)
+
 def get_snapshot_timestamp():
     response = requests.get(
         f"https://api.rainbow.ai/tiles/v1/snapshot?token={api_secrets.RAINBOW_API_TOKEN}"
@@ -146,15 +164,22 @@ def process_dbz_u8(img: Image) -> Image:
     
     return processed_img
 
+def raw_precip_path(zoom, tile_x, tile_y, ts, forecast_secs):
+    """The tile as downloaded, dBZ values rather than colours, for the firmware to dither itself"""
+    return IMAGES_DIR / f"precip_{zoom}_{tile_x}_{tile_y}_{ts}_{forecast_secs}_dbz_u8_raw.png"
+
+
 def download_precip_image(zoom, tile_x, tile_y, ts, forecast_secs):
     file_path = IMAGES_DIR / f"precip_{zoom}_{tile_x}_{tile_y}_{ts}_{forecast_secs}_dbz_u8.png"
-    if not file_path.exists(): # or True:
+    raw_path = raw_precip_path(zoom, tile_x, tile_y, ts, forecast_secs)
+    if not file_path.exists() or not raw_path.exists(): # or True:
         print("Downloading forecast image...")
 
         response = get_tile_handler(zoom, tile_x, tile_y, ts, forecast_secs)
         assert response.status_code == 200
 
         img = Image.open(io.BytesIO(response.content))
+        img.save(raw_path)
         if "dbz_u8" in file_path.name:
             img = process_dbz_u8(img)
         img.save(file_path)
@@ -245,60 +270,9 @@ def download_range_of_tiles(zoom, tile_start_x, tile_start_y, tile_end_x, tile_e
     combined_precip_forecast.save(PRECIP_FORECAST_TILE_FILE)
     print("Combined map and precipitation tiles into single images.")
 
-def build_image():
-    # precip_ts = get_snapshot_timestamp()
-    current_time = dt.datetime.now(tz=ZoneInfo("UTC"))
-    snapshot_time = current_time - dt.timedelta(minutes=8)
-    snapshot_time = snapshot_time.replace(minute=(snapshot_time.minute // 10) * 10, second=0, microsecond=0)
-
-    now_offset = 0
-    if snapshot_time + dt.timedelta(minutes=10) < current_time:
-        now_offset = 600
-    snapshot_time = int(snapshot_time.timestamp())
-    current_map_time = snapshot_time + now_offset
-
-
-    print(f"Snapshot timestamp: {snapshot_time}")
-    FORECAST_SECS = 1800
-    download_range_of_tiles(ZOOM, TILE_X, TILE_Y, TILE_X+1, TILE_Y+1, snapshot_time, now_offset, FORECAST_SECS)
-
-    with open(IMAGE_INFO_FILE, "w") as f:
-        current_time_dt = int(dt.datetime.now(tz=ZoneInfo("Europe/London")).timestamp())
-
-        image_text = dt.datetime.fromtimestamp(current_map_time, tz=ZoneInfo("Europe/London")).strftime(
-                "%Y-%m-%d %H:%M:%S") + " + " + f"{FORECAST_SECS//60} min forecast"
-        f.write(f"local_time={current_time_dt}\n")
-        f.write(f"text={image_text}\n")
-
-    qr_code_image()
-
-    map_img = Image.open(MAP_TILE_FILE).convert("RGBA")
-    precip_now_img = Image.open(PRECIP_NOW_TILE_FILE).convert("RGBA")
-    precip_forecast_img = Image.open(PRECIP_FORECAST_TILE_FILE).convert("RGBA")
-    qr_img = Image.open(QRCODE_FILE).convert("RGBA")
-
-    # turn the old precip data into the lightest intensity
-    # and draw the forecast over it
-    # precip_now_img = precip_now_img.
-    precip_now_img = np.array(precip_now_img)
-    precip_now_img[precip_now_img[:,:,3] != 0] = intensity_to_color(INTENSITY_MIN)
-    precip_now_img = Image.fromarray(precip_now_img)
-    precip_now_img.save("debug_precip_now.png")
-    assert precip_now_img.mode == "RGBA"
-    precip_combined_img = Image.new("RGBA", precip_now_img.size)
-    precip_combined_img = Image.alpha_composite(precip_combined_img, precip_now_img)
-    precip_combined_img = Image.alpha_composite(precip_combined_img, precip_forecast_img)
-    precip_combined_img.save("debug_precip_combined.png")
-
-    assert map_img.size[0] / map_img.size[1] == precip_combined_img.size[0] / precip_combined_img.size[1]
-
-    precip_combined_img = precip_combined_img.resize(map_img.size, resample=Image.BILINEAR)
-
-    # combined = map_img # no precip data
-    combined = Image.alpha_composite(map_img, precip_combined_img)
-
-    combined = combined.convert("RGB")
-    current_width, current_height = combined.size
+def crop_to_display(img, size=(DESIRED_WIDTH, DESIRED_HEIGHT), resample=Image.BILINEAR):
+    """Crop and zoom the stitched tiles to the bit of the map we show, at the display's resolution"""
+    current_width, current_height = img.size
     if current_width / current_height > DESIRED_WIDTH / DESIRED_HEIGHT:
         # too wide
         cropped_width = current_height * DESIRED_WIDTH / DESIRED_HEIGHT
@@ -323,10 +297,10 @@ def build_image():
             cropped_height + cropped_height_start,
         )
 
-    combined = combined.crop(bounding_box)
+    img = img.crop(bounding_box)
 
     # zoom into the center quarter of the image
-    width, height = combined.size
+    width, height = img.size
     scale = 0.7
     centre_point = (width*0.38, height*0.35)
     new_width = int(width * scale)
@@ -335,14 +309,89 @@ def build_image():
     upper = centre_point[1] - new_height // 2
     right = centre_point[0] + new_width // 2
     lower = centre_point[1] + new_height // 2
-    combined = combined.crop((left, upper, right, lower))
+    img = img.crop((left, upper, right, lower))
+
+    img = img.resize(size, resample=resample)
+    return img
 
-    combined = combined.resize(
-        (DESIRED_WIDTH, DESIRED_HEIGHT), resample=Image.BILINEAR
-    )
 
+def compose_frame(map_img):
+    """The precip tiles last stitched by download_range_of_tiles drawn over the map, cropped to the display,
+    and where on the display there's any rain, for quantize to keep the rest of the map as it was"""
+    precip_now_img = Image.open(PRECIP_NOW_TILE_FILE).convert("RGBA")
+    precip_forecast_img = Image.open(PRECIP_FORECAST_TILE_FILE).convert("RGBA")
 
-    convert_to_bitmap(combined)
+    # turn the old precip data into the lightest intensity
+    # and draw the forecast over it
+    # precip_now_img = precip_now_img.
+    precip_now_img = np.array(precip_now_img)
+    precip_now_img[precip_now_img[:,:,3] != 0] = intensity_to_color(INTENSITY_MIN)
+    precip_now_img = Image.fromarray(precip_now_img)
+    precip_now_img.save("debug_precip_now.png")
+    assert precip_now_img.mode == "RGBA"
+    precip_combined_img = Image.new("RGBA", precip_now_img.size)
+    precip_combined_img = Image.alpha_composite(precip_combined_img, precip_now_img)
+    precip_combined_img = Image.alpha_composite(precip_combined_img, precip_forecast_img)
+    precip_combined_img.save("debug_precip_combined.png")
+
+    assert map_img.size[0] / map_img.size[1] == precip_combined_img.size[0] / precip_combined_img.size[1]
+
+    precip_combined_img = precip_combined_img.resize(map_img.size, resample=Image.BILINEAR)
+
+    # combined = map_img # no precip data
+    combined = Image.alpha_composite(map_img, precip_combined_img)
+
+    combined = combined.convert("RGB")
+    # anything the bilinear scaling blended a bit of rain into counts
+    rain = np.array(crop_to_display(precip_combined_img.getchannel("A"))) != 0
+    return crop_to_display(combined), rain
+
+
+def build_image():
+    # precip_ts = get_snapshot_timestamp()
+    current_time = dt.datetime.now(tz=ZoneInfo("UTC"))
+    snapshot_time = current_time - dt.timedelta(minutes=8)
+    snapshot_time = snapshot_time.replace(minute=(snapshot_time.minute // 10) * 10, second=0, microsecond=0)
+
+    now_offset = 0
+    if snapshot_time + dt.timedelta(minutes=10) < current_time:
+        now_offset = 600
+    snapshot_time = int(snapshot_time.timestamp())
+    current_map_time = snapshot_time + now_offset
+
+
+    print(f"Snapshot timestamp: {snapshot_time}")
+    FORECAST_SECS = 1800
+    download_range_of_tiles(ZOOM, TILE_X, TILE_Y, TILE_X+1, TILE_Y+1, snapshot_time, now_offset, FORECAST_SECS)
+
+    with open(IMAGE_INFO_FILE, "w") as f:
+        current_time_dt = int(dt.datetime.now(tz=ZoneInfo("Europe/London")).timestamp())
+
+        image_text = dt.datetime.fromtimestamp(current_map_time, tz=ZoneInfo("Europe/London")).strftime(
+                "%Y-%m-%d %H:%M:%S") + " + " + f"{FORECAST_SECS//60} min forecast"
+        f.write(f"local_time={current_time_dt}\n")
+        f.write(f"text={image_text}\n")
+
+    qr_code_image()
+
+    map_img = Image.open(MAP_TILE_FILE).convert("RGBA")
+    qr_img = Image.open(QRCODE_FILE).convert("RGBA")
+    combined, rain = compose_frame(map_img)
+
+    # the map on its own, so the firmware can cache it and only fetch what the rain changes
+    basemap = crop_to_display(map_img.convert("RGB"))
+
+    quantized_basemap = quantize(basemap, add_text=False)
+    quantized = convert_to_bitmap(combined, over=(quantized_basemap, rain))
+    basemap_version = write_precip_layer(quantized_basemap, quantized)
+    raw_now = stitch_raw_precip(ZOOM, TILE_X, TILE_Y, TILE_X+1, TILE_Y+1, snapshot_time, now_offset)
+    raw_forecast = stitch_raw_precip(ZOOM, TILE_X, TILE_Y, TILE_X+1, TILE_Y+1, snapshot_time, FORECAST_SECS)
+    write_rain_grid(raw_now, raw_forecast, basemap_version)
+    write_frame_containers(
+        combined, quantized_basemap, quantized, basemap_version, raw_now, raw_forecast,
+        current_map_time, next_publish_time(current_time),
+    )
+    write_forecast_bundle(map_img, quantized_basemap, quantized, basemap_version, snapshot_time, now_offset, FORECAST_SECS)
     combined = ImageEnhance.Color(combined).enhance(1.3)
     combined.save(COMBINED_FILE, progressive=False, quality=85)
     print("Combined map.png and forecast.png into one image.")
@@ -350,19 +399,26 @@ def build_image():
 
 
 
-def convert_to_bitmap(img):
+def quantize(img, add_text=True, text=None, palette=INKY_FRAME_PALETTE, over=None):
+    """Quantize to the inky's palette with the legend and, optionally, the info text drawn on.
+    Smaller images, e.g. the half resolution quality tier, get a smaller legend and text.
+
+    over is the quantized basemap and the rain mask from compose_frame. The dithering carries
+    the rain's error across the whole map, so everywhere but the rain is put back to the
+    basemap's pixels, which keeps the precip layer to the rain and the text."""
 
     # Image to hold the quantize palette
     pal_img = Image.new("P", (1, 1))
 
-    pal_img.putpalette(INKY_FRAME_PALETTE, rawmode="RGB")
+    pal_img.putpalette(palette, rawmode="RGB")
+    scale = img.size[1] / DESIRED_HEIGHT
 
     # draw a bar in the bottom right showing the colour intesity legend using intensity_to_color
     if add_legend := True:
-        legend_width = 400
-        legend_start_x = DESIRED_WIDTH - legend_width - 3
-        legend_height = 16
-        legend_start_y = DESIRED_HEIGHT - legend_height - 3
+        legend_width = int(400 * scale)
+        legend_start_x = img.size[0] - legend_width - 3
+        legend_height = int(16 * scale)
+        legend_start_y = img.size[1] - legend_height - 3
         for i in range(int(legend_width)):
             intensity = int((i / legend_width) * (INTENSITY_MAX - INTENSITY_MIN) + INTENSITY_MIN)
             color = intensity_to_color(intensity)
@@ -377,14 +433,22 @@ def convert_to_bitmap(img):
         palette=pal_img, dither=Image.Dither.FLOYDSTEINBERG
     )
 
+    if over is not None:
+        basemap_img, rain = over
+        assert basemap_img.size == quantized_img.size
+        quantized_img.paste(basemap_img, (0, 0), Image.fromarray(np.where(rain, 0, 255).astype(np.uint8), "L"))
+
     if add_qr_code := False:
         combined.paste(qr_img, (1, 52)) # near the top left corner
 
-    if add_text := True:
-        TEXT_HEIGHT = 16
-        with open(IMAGE_INFO_FILE, "r") as f:
-            lines = f.readlines()
-            image_text = lines[1].strip().split("=")[1]
+    if add_text:
+        TEXT_HEIGHT = int(16 * scale)
+        if text is None:
+            with open(IMAGE_INFO_FILE, "r") as f:
+                lines = f.readlines()
+                image_text = lines[1].strip().split("=")[1]
+        else:
+            image_text = text
 
 
         # draw image_text in the lower-left corner with a semi-transparent background
@@ -393,14 +457,14 @@ def convert_to_bitmap(img):
         # https://www.dafont.com/minecraftia.font
         font = ImageFont.truetype("Minecraftia-Regular.ttf", TEXT_HEIGHT)
 
-        padding = 8
+        padding = int(8 * scale)
         x = padding
         y = quantized_img.size[1] - TEXT_HEIGHT - padding
 
         print(f"Adding text to image: {image_text}")
 
 
-        draw.text((x, y), image_text, font=font, fill=(0, 0, 0), stroke_width=3, stroke_fill=(0,0,0))
+        draw.text((x, y), image_text, font=font, fill=(0, 0, 0), stroke_width=max(1, round(3 * scale)), stroke_fill=(0,0,0))
         draw.text((x, y), image_text, font=font, fill=(255, 255, 255))
 
         # add point of interest
@@ -408,6 +472,23 @@ def convert_to_bitmap(img):
         # x,y = 100,200
         # draw.ellipse((x,y,x+w,y+w), fill=(255,0,0))
 
+    return quantized_img
+
+
+def pack_4bpp(pixels):
+    """The inky73's native format: two pixels per byte, high nibble is the left pixel."""
+    pixels = np.asarray(pixels, dtype=np.uint8).reshape(-1)
+    return ((pixels[0::2] << 4) | (pixels[1::2] & 0x0F)).tobytes()
+
+
+def pack_2bpp(pixels):
+    """Four pixels per byte, high bits are the left pixel. For the reduced colour quality tier."""
+    pixels = np.asarray(pixels, dtype=np.uint8).reshape(-1)
+    return ((pixels[0::4] << 6) | ((pixels[1::4] & 3) << 4) | ((pixels[2::4] & 3) << 2) | (pixels[3::4] & 3)).tobytes()
+
+
+def convert_to_bitmap(img, over=None):
+    quantized_img = quantize(img, over=over)
 
     # so we can see it
     quantized_img.convert("RGB").save(QUANTIZED_PNG_FILE)
@@ -431,6 +512,237 @@ def convert_to_bitmap(img):
         f.write(framebuffer)
     print("Wrote quantized framebuffer.")
 
+    # firmware built with RAIN_RADAR_DIRECT_STREAM pushes this straight to the panel.
+    with open(QUANTIZED_PACKED_BIN_FILE, "wb") as f:
+        f.write(pack_4bpp(np.frombuffer(framebuffer, dtype=np.uint8)))
+    print("Wrote packed framebuffer.")
+
+    return quantized_img
+
+
+PRECIP_LAYER_MAGIC = 0x4C505252  # "RRPL"
+
+
+def write_precip_layer(basemap_img, quantized_img):
+    """Write the quantized basemap, which the firmware keeps in flash, and the sparse layer of
+    pixels that differ from it, the rain and the text.
+
+    basemap.bin: u32 version, then the packed pixels. The version is a crc of the pixels,
+    so it only changes when the map does.
+    precip_layer.bin: u32 magic, u32 basemap version, u16 width, u16 height, u32 run count,
+    then runs sorted by row and column, each u16 y, u16 x, u16 len then len palette indices.
+    Everything is little endian.
+    """
+    base = np.array(basemap_img, dtype=np.uint8)
+    full = np.array(quantized_img, dtype=np.uint8)
+    assert base.shape == full.shape == (DESIRED_HEIGHT, DESIRED_WIDTH)
+
+    packed_base = pack_4bpp(base)
+    # 0 means "no basemap" on the device
+    version = zlib.crc32(packed_base) or 1
+    with open(BASEMAP_BIN_FILE, "wb") as f:
+        f.write(struct.pack("<I", version))
+        f.write(packed_base)
+
+    with open(PRECIP_LAYER_BIN_FILE, "wb") as f:
+        f.write(precip_layer_bytes(base, full, version))
+    print(f"Wrote precip layer, {PRECIP_LAYER_BIN_FILE.stat().st_size} bytes.")
+    return version
+
+
+def precip_layer_bytes(base, full, version):
+    """The pixels of full that differ from base as a precip layer, see write_precip_layer"""
+    runs = []
+    for y, row_diff in enumerate(base != full):
+        if not row_diff.any():
+            continue
+        # start and end of each run of differing pixels
+        edges = np.flatnonzero(np.diff(np.concatenate(([0], row_diff.view(np.int8), [0]))))
+        for x0, x1 in zip(edges[0::2], edges[1::2]):
+            runs.append(struct.pack("<HHH", y, x0, x1 - x0) + full[y, x0:x1].tobytes())
+
+    header = struct.pack("<IIHHI", PRECIP_LAYER_MAGIC, version, DESIRED_WIDTH, DESIRED_HEIGHT, len(runs))
+    return header + b"".join(runs)
+
+
+FORECAST_BUNDLE_MAGIC = 0x42465252  # "RRFB"
+BUNDLE_FRAMES = 4
+BUNDLE_STEP_SECS = 600
+
+
+def write_forecast_bundle(map_img, basemap_img, quantized_img, basemap_version, snapshot_time, now_offset, forecast_secs):
+    """The frame we just made plus the ones the next few wakes would get, so the firmware can
+    fetch them all at once and show them with the radio off.
+
+    forecast_bundle.bin: u32 magic, u32 basemap version, u16 frame count, u16 change,
+    u16 minutes between frames, u16 reserved, u32 length of each frame, then the frames, each a
+    precip layer. change is the most pixels, per mille, that differ between consecutive frames,
+    so the firmware can fetch afresh instead when the rain is moving quickly.
+    """
+    base = np.array(basemap_img, dtype=np.uint8)
+    frames = [np.array(quantized_img, dtype=np.uint8)]
+    for k in range(1, BUNDLE_FRAMES):
+        step = k * BUNDLE_STEP_SECS
+        # what build_image would make in step seconds time
+        download_range_of_tiles(ZOOM, TILE_X, TILE_Y, TILE_X+1, TILE_Y+1, snapshot_time, now_offset + step, forecast_secs + step)
+        map_time = dt.datetime.fromtimestamp(snapshot_time + now_offset + step, tz=ZoneInfo("Europe/London"))
+        text = map_time.strftime("%Y-%m-%d %H:%M:%S") + " + " + f"{forecast_secs//60} min forecast"
+        frame, rain = compose_frame(map_img)
+        frames.append(np.array(quantize(frame, text=text, over=(basemap_img, rain)), dtype=np.uint8))
+
+    change = max(int(np.count_nonzero(a != b) * 1000 // a.size) for a, b in zip(frames, frames[1:]))
+    layers = [precip_layer_bytes(base, frame, basemap_version) for frame in frames]
+
+    with open(FORECAST_BUNDLE_BIN_FILE, "wb") as f:
+        f.write(struct.pack("<IIHHHH", FORECAST_BUNDLE_MAGIC, basemap_version, len(layers), change, BUNDLE_STEP_SECS // 60, 0))
+        for layer in layers:
+            f.write(struct.pack("<I", len(layer)))
+        for layer in layers:
+            f.write(layer)
+    print(f"Wrote forecast bundle, {len(layers)} frames, change {change} per mille, {FORECAST_BUNDLE_BIN_FILE.stat().st_size} bytes.")
+
+
+RAIN_GRID_MAGIC = 0x47495252  # "RRIG"
+GRID_WIDTH = DESIRED_WIDTH // 4
+GRID_HEIGHT = DESIRED_HEIGHT // 4
+
+
+def stitch_raw_precip(zoom, tile_start_x, tile_start_y, tile_end_x, tile_end_y, ts, forecast_secs):
+    """Like download_range_of_tiles but for the raw dBZ tiles, which are already downloaded by then"""
+    tiles = {}
+    for x in range(tile_start_x, tile_end_x + 1):
+        for y in range(tile_start_y, tile_end_y + 1):
+            tiles[(x, y)] = Image.open(raw_precip_path(zoom, x, y, ts, forecast_secs)).convert("RGBA")
+    tile_width, tile_height = next(iter(tiles.values())).size
+    stitched = Image.new("RGBA", (tile_width * (tile_end_x - tile_start_x + 1), tile_height * (tile_end_y - tile_start_y + 1)))
+    for (x, y), tile in tiles.items():
+        stitched.paste(tile, ((x - tile_start_x) * tile_width, (y - tile_start_y) * tile_height))
+    return stitched
+
+
+def visible_intensity(raw_img):
+    """dBZ (bit 7 set for snow) wherever process_dbz_u8 would draw something, 0 elsewhere"""
+    pixels = np.array(raw_img)
+    intensity = pixels[:, :, 0].copy()
+    visible = (pixels[:, :, 3] != 0) & (((intensity & 128) != 0) | (intensity >= INTENSITY_MIN))
+    intensity[~visible] = 0
+    return intensity
+
+
+def write_rain_grid(raw_now_img, raw_forecast_img, basemap_version):
+    """The rain as a grid of intensities at a quarter of the display's resolution, for firmware
+    built with RAIN_RADAR_DEVICE_DITHER to dither over its cached basemap.
+
+    rain_grid.bin: u32 magic, u32 basemap version, u16 width, u16 height, u32 text length,
+    then a byte per cell a row at a time, then the caption. Everything is little endian.
+    """
+    now = visible_intensity(raw_now_img)
+    forecast = visible_intensity(raw_forecast_img)
+    # same as build_image: rain now is drawn at the lowest intensity, the forecast on top
+    grid = np.where(forecast != 0, forecast, np.where(now != 0, INTENSITY_MIN, 0)).astype(np.uint8)
+    grid = crop_to_display(Image.fromarray(grid, "L"), (GRID_WIDTH, GRID_HEIGHT), Image.NEAREST)
+
+    with open(IMAGE_INFO_FILE, "r") as f:
+        text = f.readlines()[1].strip().split("=")[1].encode()
+
+    with open(RAIN_GRID_BIN_FILE, "wb") as f:
+        f.write(struct.pack("<IIHHI", RAIN_GRID_MAGIC, basemap_version, GRID_WIDTH, GRID_HEIGHT, len(text)))
+        f.write(np.array(grid, dtype=np.uint8).tobytes())
+        f.write(text)
+    print(f"Wrote rain grid, {RAIN_GRID_BIN_FILE.stat().st_size} bytes.")
+
+
+FRAME_MAGIC = 0x52465252  # "RRFR"
+FRAME_VERSION = 1
+FRAME_HEADER_LEN = 32
+# what the payload is, the firmware falls back to the old files for any it doesn't know
+FRAME_ENCODING_RAW_8BPP = 0
+FRAME_ENCODING_PACKED_4BPP = 1
+FRAME_ENCODING_PRECIP_LAYER = 2
+FRAME_ENCODING_REDUCED_2BPP = 3
+FRAME_ENCODING_HALF_4BPP = 4
+# the quality tiers, for the firmware to pick from by its link and battery, see quality_tier.hpp
+FRAME_TIER_FILES = (FRAME_BIN_FILE, FRAME_REDUCED_BIN_FILE, FRAME_HALF_BIN_FILE)
+# this runs every PUBLISH_INTERVAL_SECS, and the new files are up PUBLISH_DELAY_SECS after that
+PUBLISH_INTERVAL_SECS = 600
+PUBLISH_DELAY_SECS = 90
+# the same points the firmware marks, in display pixels, see secrets_template.h
+POINTS_OF_INTEREST_XY = getattr(api_secrets, "POINTS_OF_INTEREST_XY", [])
+POI_RADIUS = 12
+
+
+def next_publish_time(current_time):
+    """When the run after this one should have its files up"""
+    now = int(current_time.timestamp())
+    return (now // PUBLISH_INTERVAL_SECS + 1) * PUBLISH_INTERVAL_SECS + PUBLISH_DELAY_SECS
+
+
+def poi_rain(raw_now_img, raw_forecast_img):
+    """The most rain within POI_RADIUS pixels of each point of interest, now and in the forecast,
+    as (x, y, now, forecast) with the intensities in dBZ, bit 7 set for snow"""
+    layers = []
+    for raw_img in (raw_now_img, raw_forecast_img):
+        visible = Image.fromarray(visible_intensity(raw_img), "L")
+        layers.append(np.array(crop_to_display(visible, resample=Image.NEAREST), dtype=np.uint8))
+
+    ys, xs = np.mgrid[0:DESIRED_HEIGHT, 0:DESIRED_WIDTH]
+    summary = []
+    for x, y in POINTS_OF_INTEREST_XY:
+        near = (xs - x) ** 2 + (ys - y) ** 2 <= POI_RADIUS ** 2
+        summary.append((x, y, *(int(layer[near].max(initial=0)) for layer in layers)))
+    return summary
+
+
+def quality_tier_payloads(combined_img, basemap_img, quantized_img, basemap_version):
+    """The (encoding, payload) for each of FRAME_TIER_FILES. Each tier is whichever of the encodings
+    at or above its quality is smallest, so a lower tier is never bigger than the one above it:
+    in light rain the precip layer is smaller than any of them."""
+    base = np.array(basemap_img, dtype=np.uint8)
+    full = np.array(quantized_img, dtype=np.uint8)
+    # quantize draws the legend on what it's given
+    reduced = quantize(combined_img.copy(), palette=REDUCED_PALETTE)
+    half = quantize(combined_img.resize((DESIRED_WIDTH // 2, DESIRED_HEIGHT // 2), Image.BOX))
+
+    options = [
+        (FRAME_ENCODING_PRECIP_LAYER, precip_layer_bytes(base, full, basemap_version)),
+        (FRAME_ENCODING_PACKED_4BPP, pack_4bpp(full)),
+    ]
+    tiers = []
+    for extra in ([], [(FRAME_ENCODING_REDUCED_2BPP, pack_2bpp(reduced))], [(FRAME_ENCODING_HALF_4BPP, pack_4bpp(half))]):
+        options += extra
+        tiers.append(min(options, key=lambda option: len(option[1])))
+    return tiers
+
+
+def write_frame_containers(combined_img, basemap_img, quantized_img, basemap_version, raw_now_img, raw_forecast_img, frame_time, next_publish):
+    """Each quality tier of the frame with a header saying what it is, so one request brings the
+    device everything it needs for the wake. Layout in firmware_c/rain_radar_app/frame_container.hpp.
+
+    u32 magic, u16 header length, u8 version, u8 encoding, u16 width, u16 height,
+    u32 frame time, u32 next publish time, u32 payload length, u32 payload crc32, u8 text length,
+    u8 poi count, u16 reserved, then the caption, then u16 x, u16 y, u8 now, u8 forecast for each
+    point of interest. Then the payload. Everything is little endian. Fields added later go on the
+    end of the header, the firmware skips what it doesn't know using the header length.
+    """
+    with open(IMAGE_INFO_FILE, "r") as f:
+        text = f.readlines()[1].strip().split("=")[1].encode()[:255]
+    pois = poi_rain(raw_now_img, raw_forecast_img)[:255]
+    tiers = quality_tier_payloads(combined_img, basemap_img, quantized_img, basemap_version)
+
+    for path, (encoding, payload) in zip(FRAME_TIER_FILES, tiers):
+        header = struct.pack(
+            "<IHBBHHIIIIBBH", FRAME_MAGIC, FRAME_HEADER_LEN + len(text) + 6 * len(pois), FRAME_VERSION, encoding,
+            DESIRED_WIDTH, DESIRED_HEIGHT, frame_time, next_publish, len(payload), zlib.crc32(payload), len(text), len(pois), 0,
+        )
+        assert len(header) == FRAME_HEADER_LEN
+        with open(path, "wb") as f:
+            f.write(header)
+            f.write(text)
+            for poi in pois:
+                f.write(struct.pack("<HHBB", *poi))
+            f.write(payload)
+        print(f"Wrote {path.name}, encoding {encoding}, {path.stat().st_size} bytes.")
+
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser()
@@ -454,6 +766,13 @@ if __name__ == "__main__":
             deploy_dir.mkdir(exist_ok=True)
             shutil.copy(QUANTIZED_PNG_FILE, deploy_dir / QUANTIZED_PNG_FILE.name)
             shutil.copy(QUANTIZED_BIN_FILE, deploy_dir / QUANTIZED_BIN_FILE.name)
+            shutil.copy(QUANTIZED_PACKED_BIN_FILE, deploy_dir / QUANTIZED_PACKED_BIN_FILE.name)
+            shutil.copy(BASEMAP_BIN_FILE, deploy_dir / BASEMAP_BIN_FILE.name)
+            shutil.copy(PRECIP_LAYER_BIN_FILE, deploy_dir / PRECIP_LAYER_BIN_FILE.name)
+            shutil.copy(RAIN_GRID_BIN_FILE, deploy_dir / RAIN_GRID_BIN_FILE.name)
+            shutil.copy(FORECAST_BUNDLE_BIN_FILE, deploy_dir / FORECAST_BUNDLE_BIN_FILE.name)
+            for frame_file in FRAME_TIER_FILES:
+                shutil.copy(frame_file, deploy_dir / frame_file.name)
             shutil.copy(IMAGE_INFO_FILE, deploy_dir / IMAGE_INFO_FILE.name)
             print(f"Copied images to {deploy_dir}")
 